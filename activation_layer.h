@@ -0,0 +1,71 @@
+#pragma once
+#include "lay.h"
+#include "activations.h"
+#include <vector>
+#include <string>
+#include <functional>
+#include <iostream>
+
+// A named activation applied elementwise, for inputs that come from layers
+// without one of their own, such as Conv2D or pooling.
+template<typename T>
+class ActivationLayer : public Lay<T> {
+private:
+    std::string m_name = "linear";
+    std::function<T(T)> m_activation;
+    std::function<T(T)> m_activation_deriv;
+    std::vector<T> m_last_input;
+
+public:
+    explicit ActivationLayer(const std::string& name = "linear") {
+        set_activation(name);
+    }
+
+    void set_activation(const std::string& name) {
+        m_name = name;
+        Activations<T>::select(name, m_activation, m_activation_deriv);
+    }
+
+    const std::string& activation_name() const { return m_name; }
+
+    std::string getType() const override { return "Activation"; }
+
+    void save(std::ostream& out) const override {
+        out << m_name << "\n";
+    }
+
+    void load(std::istream& in) override {
+        in >> m_name;
+        set_activation(m_name);
+    }
+
+    // Elementwise, so any layout works and no transform is needed.
+    Layout select_layout(const std::vector<size_t>& input_shape, Layout incoming) override {
+        return incoming;
+    }
+
+    std::vector<size_t> compile(const std::vector<size_t>& input_shape) override {
+        return input_shape;
+    }
+
+    std::vector<T> forward(const std::vector<T>& input) override {
+        return forward(std::vector<T>(input));
+    }
+
+    std::vector<T> forward(std::vector<T>&& input) override {
+        if (!this->m_inference) m_last_input = input;
+        for (auto& x : input) x = m_activation(x);
+        return std::move(input);
+    }
+
+    std::vector<T> backward(const std::vector<T>& output_gradient) override {
+        return backward(std::vector<T>(output_gradient));
+    }
+
+    std::vector<T> backward(std::vector<T>&& output_gradient) override {
+        for (size_t i = 0; i < output_gradient.size(); ++i) {
+            output_gradient[i] *= m_activation_deriv(m_last_input[i]);
+        }
+        return std::move(output_gradient);
+    }
+};
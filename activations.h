@@ -1,8 +1,10 @@
 #pragma once
+#include "kernels.h"
 #include <cmath>
 #include <functional>
 #include <vector>
 #include <algorithm>
+#include <string>
 
 template<typename T>
 struct Activations {
@@ -25,19 +27,32 @@ struct Activations {
     }
     
 
+    // Resolves an activation name as stored in model files; unknown names
+    // are linear.
+    static void select(const std::string& name,
+                       std::function<T(T)>& activation,
+                       std::function<T(T)>& derivative) {
+        if (name == "sigmoid") {
+            activation = sigmoid;
+            derivative = sigmoid_deriv;
+        } else if (name == "relu") {
+            activation = relu;
+            derivative = relu_deriv;
+        } else if (name == "leakyRelu") {
+            activation = leakyRelu;
+            derivative = leakyRelu_deriv;
+        } else if (name == "tanh") {
+            activation = tanh;
+            derivative = tanh_deriv;
+        } else {
+            activation = [](T x) { return x; };
+            derivative = [](T) { return 1; };
+        }
+    }
+
     static std::vector<T> softmax(const std::vector<T>& x) {
         std::vector<T> result(x.size());
-        T max_val = *std::max_element(x.begin(), x.end());
-        T sum = 0;
-        
-        for (size_t i = 0; i < x.size(); ++i) {
-            result[i] = std::exp(x[i] - max_val);
-            sum += result[i];
-        }
-        
-        for (auto& val : result) {
-            val /= sum;
-        }
+        softmax_rows(x.data(), 1, x.size(), result.data());
         return result;
     }
 };
\ No newline at end of file
@@ -0,0 +1,216 @@
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <type_traits>
+#include <algorithm>
+#include <sys/mman.h>
+
+// How blocks at or above the huge-page threshold are backed. Transparent
+// maps them 2 MiB aligned and asks the kernel to back them with huge pages
+// (MADV_HUGEPAGE). Explicit takes pages from the reserved hugetlbfs pool
+// (MAP_HUGETLB) and falls back to Transparent when none are free.
+enum class HugePages { Off, Transparent, Explicit };
+
+struct AllocationStats {
+    size_t allocations = 0;        // requests served, from the pool or not
+    size_t pool_hits = 0;          // requests served by a recycled block
+    size_t system_allocations = 0; // blocks obtained from the system
+    size_t huge_page_allocations = 0;
+    size_t bytes_in_use = 0;
+    size_t peak_bytes_in_use = 0;
+    size_t bytes_cached = 0;       // freed blocks kept for reuse
+};
+
+// Process-wide source of 64-byte aligned blocks. Freed blocks are kept in
+// per-size free lists, so buffers that are allocated and dropped on every
+// forward call come back without a system call or page faults once the
+// shapes have been seen. Sizes are rounded up to the block granularity
+// (64 bytes, or 2 MiB for huge-page blocks) so near sizes share a list.
+class BufferPool {
+public:
+    static constexpr size_t kAlignment = 64;
+    static constexpr size_t kHugePageSize = size_t(2) << 20;
+
+private:
+    std::mutex m_mutex;
+    std::unordered_map<size_t, std::vector<void*>> m_free;
+    // Blocks rounded to huge pages, by address, so they are found again
+    // whatever the settings are when they come back.
+    struct HugeBlock { size_t size; bool mapped; };
+    std::unordered_map<void*, HugeBlock> m_huge_blocks;
+    HugePages m_huge_pages = HugePages::Transparent;
+    size_t m_huge_page_threshold = kHugePageSize;
+    size_t m_max_cached_bytes = size_t(256) << 20;
+    AllocationStats m_stats;
+
+    BufferPool() = default;
+
+    static size_t round_up(size_t bytes, size_t granularity) {
+        return (bytes + granularity - 1) / granularity * granularity;
+    }
+
+    size_t block_size(void* block, size_t bytes) const {
+        auto it = m_huge_blocks.find(block);
+        return it != m_huge_blocks.end() ? it->second.size : round_up(bytes, kAlignment);
+    }
+
+    // Maps size bytes on a 2 MiB boundary by over-mapping and trimming.
+    void* map_huge(size_t size) {
+#ifdef MAP_HUGETLB
+        if (m_huge_pages == HugePages::Explicit) {
+            void* block = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (block != MAP_FAILED) return block;
+        }
+#endif
+        size_t span = size + kHugePageSize;
+        void* region = ::mmap(nullptr, span, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (region == MAP_FAILED) return nullptr;
+        char* base = static_cast<char*>(region);
+        char* block = base + (kHugePageSize - reinterpret_cast<uintptr_t>(base) % kHugePageSize) % kHugePageSize;
+        if (block > base) ::munmap(base, block - base);
+        if (base + span > block + size) ::munmap(block + size, base + span - (block + size));
+#ifdef MADV_HUGEPAGE
+        ::madvise(block, size, MADV_HUGEPAGE);
+#endif
+        return block;
+    }
+
+    void release_block(void* block, size_t size) {
+        auto it = m_huge_blocks.find(block);
+        if (it != m_huge_blocks.end() && it->second.mapped) {
+            ::munmap(block, size);
+        } else {
+            std::free(block);
+        }
+        if (it != m_huge_blocks.end()) m_huge_blocks.erase(it);
+    }
+
+public:
+    // Never destroyed, so containers in other static objects can still
+    // free into it during shutdown.
+    static BufferPool& instance() {
+        static BufferPool* pool = new BufferPool();
+        return *pool;
+    }
+
+    void* allocate(size_t bytes) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        bool huge = m_huge_pages != HugePages::Off && bytes >= m_huge_page_threshold;
+        size_t size = round_up(bytes, huge ? kHugePageSize : kAlignment);
+        ++m_stats.allocations;
+
+        void* block = nullptr;
+        auto it = m_free.find(size);
+        if (it != m_free.end() && !it->second.empty()) {
+            block = it->second.back();
+            it->second.pop_back();
+            ++m_stats.pool_hits;
+            m_stats.bytes_cached -= size;
+        } else {
+            if (huge) block = map_huge(size);
+            bool mapped = block != nullptr;
+            if (mapped) {
+                ++m_stats.huge_page_allocations;
+            } else {
+                block = std::aligned_alloc(huge ? kHugePageSize : kAlignment, size);
+                if (!block) throw std::bad_alloc();
+            }
+            if (huge) m_huge_blocks[block] = {size, mapped};
+            ++m_stats.system_allocations;
+        }
+        m_stats.bytes_in_use += size;
+        m_stats.peak_bytes_in_use = std::max(m_stats.peak_bytes_in_use, m_stats.bytes_in_use);
+        return block;
+    }
+
+    // bytes must be the size the block was allocated with.
+    void deallocate(void* block, size_t bytes) {
+        if (!block) return;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t size = block_size(block, bytes);
+        m_stats.bytes_in_use -= size;
+        if (m_stats.bytes_cached + size > m_max_cached_bytes) {
+            release_block(block, size);
+            return;
+        }
+        m_free[size].push_back(block);
+        m_stats.bytes_cached += size;
+    }
+
+    // Returns every cached block to the system.
+    void trim() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& entry : m_free) {
+            for (void* block : entry.second) release_block(block, entry.first);
+        }
+        m_free.clear();
+        m_stats.bytes_cached = 0;
+    }
+
+    // Applies to blocks allocated from now on; recycled blocks keep the
+    // backing they were created with.
+    void set_huge_pages(HugePages mode, size_t threshold = kHugePageSize) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_huge_pages = mode;
+        m_huge_page_threshold = threshold;
+    }
+
+    // Upper bound on the bytes held in the free lists; 0 disables recycling.
+    void set_max_cached_bytes(size_t bytes) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_max_cached_bytes = bytes;
+        }
+        if (bytes == 0) trim();
+    }
+
+    AllocationStats stats() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+
+    // Zeroes the counters; bytes in use and cached keep their values.
+    void reset_stats() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        AllocationStats fresh;
+        fresh.bytes_in_use = fresh.peak_bytes_in_use = m_stats.bytes_in_use;
+        fresh.bytes_cached = m_stats.bytes_cached;
+        m_stats = fresh;
+    }
+};
+
+// Stateless allocator over BufferPool, for std::vector and friends.
+template<typename T>
+struct AlignedAllocator {
+    using value_type = T;
+    using is_always_equal = std::true_type;
+
+    AlignedAllocator() = default;
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        if (n == 0) return nullptr;
+        if (n > size_t(-1) / sizeof(T)) throw std::bad_alloc();
+        return static_cast<T*>(BufferPool::instance().allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n) {
+        BufferPool::instance().deallocate(p, n * sizeof(T));
+    }
+
+    template<typename U>
+    bool operator==(const AlignedAllocator<U>&) const { return true; }
+    template<typename U>
+    bool operator!=(const AlignedAllocator<U>&) const { return false; }
+};
+
+template<typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
@@ -0,0 +1,258 @@
+#pragma once
+#include "lay.h"
+#include <vector>
+#include <stdexcept>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <algorithm>
+
+// Average pooling. Padded positions are not counted, so border windows
+// average only the inputs they actually cover.
+template<typename T>
+class AvgPool : public Lay<T> {
+private:
+    size_t m_input_height;
+    size_t m_input_width;
+    size_t m_channels;
+    size_t m_pool_size;
+    size_t m_stride;
+    size_t m_padding;
+    size_t m_output_height;
+    size_t m_output_width;
+    std::vector<T> m_inv_counts;
+    std::vector<T> m_scaled_row;
+    bool m_compiled = false;
+
+    void calculate_output_dimensions() {
+        if (m_pool_size == 0 || m_stride == 0) {
+            throw std::runtime_error("AvgPool: pool_size and stride must be positive");
+        }
+        if (m_padding >= m_pool_size) {
+            throw std::runtime_error("AvgPool: padding must be smaller than pool_size");
+        }
+        if (m_input_height + 2 * m_padding < m_pool_size ||
+            m_input_width + 2 * m_padding < m_pool_size) {
+            throw std::runtime_error("AvgPool: pool_size exceeds padded input dimensions");
+        }
+        m_output_height = (m_input_height + 2 * m_padding - m_pool_size) / m_stride + 1;
+        m_output_width = (m_input_width + 2 * m_padding - m_pool_size) / m_stride + 1;
+    }
+
+    // Output columns j whose input column j * stride + pw - padding is inside the row.
+    void valid_columns(size_t pw, size_t& j_begin, size_t& j_end) const {
+        j_begin = pw < m_padding ? (m_padding - pw + m_stride - 1) / m_stride : 0;
+        j_end = pw < m_input_width + m_padding
+            ? std::min(m_output_width, (m_input_width + m_padding - pw - 1) / m_stride + 1)
+            : 0;
+    }
+
+    static size_t covered(size_t start, size_t pool_size, size_t padding, size_t extent) {
+        size_t begin = std::max(start, padding);
+        size_t end = std::min(start + pool_size, extent + padding);
+        return end > begin ? end - begin : 0;
+    }
+
+public:
+    AvgPool(size_t input_height, size_t input_width, size_t channels, size_t pool_size,
+            size_t stride = 0, size_t padding = 0)
+        : m_input_height(input_height), m_input_width(input_width),
+          m_channels(channels), m_pool_size(pool_size),
+          m_stride(stride ? stride : pool_size), m_padding(padding)
+    {
+        calculate_output_dimensions();
+    }
+
+    AvgPool() = default;
+
+    std::string getType() const override { return "AvgPool"; }
+
+    void save(std::ostream& out) const override {
+        out << m_input_height << " " << m_input_width << " "
+            << m_channels << " " << m_pool_size << " "
+            << m_stride << " " << m_padding << "\n";
+    }
+
+    void load(std::istream& in) override {
+        in >> m_input_height >> m_input_width >> m_channels
+           >> m_pool_size >> m_stride >> m_padding;
+        if (in.fail()) {
+            throw std::runtime_error("AvgPool: failed to read parameters");
+        }
+        calculate_output_dimensions();
+        m_compiled = false;
+    }
+
+    std::vector<size_t> compile(const std::vector<size_t>& input_shape) override {
+        size_t expected = m_channels * m_input_height * m_input_width;
+        bool matches = input_shape.size() == 3
+            ? input_shape == std::vector<size_t>{m_channels, m_input_height, m_input_width}
+            : shape_size(input_shape) == expected;
+        if (!matches) {
+            std::ostringstream oss;
+            oss << "AvgPool: input shape mismatch. Expected: " << m_channels
+                << "x" << m_input_height << "x" << m_input_width
+                << " (" << expected << " values), Got: " << shape_size(input_shape);
+            throw std::runtime_error(oss.str());
+        }
+
+        m_inv_counts.resize(m_output_height * m_output_width);
+        for (size_t i = 0; i < m_output_height; ++i) {
+            size_t rows = covered(i * m_stride, m_pool_size, m_padding, m_input_height);
+            for (size_t j = 0; j < m_output_width; ++j) {
+                size_t cols = covered(j * m_stride, m_pool_size, m_padding, m_input_width);
+                m_inv_counts[i * m_output_width + j] = T(1) / static_cast<T>(rows * cols);
+            }
+        }
+        m_scaled_row.resize(m_output_width);
+
+        m_compiled = true;
+        return {m_channels, m_output_height, m_output_width};
+    }
+
+    std::vector<T> forward(const std::vector<T>& input) override {
+        if (!m_compiled) compile({input.size()});
+
+        size_t plane = m_output_height * m_output_width;
+        std::vector<T> output(plane * m_channels, T(0));
+
+        for (size_t c = 0; c < m_channels; ++c) {
+            const T* channel = &input[c * m_input_height * m_input_width];
+            for (size_t i = 0; i < m_output_height; ++i) {
+                T* out_row = &output[c * plane + i * m_output_width];
+
+                for (size_t ph = 0; ph < m_pool_size; ++ph) {
+                    size_t h = i * m_stride + ph;
+                    if (h < m_padding || h - m_padding >= m_input_height) continue;
+                    const T* in_row = channel + (h - m_padding) * m_input_width;
+
+                    for (size_t pw = 0; pw < m_pool_size; ++pw) {
+                        size_t j_begin, j_end;
+                        valid_columns(pw, j_begin, j_end);
+                        for (size_t j = j_begin; j < j_end; ++j) {
+                            out_row[j] += in_row[j * m_stride + pw - m_padding];
+                        }
+                    }
+                }
+
+                const T* inv_row = &m_inv_counts[i * m_output_width];
+                for (size_t j = 0; j < m_output_width; ++j) {
+                    out_row[j] *= inv_row[j];
+                }
+            }
+        }
+
+        return output;
+    }
+
+    std::vector<T> backward(const std::vector<T>& output_gradient) override {
+        size_t plane = m_output_height * m_output_width;
+        std::vector<T> input_gradient(m_input_height * m_input_width * m_channels, T(0));
+
+        for (size_t c = 0; c < m_channels; ++c) {
+            T* channel = &input_gradient[c * m_input_height * m_input_width];
+            for (size_t i = 0; i < m_output_height; ++i) {
+                const T* grad_row = &output_gradient[c * plane + i * m_output_width];
+                const T* inv_row = &m_inv_counts[i * m_output_width];
+                for (size_t j = 0; j < m_output_width; ++j) {
+                    m_scaled_row[j] = grad_row[j] * inv_row[j];
+                }
+
+                for (size_t ph = 0; ph < m_pool_size; ++ph) {
+                    size_t h = i * m_stride + ph;
+                    if (h < m_padding || h - m_padding >= m_input_height) continue;
+                    T* in_row = channel + (h - m_padding) * m_input_width;
+
+                    for (size_t pw = 0; pw < m_pool_size; ++pw) {
+                        size_t j_begin, j_end;
+                        valid_columns(pw, j_begin, j_end);
+                        for (size_t j = j_begin; j < j_end; ++j) {
+                            in_row[j * m_stride + pw - m_padding] += m_scaled_row[j];
+                        }
+                    }
+                }
+            }
+        }
+
+        return input_gradient;
+    }
+
+    void update_weights(T learning_rate) override {}
+};
+
+// Averages each channel down to a single value, turning a C x H x W
+// feature map into C features without a Dense layer over all of them.
+template<typename T>
+class GlobalAvgPool : public Lay<T> {
+private:
+    size_t m_input_height = 0;
+    size_t m_input_width = 0;
+    size_t m_channels = 0;
+
+public:
+    GlobalAvgPool(size_t input_height, size_t input_width, size_t channels)
+        : m_input_height(input_height), m_input_width(input_width), m_channels(channels) {}
+
+    GlobalAvgPool() = default;
+
+    std::string getType() const override { return "GlobalAvgPool"; }
+
+    void save(std::ostream& out) const override {
+        out << m_input_height << " " << m_input_width << " " << m_channels << "\n";
+    }
+
+    void load(std::istream& in) override {
+        in >> m_input_height >> m_input_width >> m_channels;
+        if (in.fail()) {
+            throw std::runtime_error("GlobalAvgPool: failed to read parameters");
+        }
+    }
+
+    std::vector<size_t> compile(const std::vector<size_t>& input_shape) override {
+        if (input_shape.size() == 3 && m_channels == 0) {
+            m_channels = input_shape[0];
+            m_input_height = input_shape[1];
+            m_input_width = input_shape[2];
+        }
+
+        size_t expected = m_channels * m_input_height * m_input_width;
+        bool matches = input_shape.size() == 3
+            ? input_shape == std::vector<size_t>{m_channels, m_input_height, m_input_width}
+            : shape_size(input_shape) == expected;
+        if (!matches || expected == 0) {
+            std::ostringstream oss;
+            oss << "GlobalAvgPool: input shape mismatch. Expected: " << m_channels
+                << "x" << m_input_height << "x" << m_input_width
+                << " (" << expected << " values), Got: " << shape_size(input_shape);
+            throw std::runtime_error(oss.str());
+        }
+        return {m_channels};
+    }
+
+    std::vector<T> forward(const std::vector<T>& input) override {
+        size_t plane = m_input_height * m_input_width;
+        T scale = T(1) / static_cast<T>(plane);
+        std::vector<T> output(m_channels);
+
+        for (size_t c = 0; c < m_channels; ++c) {
+            const T* channel = &input[c * plane];
+            T sum = 0;
+            for (size_t p = 0; p < plane; ++p) sum += channel[p];
+            output[c] = sum * scale;
+        }
+        return output;
+    }
+
+    std::vector<T> backward(const std::vector<T>& output_gradient) override {
+        size_t plane = m_input_height * m_input_width;
+        T scale = T(1) / static_cast<T>(plane);
+        std::vector<T> input_gradient(m_channels * plane);
+
+        for (size_t c = 0; c < m_channels; ++c) {
+            std::fill_n(&input_gradient[c * plane], plane, output_gradient[c] * scale);
+        }
+        return input_gradient;
+    }
+
+    void update_weights(T learning_rate) override {}
+};
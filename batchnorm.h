@@ -0,0 +1,463 @@
+#pragma once
+#include "lay.h"
+#include "layout.h"
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+
+// Per-channel batch normalization for C x H x W feature maps, or for flat
+// feature vectors (one channel per value). forward_batch() in training
+// normalizes each channel over every sample and position of the batch and
+// backward_batch() differentiates through those statistics; train through
+// Model::forward_batch (BackwardTrainer::train_batch) for real batch
+// normalization. forward() sees a batch of one sample: a feature map is
+// normalized over its own H x W positions, and a flat input, which has no
+// statistics of its own, with the running statistics as constants. Either
+// way the per-channel sums go into the current batch; update_weights(),
+// which ends each (possibly accumulated) batch, blends the batch mean and
+// variance into the running statistics used for inference and folding.
+template<typename T>
+class BatchNorm : public Lay<T> {
+private:
+    size_t m_channels = 0;
+    size_t m_plane = 1;
+    T m_momentum = T(0.1);
+    T m_epsilon = T(1e-5);
+    std::vector<T> m_gamma;
+    std::vector<T> m_beta;
+    std::vector<T> m_running_mean;
+    std::vector<T> m_running_var;
+    std::vector<T> m_dgamma;
+    std::vector<T> m_dbeta;
+
+    std::vector<T> m_scale;
+    std::vector<T> m_shift;
+    std::vector<T> m_inv_std;
+    std::vector<T> m_neg_mean_inv_std;
+    std::vector<T> m_sample_sum;
+    std::vector<T> m_sample_sqsum;
+    std::vector<T> m_sample_scale;
+    std::vector<T> m_sample_shift;
+    std::vector<T> m_sample_inv_std;
+    std::vector<T> m_sample_neg_mean_inv_std;
+    std::vector<T> m_grad_sum;
+    std::vector<T> m_grad_dot;
+    std::vector<T> m_grad_coef;
+    std::vector<T> m_normalized_coef;
+    std::vector<T> m_grad_shift;
+    bool m_sample_statistics = false;
+    // Statistics and normalized inputs of the last forward_batch().
+    bool m_batch_statistics = false;
+    std::vector<T> m_total_sum;
+    std::vector<T> m_total_dot;
+    std::vector<T> m_batch_normalized;
+    std::vector<T> m_batch_sum;
+    std::vector<T> m_batch_sqsum;
+    size_t m_batch_count = 0;
+    // False until the first batch: that batch's statistics replace the
+    // placeholder mean 0 / variance 1 outright instead of being blended in.
+    bool m_has_statistics = false;
+    std::vector<T> m_last_normalized;
+    Layout m_layout = Layout::NCHW;
+    size_t m_lanes = 1;
+    bool m_compiled = false;
+
+    // y = x * scale + shift with scale = gamma / std, shift = beta - mean * scale.
+    void refresh_affine() {
+        for (size_t c = 0; c < m_channels; ++c) {
+            m_inv_std[c] = T(1) / std::sqrt(m_running_var[c] + m_epsilon);
+            m_neg_mean_inv_std[c] = -m_running_mean[c] * m_inv_std[c];
+            m_scale[c] = m_gamma[c] * m_inv_std[c];
+            m_shift[c] = m_beta[c] - m_running_mean[c] * m_scale[c];
+        }
+    }
+
+    // sum[c] = sum of x, dot[c] = sum of x * y over the positions of channel c.
+    void channel_sums(const T* x, const T* y, T* sum, T* dot) const {
+        std::fill(sum, sum + m_channels, T(0));
+        std::fill(dot, dot + m_channels, T(0));
+        if (m_lanes == 1) {
+            for (size_t c = 0; c < m_channels; ++c) {
+                const T* xs = x + c * m_plane;
+                const T* ys = y + c * m_plane;
+                T s = 0;
+                T d = 0;
+                for (size_t p = 0; p < m_plane; ++p) {
+                    s += xs[p];
+                    d += xs[p] * ys[p];
+                }
+                sum[c] = s;
+                dot[c] = d;
+            }
+            return;
+        }
+        for (size_t b = 0; b < m_channels / m_lanes; ++b) {
+            T* s = sum + b * m_lanes;
+            T* d = dot + b * m_lanes;
+            for (size_t p = 0; p < m_plane; ++p) {
+                size_t offset = (b * m_plane + p) * m_lanes;
+                for (size_t l = 0; l < m_lanes; ++l) {
+                    s[l] += x[offset + l];
+                    d[l] += x[offset + l] * y[offset + l];
+                }
+            }
+        }
+    }
+
+    // out = x * a[c] + y * b[c] + shift[c]; y and b may be null.
+    void per_channel(const T* x, const T* a, const T* y, const T* b,
+                     const T* shift, T* out) const {
+        if (m_lanes == 1) {
+            for (size_t c = 0; c < m_channels; ++c) {
+                size_t offset = c * m_plane;
+                T scale = a[c];
+                T bias = shift[c];
+                if (y) {
+                    T scale_y = b[c];
+                    for (size_t p = 0; p < m_plane; ++p) {
+                        out[offset + p] = x[offset + p] * scale + y[offset + p] * scale_y + bias;
+                    }
+                } else {
+                    for (size_t p = 0; p < m_plane; ++p) out[offset + p] = x[offset + p] * scale + bias;
+                }
+            }
+            return;
+        }
+        for (size_t blk = 0; blk < m_channels / m_lanes; ++blk) {
+            const T* scale = a + blk * m_lanes;
+            const T* scale_y = y ? b + blk * m_lanes : nullptr;
+            const T* bias = shift + blk * m_lanes;
+            for (size_t p = 0; p < m_plane; ++p) {
+                size_t offset = (blk * m_plane + p) * m_lanes;
+                for (size_t l = 0; l < m_lanes; ++l) {
+                    T value = x[offset + l] * scale[l] + bias[l];
+                    if (y) value += y[offset + l] * scale_y[l];
+                    out[offset + l] = value;
+                }
+            }
+        }
+    }
+
+public:
+    explicit BatchNorm(size_t channels = 0, T momentum = T(0.1), T epsilon = T(1e-5))
+        : m_channels(channels), m_momentum(momentum), m_epsilon(epsilon) {}
+
+    std::string getType() const override { return "BatchNorm"; }
+
+    size_t channels() const { return m_channels; }
+
+    // The affine map inference applies: y = x * scale[c] + shift[c].
+    void inference_affine(std::vector<T>& scale, std::vector<T>& shift) const {
+        scale.resize(m_gamma.size());
+        shift.resize(m_gamma.size());
+        for (size_t c = 0; c < m_gamma.size(); ++c) {
+            T inv_std = T(1) / std::sqrt(m_running_var[c] + m_epsilon);
+            scale[c] = m_gamma[c] * inv_std;
+            shift[c] = m_beta[c] - m_running_mean[c] * scale[c];
+        }
+    }
+
+    Layout select_layout(const std::vector<size_t>& input_shape, Layout incoming) override {
+        size_t channels = input_shape.size() == 3 ? input_shape[0] : shape_size(input_shape);
+        m_layout = input_shape.size() == 3 && layout_supports(incoming, channels)
+            ? incoming : Layout::NCHW;
+        return m_layout;
+    }
+
+    void save(std::ostream& out) const override {
+        out << m_channels << " " << m_plane << " " << m_momentum << " " << m_epsilon << "\n";
+        for (const auto& v : m_gamma) out << v << " ";
+        out << "\n";
+        for (const auto& v : m_beta) out << v << " ";
+        out << "\n";
+        for (const auto& v : m_running_mean) out << v << " ";
+        out << "\n";
+        for (const auto& v : m_running_var) out << v << " ";
+        out << "\n";
+    }
+
+    void load(std::istream& in) override {
+        in >> m_channels >> m_plane >> m_momentum >> m_epsilon;
+        if (in.fail()) {
+            throw std::runtime_error("BatchNorm: failed to read parameters");
+        }
+        for (auto* values : {&m_gamma, &m_beta, &m_running_mean, &m_running_var}) {
+            values->resize(m_channels);
+            for (auto& v : *values) in >> v;
+        }
+        if (in.fail()) {
+            throw std::runtime_error("BatchNorm: data truncated");
+        }
+        m_has_statistics = true;
+        m_compiled = false;
+    }
+
+    std::vector<size_t> compile(const std::vector<size_t>& input_shape) override {
+        size_t channels = shape_size(input_shape);
+        size_t plane = 1;
+        if (input_shape.size() == 3) {
+            channels = input_shape[0];
+            plane = input_shape[1] * input_shape[2];
+        } else if (m_plane > 1 && channels == m_channels * m_plane) {
+            channels = m_channels;
+            plane = m_plane;
+        }
+        if (m_gamma.empty()) {
+            if (m_channels == 0) m_channels = channels;
+            m_gamma.assign(m_channels, T(1));
+            m_beta.assign(m_channels, T(0));
+            m_running_mean.assign(m_channels, T(0));
+            m_running_var.assign(m_channels, T(1));
+        }
+        if (channels != m_channels) {
+            std::ostringstream oss;
+            oss << "BatchNorm: input shape mismatch. Expected " << m_channels
+                << " channels, Got: " << channels;
+            throw std::runtime_error(oss.str());
+        }
+        if (!layout_supports(m_layout, m_channels)) {
+            throw std::runtime_error("BatchNorm: " + layout_name(m_layout) +
+                                     " needs a channel count divisible by " +
+                                     std::to_string(kChannelBlock));
+        }
+
+        m_plane = plane;
+        m_lanes = layout_lanes(m_layout, m_channels);
+        this->allocate_gradient(m_dgamma, m_channels);
+        this->allocate_gradient(m_dbeta, m_channels);
+        m_scale.resize(m_channels);
+        m_shift.resize(m_channels);
+        m_inv_std.resize(m_channels);
+        m_neg_mean_inv_std.resize(m_channels);
+        for (auto* buffer : {&m_sample_sum, &m_sample_sqsum, &m_sample_scale, &m_sample_shift,
+                             &m_sample_inv_std, &m_sample_neg_mean_inv_std, &m_grad_sum,
+                             &m_grad_dot, &m_grad_coef, &m_normalized_coef, &m_grad_shift,
+                             &m_total_sum, &m_total_dot}) {
+            buffer->resize(m_channels);
+        }
+        m_batch_sum.assign(m_channels, T(0));
+        m_batch_sqsum.assign(m_channels, T(0));
+        m_batch_count = 0;
+        m_last_normalized.resize(m_channels * m_plane);
+        refresh_affine();
+        m_compiled = true;
+        return input_shape;
+    }
+
+    std::vector<T> forward(const std::vector<T>& input) override {
+        if (!m_compiled) compile({input.size()});
+
+        std::vector<T> output(input.size());
+        bool training = !this->m_inference && this->m_trainable;
+        if (!training) {
+            per_channel(input.data(), m_scale.data(), nullptr, nullptr, m_shift.data(), output.data());
+            return output;
+        }
+
+        channel_sums(input.data(), input.data(), m_sample_sum.data(), m_sample_sqsum.data());
+        for (size_t c = 0; c < m_channels; ++c) {
+            m_batch_sum[c] += m_sample_sum[c];
+            m_batch_sqsum[c] += m_sample_sqsum[c];
+        }
+        ++m_batch_count;
+
+        m_sample_statistics = m_plane > 1;
+        const T* inv_std = m_inv_std.data();
+        const T* neg_mean_inv_std = m_neg_mean_inv_std.data();
+        if (m_sample_statistics) {
+            T inv_plane = T(1) / static_cast<T>(m_plane);
+            for (size_t c = 0; c < m_channels; ++c) {
+                T mean = m_sample_sum[c] * inv_plane;
+                T var = std::max(T(0), m_sample_sqsum[c] * inv_plane - mean * mean);
+                m_sample_inv_std[c] = T(1) / std::sqrt(var + m_epsilon);
+                m_sample_neg_mean_inv_std[c] = -mean * m_sample_inv_std[c];
+            }
+            inv_std = m_sample_inv_std.data();
+            neg_mean_inv_std = m_sample_neg_mean_inv_std.data();
+        }
+
+        per_channel(input.data(), inv_std, nullptr, nullptr, neg_mean_inv_std,
+                    m_last_normalized.data());
+        per_channel(m_last_normalized.data(), m_gamma.data(), nullptr, nullptr,
+                    m_beta.data(), output.data());
+        return output;
+    }
+
+    // With per-sample statistics over N positions:
+    // dx = gamma * inv_std / N * (N * g - sum(g) - x_hat * sum(g * x_hat)).
+    std::vector<T> backward(const std::vector<T>& output_gradient) override {
+        channel_sums(output_gradient.data(), m_last_normalized.data(),
+                     m_grad_sum.data(), m_grad_dot.data());
+        if (this->m_trainable && !m_dgamma.empty()) {
+            for (size_t c = 0; c < m_channels; ++c) {
+                m_dgamma[c] += m_grad_dot[c];
+                m_dbeta[c] += m_grad_sum[c];
+            }
+        }
+
+        std::vector<T> input_gradient;
+        if (!this->m_input_gradient_required) return input_gradient;
+
+        input_gradient.resize(output_gradient.size());
+        if (!m_sample_statistics) {
+            std::fill(m_grad_shift.begin(), m_grad_shift.end(), T(0));
+            per_channel(output_gradient.data(), m_scale.data(), nullptr, nullptr,
+                        m_grad_shift.data(), input_gradient.data());
+            return input_gradient;
+        }
+
+        T inv_plane = T(1) / static_cast<T>(m_plane);
+        for (size_t c = 0; c < m_channels; ++c) {
+            T scale = m_gamma[c] * m_sample_inv_std[c];
+            m_grad_coef[c] = scale;
+            m_normalized_coef[c] = -scale * m_grad_dot[c] * inv_plane;
+            m_grad_shift[c] = -scale * m_grad_sum[c] * inv_plane;
+        }
+        per_channel(output_gradient.data(), m_grad_coef.data(), m_last_normalized.data(),
+                    m_normalized_coef.data(), m_grad_shift.data(), input_gradient.data());
+        return input_gradient;
+    }
+
+    // Batch statistics: mean and variance over all count * H * W values of
+    // each channel. A batch of one takes the forward() path.
+    std::vector<T> forward_batch(const std::vector<T>& inputs, size_t count) override {
+        if (!m_compiled) compile({count ? inputs.size() / count : 0});
+
+        m_batch_statistics = false;
+        bool training = !this->m_inference && this->m_trainable;
+        if (training && count == 1) return forward(inputs);
+
+        size_t size = m_channels * m_plane;
+        std::vector<T> outputs(inputs.size());
+        if (!training) {
+            for (size_t n = 0; n < count; ++n) {
+                per_channel(inputs.data() + n * size, m_scale.data(), nullptr, nullptr,
+                            m_shift.data(), outputs.data() + n * size);
+            }
+            return outputs;
+        }
+
+        std::fill(m_total_sum.begin(), m_total_sum.end(), T(0));
+        std::fill(m_total_dot.begin(), m_total_dot.end(), T(0));
+        for (size_t n = 0; n < count; ++n) {
+            const T* x = inputs.data() + n * size;
+            channel_sums(x, x, m_sample_sum.data(), m_sample_sqsum.data());
+            for (size_t c = 0; c < m_channels; ++c) {
+                m_total_sum[c] += m_sample_sum[c];
+                m_total_dot[c] += m_sample_sqsum[c];
+            }
+        }
+        T inv_values = T(1) / static_cast<T>(count * m_plane);
+        for (size_t c = 0; c < m_channels; ++c) {
+            m_batch_sum[c] += m_total_sum[c];
+            m_batch_sqsum[c] += m_total_dot[c];
+            T mean = m_total_sum[c] * inv_values;
+            T var = std::max(T(0), m_total_dot[c] * inv_values - mean * mean);
+            m_sample_inv_std[c] = T(1) / std::sqrt(var + m_epsilon);
+            m_sample_neg_mean_inv_std[c] = -mean * m_sample_inv_std[c];
+        }
+        m_batch_count += count;
+
+        m_batch_normalized.resize(inputs.size());
+        for (size_t n = 0; n < count; ++n) {
+            T* normalized = m_batch_normalized.data() + n * size;
+            per_channel(inputs.data() + n * size, m_sample_inv_std.data(), nullptr, nullptr,
+                        m_sample_neg_mean_inv_std.data(), normalized);
+            per_channel(normalized, m_gamma.data(), nullptr, nullptr, m_beta.data(), outputs.data() + n * size);
+        }
+        m_batch_statistics = true;
+        return outputs;
+    }
+
+    // The backward() formula with N = count * H * W and the sums taken
+    // over the whole batch.
+    std::vector<T> backward_batch(const std::vector<T>& output_gradients, size_t count) override {
+        if (!m_batch_statistics) return backward(output_gradients);
+
+        size_t size = m_channels * m_plane;
+        std::fill(m_total_sum.begin(), m_total_sum.end(), T(0));
+        std::fill(m_total_dot.begin(), m_total_dot.end(), T(0));
+        for (size_t n = 0; n < count; ++n) {
+            channel_sums(output_gradients.data() + n * size, m_batch_normalized.data() + n * size,
+                         m_grad_sum.data(), m_grad_dot.data());
+            for (size_t c = 0; c < m_channels; ++c) {
+                m_total_sum[c] += m_grad_sum[c];
+                m_total_dot[c] += m_grad_dot[c];
+            }
+        }
+        if (this->m_trainable && !m_dgamma.empty()) {
+            for (size_t c = 0; c < m_channels; ++c) {
+                m_dgamma[c] += m_total_dot[c];
+                m_dbeta[c] += m_total_sum[c];
+            }
+        }
+
+        std::vector<T> input_gradients;
+        if (!this->m_input_gradient_required) return input_gradients;
+
+        T inv_values = T(1) / static_cast<T>(count * m_plane);
+        for (size_t c = 0; c < m_channels; ++c) {
+            T scale = m_gamma[c] * m_sample_inv_std[c];
+            m_grad_coef[c] = scale;
+            m_normalized_coef[c] = -scale * m_total_dot[c] * inv_values;
+            m_grad_shift[c] = -scale * m_total_sum[c] * inv_values;
+        }
+        input_gradients.resize(output_gradients.size());
+        for (size_t n = 0; n < count; ++n) {
+            per_channel(output_gradients.data() + n * size, m_grad_coef.data(),
+                        m_batch_normalized.data() + n * size, m_normalized_coef.data(),
+                        m_grad_shift.data(), input_gradients.data() + n * size);
+        }
+        return input_gradients;
+    }
+
+    void reinitialize() override {
+        if (m_gamma.empty()) return;
+        std::fill(m_gamma.begin(), m_gamma.end(), T(1));
+        std::fill(m_running_var.begin(), m_running_var.end(), T(1));
+        for (auto* values : {&m_beta, &m_running_mean, &m_dgamma, &m_dbeta, &m_batch_sum, &m_batch_sqsum}) {
+            std::fill(values->begin(), values->end(), T(0));
+        }
+        m_batch_count = 0;
+        m_has_statistics = false;
+        if (m_compiled) refresh_affine();
+    }
+
+    void collect_params(std::vector<ParamRef<T>>& params) override {
+        bool frozen = m_dgamma.empty();
+        params.push_back({m_gamma.data(), frozen ? nullptr : m_dgamma.data(), m_gamma.size()});
+        params.push_back({m_beta.data(), frozen ? nullptr : m_dbeta.data(), m_beta.size()});
+        params.push_back({m_running_mean.data(), nullptr, m_running_mean.size()});
+        params.push_back({m_running_var.data(), nullptr, m_running_var.size()});
+    }
+
+    void update_weights(T learning_rate) override {
+        if (m_dgamma.empty()) return;
+        for (size_t c = 0; c < m_channels; ++c) {
+            m_gamma[c] -= learning_rate * m_dgamma[c];
+            m_beta[c] -= learning_rate * m_dbeta[c];
+            m_dgamma[c] = 0;
+            m_dbeta[c] = 0;
+        }
+
+        if (m_batch_count > 0) {
+            T count = static_cast<T>(m_batch_count * m_plane);
+            for (size_t c = 0; c < m_channels; ++c) {
+                T mean = m_batch_sum[c] / count;
+                T var = std::max(T(0), m_batch_sqsum[c] / count - mean * mean);
+                T momentum = m_has_statistics ? m_momentum : T(1);
+                m_running_mean[c] += momentum * (mean - m_running_mean[c]);
+                m_running_var[c] += momentum * (var - m_running_var[c]);
+            }
+            std::fill(m_batch_sum.begin(), m_batch_sum.end(), T(0));
+            std::fill(m_batch_sqsum.begin(), m_batch_sqsum.end(), T(0));
+            m_batch_count = 0;
+            m_has_statistics = true;
+        }
+        refresh_affine();
+    }
+};
@@ -0,0 +1,421 @@
+#pragma once
+#include "model.h"
+#include "trainer.h"
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+#include <unistd.h>
+
+// Where training stood when a snapshot was taken, so a run can resume in
+// the middle of an epoch.
+struct TrainingState {
+    uint64_t epoch = 0;
+    uint64_t sample = 0;
+    uint64_t step = 0;
+    double learning_rate = 0;
+    // BackwardTrainer progress: completed updates, and samples summed into
+    // the gradient buffers since the last one.
+    uint64_t updates = 0;
+    uint64_t accumulated = 0;
+};
+
+// Writes checkpoints on a background thread. snapshot() only copies the
+// parameters into a staging buffer; encoding and writing happen off the
+// training thread. Every full_interval-th checkpoint is written in full
+// to <path>.full; the others go to <path>.delta as the XOR of each value's
+// bits against that full checkpoint. A small update leaves the sign,
+// exponent and top of the mantissa alone, so only the low, non-zero bytes
+// of each XOR word are stored, and runs of unchanged values collapse.
+// While a trainer is part way through an accumulation its gradient sums
+// are saved after the parameters. Both files are replaced with an atomic
+// rename.
+template<typename T>
+class AsyncCheckpointer {
+    static_assert(std::is_floating_point<T>::value, "AsyncCheckpointer needs a floating point type");
+    using Word = typename std::conditional<sizeof(T) == 4, uint32_t, uint64_t>::type;
+
+    struct Snapshot {
+        std::vector<T> values;
+        size_t gradient_count = 0;
+        TrainingState state;
+    };
+
+    static constexpr uint32_t kMagic = 0x4b434e4e;  // "NNCK"
+    static constexpr uint32_t kVersion = 2;
+    enum Kind : uint32_t { Full = 0, Delta = 1 };
+
+    struct Header {
+        uint32_t magic = kMagic;
+        uint32_t version = kVersion;
+        uint32_t kind = Full;
+        uint32_t value_size = sizeof(T);
+        uint64_t id = 0;
+        uint64_t base_id = 0;
+        uint64_t count = 0;          // values, gradient sums included
+        uint64_t gradient_count = 0; // trailing values that are gradient sums
+        uint64_t payload_size = 0;
+        uint64_t checksum = 0;
+        TrainingState state;
+    };
+
+    Model<T>& m_model;
+    std::string m_path;
+    size_t m_full_interval;
+
+    Snapshot m_staged;
+    Snapshot m_writing;
+    bool m_pending = false;
+    bool m_busy = false;
+    bool m_stop = false;
+    std::string m_error;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::thread m_writer;
+
+    // Touched only by the writer thread.
+    std::vector<T> m_base;
+    uint64_t m_base_id = 0;
+    uint64_t m_next_id = 1;
+    size_t m_since_full = 0;
+    std::vector<uint8_t> m_payload;
+
+    static uint64_t checksum(const uint8_t* data, size_t size) {
+        uint64_t hash = 1469598103934665603ull;
+        for (size_t i = 0; i < size; ++i) {
+            hash ^= data[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    static void put_varint(std::vector<uint8_t>& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    static bool get_varint(const uint8_t*& in, const uint8_t* end, uint64_t& value) {
+        value = 0;
+        for (int shift = 0; in < end && shift < 64; shift += 7) {
+            uint8_t byte = *in++;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+
+    static Word bits(T value) {
+        Word word;
+        std::memcpy(&word, &value, sizeof(T));
+        return word;
+    }
+
+    static T from_bits(Word word) {
+        T value;
+        std::memcpy(&value, &word, sizeof(T));
+        return value;
+    }
+
+    static unsigned significant_bytes(Word word) {
+        unsigned bytes = 0;
+        for (; word; word >>= 8) ++bytes;
+        return bytes;
+    }
+
+    // Alternating (unchanged run, changed run) records. A changed run is
+    // followed by one 4-bit byte count per word, two to a byte, and then
+    // the low bytes of each XOR word.
+    void encode_delta(const std::vector<T>& values) {
+        m_payload.clear();
+        size_t i = 0;
+        while (i < values.size()) {
+            size_t zeros = 0;
+            while (i + zeros < values.size() && bits(values[i + zeros]) == bits(m_base[i + zeros])) ++zeros;
+            size_t start = i + zeros;
+            size_t literals = 0;
+            while (start + literals < values.size() &&
+                   bits(values[start + literals]) != bits(m_base[start + literals])) ++literals;
+
+            put_varint(m_payload, zeros);
+            put_varint(m_payload, literals);
+            size_t lengths = m_payload.size();
+            m_payload.resize(lengths + (literals + 1) / 2, 0);
+            for (size_t k = 0; k < literals; ++k) {
+                Word word = bits(values[start + k]) ^ bits(m_base[start + k]);
+                unsigned bytes = significant_bytes(word);
+                m_payload[lengths + k / 2] |= static_cast<uint8_t>(bytes << (k % 2 * 4));
+                for (unsigned b = 0; b < bytes; ++b) m_payload.push_back(static_cast<uint8_t>(word >> (8 * b)));
+            }
+            i = start + literals;
+        }
+    }
+
+    static bool decode_delta(const std::vector<uint8_t>& payload, std::vector<T>& values) {
+        const uint8_t* in = payload.data();
+        const uint8_t* end = in + payload.size();
+        size_t i = 0;
+        while (in < end) {
+            uint64_t zeros, literals;
+            if (!get_varint(in, end, zeros) || !get_varint(in, end, literals)) return false;
+            // Compared by subtraction so corrupt counts cannot overflow.
+            if (zeros > values.size() - i) return false;
+            i += zeros;
+            if (literals > values.size() - i ||
+                (literals + 1) / 2 > static_cast<size_t>(end - in)) return false;
+            const uint8_t* lengths = in;
+            in += (literals + 1) / 2;
+            for (uint64_t k = 0; k < literals; ++k, ++i) {
+                unsigned bytes = (lengths[k / 2] >> (k % 2 * 4)) & 0xf;
+                if (bytes == 0 || bytes > sizeof(Word) || bytes > static_cast<size_t>(end - in)) return false;
+                Word word = 0;
+                for (unsigned b = 0; b < bytes; ++b) word |= static_cast<Word>(*in++) << (8 * b);
+                values[i] = from_bits(bits(values[i]) ^ word);
+            }
+        }
+        return true;
+    }
+
+    void write_file(const std::string& path, const Header& header, const uint8_t* payload) {
+        std::string temp = path + ".tmp";
+        FILE* file = std::fopen(temp.c_str(), "wb");
+        if (!file) throw std::runtime_error("Cannot open " + temp + " for writing");
+
+        bool ok = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  (header.payload_size == 0 ||
+                   std::fwrite(payload, header.payload_size, 1, file) == 1) &&
+                  std::fflush(file) == 0 && ::fsync(fileno(file)) == 0;
+        ok = std::fclose(file) == 0 && ok;
+        if (!ok || std::rename(temp.c_str(), path.c_str()) != 0) {
+            std::remove(temp.c_str());
+            throw std::runtime_error("Failed to write checkpoint " + path);
+        }
+    }
+
+    bool read_file(const std::string& path, Header& header, std::vector<uint8_t>& payload) const {
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file) return false;
+
+        bool ok = std::fread(&header, sizeof(header), 1, file) == 1 &&
+                  header.magic == kMagic && header.version == kVersion &&
+                  header.value_size == sizeof(T);
+        // payload_size is not covered by the checksum, so it must match the
+        // rest of the file before it sizes the buffer.
+        long start = ok ? std::ftell(file) : -1;
+        ok = ok && start >= 0 && std::fseek(file, 0, SEEK_END) == 0;
+        long end = ok ? std::ftell(file) : -1;
+        ok = ok && end >= start && std::fseek(file, start, SEEK_SET) == 0 &&
+             header.payload_size == static_cast<uint64_t>(end - start);
+        if (ok) {
+            payload.resize(header.payload_size);
+            ok = header.payload_size == 0 ||
+                 std::fread(payload.data(), header.payload_size, 1, file) == 1;
+        }
+        std::fclose(file);
+        return ok && checksum(payload.data(), payload.size()) == header.checksum;
+    }
+
+    void write(const Snapshot& snapshot) {
+        Header header;
+        header.id = m_next_id++;
+        header.count = snapshot.values.size();
+        header.gradient_count = snapshot.gradient_count;
+        header.state = snapshot.state;
+
+        bool full = m_since_full == 0 || m_base.size() != snapshot.values.size();
+        if (full) {
+            header.kind = Full;
+            header.base_id = header.id;
+            header.payload_size = snapshot.values.size() * sizeof(T);
+            const uint8_t* raw = reinterpret_cast<const uint8_t*>(snapshot.values.data());
+            header.checksum = checksum(raw, header.payload_size);
+            write_file(m_path + ".full", header, raw);
+            std::remove((m_path + ".delta").c_str());
+            m_base = snapshot.values;
+            m_base_id = header.id;
+        } else {
+            encode_delta(snapshot.values);
+            header.kind = Delta;
+            header.base_id = m_base_id;
+            header.payload_size = m_payload.size();
+            header.checksum = checksum(m_payload.data(), m_payload.size());
+            write_file(m_path + ".delta", header, m_payload.data());
+        }
+        m_since_full = (m_since_full + 1) % m_full_interval;
+    }
+
+    void writer_loop() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            m_cv.wait(lock, [this] { return m_stop || m_pending; });
+            if (!m_pending) break;
+
+            std::swap(m_staged, m_writing);
+            m_pending = false;
+            m_busy = true;
+            lock.unlock();
+
+            std::string error;
+            try {
+                write(m_writing);
+            } catch (const std::exception& e) {
+                error = e.what();
+            }
+
+            lock.lock();
+            m_busy = false;
+            if (!error.empty()) m_error = error;
+            m_cv.notify_all();
+        }
+    }
+
+public:
+    AsyncCheckpointer(Model<T>& model, const std::string& path, size_t full_interval = 10)
+        : m_model(model), m_path(path), m_full_interval(full_interval ? full_interval : 1) {
+        m_writer = std::thread(&AsyncCheckpointer::writer_loop, this);
+    }
+
+    ~AsyncCheckpointer() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        m_writer.join();
+    }
+
+    AsyncCheckpointer(const AsyncCheckpointer&) = delete;
+    AsyncCheckpointer& operator=(const AsyncCheckpointer&) = delete;
+
+    // Copies the parameters and returns. Only blocks if the previous
+    // snapshot has not been picked up by the writer yet.
+    void snapshot(const TrainingState& state) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this] { return !m_pending; });
+        if (!m_error.empty()) {
+            std::string error = std::move(m_error);
+            m_error.clear();
+            throw std::runtime_error(error);
+        }
+
+        auto params = m_model.params();
+        m_staged.values.clear();
+        for (const auto& param : params) {
+            m_staged.values.insert(m_staged.values.end(), param.values, param.values + param.size);
+        }
+        m_staged.gradient_count = 0;
+        if (state.accumulated > 0) {
+            for (const auto& param : params) {
+                if (!param.grads) continue;
+                m_staged.values.insert(m_staged.values.end(), param.grads, param.grads + param.size);
+                m_staged.gradient_count += param.size;
+            }
+        }
+        m_staged.state = state;
+        m_pending = true;
+        m_cv.notify_all();
+    }
+
+    // Also records the trainer's progress, so that a partial accumulation
+    // and the warmup schedule survive a restore.
+    void snapshot(TrainingState state, const BackwardTrainer<T>& trainer) {
+        state.updates = trainer.update_count();
+        state.accumulated = trainer.accumulated_count();
+        snapshot(state);
+    }
+
+    // Blocks until every snapshot taken so far is on disk.
+    void wait() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [this] { return !m_pending && !m_busy; });
+        if (!m_error.empty()) {
+            std::string error = std::move(m_error);
+            m_error.clear();
+            throw std::runtime_error(error);
+        }
+    }
+
+    // Loads the newest checkpoint into the model, which must already have
+    // the same architecture and be compiled. Returns false if there is none.
+    bool restore(TrainingState& state) {
+        wait();
+
+        Header full;
+        std::vector<uint8_t> payload;
+        if (!read_file(m_path + ".full", full, payload) || full.kind != Full) return false;
+
+        // The header is not covered by the checksum, so its sizes are checked
+        // against what was actually read before anything is copied.
+        if (payload.size() % sizeof(T) != 0 || payload.size() / sizeof(T) != full.count) return false;
+        std::vector<T> values(full.count);
+        std::memcpy(values.data(), payload.data(), payload.size());
+        state = full.state;
+        uint64_t id = full.id;
+
+        size_t gradient_count = full.gradient_count;
+        Header delta;
+        if (read_file(m_path + ".delta", delta, payload) && delta.kind == Delta &&
+            delta.base_id == full.id && delta.count == full.count &&
+            delta.gradient_count == full.gradient_count) {
+            std::vector<T> patched = values;
+            if (decode_delta(payload, patched)) {
+                values = std::move(patched);
+                state = delta.state;
+                id = delta.id;
+            }
+        }
+
+        auto params = m_model.params();
+        size_t total = 0, gradients = 0;
+        for (const auto& param : params) {
+            total += param.size;
+            if (param.grads) gradients += param.size;
+        }
+        if (gradient_count > values.size() || total != values.size() - gradient_count ||
+            (gradient_count != 0 && gradient_count != gradients)) {
+            throw std::runtime_error("Checkpoint does not match the model: " +
+                                     std::to_string(values.size() - std::min(gradient_count, values.size())) +
+                                     " values, model has " + std::to_string(total));
+        }
+
+        const T* src = values.data();
+        for (auto& param : params) {
+            std::copy(src, src + param.size, param.values);
+            src += param.size;
+        }
+        if (!m_model.input_shape().empty()) m_model.compile(m_model.input_shape());
+        // Gradient sums of a partial accumulation; without them the
+        // buffers start from zero.
+        for (auto& param : m_model.params()) {
+            if (!param.grads) continue;
+            if (gradient_count != 0) {
+                std::copy(src, src + param.size, param.grads);
+                src += param.size;
+            } else {
+                std::fill(param.grads, param.grads + param.size, T(0));
+            }
+        }
+
+        // The writer is idle after wait(); start the next chain with a full file.
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_base.clear();
+        m_next_id = id + 1;
+        m_since_full = 0;
+        return true;
+    }
+
+    // Also resumes the trainer's update count and partial accumulation.
+    bool restore(TrainingState& state, BackwardTrainer<T>& trainer) {
+        if (!restore(state)) return false;
+        trainer.restore_progress(state.updates, state.accumulated);
+        return true;
+    }
+};
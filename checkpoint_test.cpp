@@ -0,0 +1,136 @@
+#include "model.h"
+#include "trainer.h"
+#include "loss.h"
+#include "checkpoint.h"
+#include "random.h"
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+using T = float;
+
+const string kPath = "checkpoint_test_ckpt";
+// Byte offset of payload_size in the checkpoint header.
+const long kPayloadSizeOffset = 48;
+
+unique_ptr<Model<T>> make_model(uint64_t seed) {
+    auto model = make_unique<Model<T>>();
+    model->set_seed(seed);
+    model->add(make_unique<Dense<T>>(6, "relu"));
+    model->add(make_unique<Dense<T>>(3));
+    model->compile({5});
+    return model;
+}
+
+vector<T> values(Model<T>& model) {
+    vector<T> result;
+    for (const auto& param : model.params()) result.insert(result.end(), param.values, param.values + param.size);
+    return result;
+}
+
+void remove_files() {
+    std::remove((kPath + ".full").c_str());
+    std::remove((kPath + ".delta").c_str());
+}
+
+// Restores into a model built from another seed. Returns false, with a
+// message, if restore() throws or its result is not what was expected.
+bool restores(const string& name, bool expect_found, const vector<T>& expected, uint64_t expected_epoch) {
+    auto model = make_model(99);
+    AsyncCheckpointer<T> checkpointer(*model, kPath);
+    TrainingState state;
+    bool found;
+    try {
+        found = checkpointer.restore(state);
+    } catch (const exception& e) {
+        cerr << name << ": restore threw: " << e.what() << endl;
+        return false;
+    }
+    if (found != expect_found) {
+        cerr << name << ": restore returned " << found << ", expected " << expect_found << endl;
+        return false;
+    }
+    if (!found) return true;
+    if (values(*model) != expected || state.epoch != expected_epoch) {
+        cerr << name << ": restored epoch " << state.epoch << " does not match epoch " << expected_epoch << endl;
+        return false;
+    }
+    return true;
+}
+
+void overwrite(const string& path, long offset, const void* data, size_t size) {
+    fstream file(path, ios::in | ios::out | ios::binary);
+    file.seekp(offset);
+    file.write(static_cast<const char*>(data), size);
+}
+
+int main() {
+    remove_files();
+    auto model = make_model(4);
+    vector<T> input(5), target(3);
+    Philox(6).fill_uniform(input.data(), input.size(), T(-1), T(1), 0);
+    Philox(7).fill_uniform(target.data(), target.size(), T(-1), T(1), 0);
+    BackwardTrainer<T> trainer(*model, T(0.05));
+    MSELoss<T> mse;
+
+    // Epoch 1 goes to the full file, epoch 2 to the delta.
+    vector<T> first, second;
+    {
+        AsyncCheckpointer<T> checkpointer(*model, kPath);
+        TrainingState state;
+        state.epoch = 1;
+        checkpointer.snapshot(state);
+        checkpointer.wait();
+        first = values(*model);
+
+        trainer.train_step(input, target, mse);
+        state.epoch = 2;
+        checkpointer.snapshot(state);
+        checkpointer.wait();
+        second = values(*model);
+    }
+    if (first == second) {
+        cerr << "training did not change the weights" << endl;
+        return 1;
+    }
+
+    bool ok = restores("round trip", true, second, 2);
+
+    // A flipped payload byte fails the delta's checksum; restore falls
+    // back to the full checkpoint.
+    ifstream delta(kPath + ".delta", ios::binary | ios::ate);
+    long delta_size = static_cast<long>(delta.tellg());
+    delta.close();
+    char byte = 0x5a;
+    overwrite(kPath + ".delta", delta_size - 1, &byte, 1);
+    ok = restores("corrupt delta", true, first, 1) && ok;
+
+    // A payload_size beyond the file must be rejected before it sizes an
+    // allocation; so must one shorter than the file.
+    for (uint64_t payload_size : {uint64_t(1) << 60, uint64_t(first.size() * sizeof(T) - 1)}) {
+        ifstream in(kPath + ".full", ios::binary);
+        vector<char> original((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        in.close();
+        overwrite(kPath + ".full", kPayloadSizeOffset, &payload_size, sizeof(payload_size));
+        ok = restores("payload_size " + to_string(payload_size), false, {}, 0) && ok;
+        ofstream(kPath + ".full", ios::binary).write(original.data(), original.size());
+    }
+
+    // A truncated full checkpoint, whose header claims more than is left.
+    ok = restores("intact full", true, first, 1) && ok;
+    {
+        ifstream in(kPath + ".full", ios::binary);
+        vector<char> original((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+        ofstream(kPath + ".full", ios::binary).write(original.data(), original.size() - 8);
+    }
+    ok = restores("truncated full", false, {}, 0) && ok;
+
+    remove_files();
+    cout << (ok ? "all restores behaved" : "some restores misbehaved") << endl;
+    return ok ? 0 : 1;
+}
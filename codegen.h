@@ -0,0 +1,340 @@
+#pragma once
+#include "model.h"
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+// Emits a standalone C++ header that evaluates a compiled model without
+// the library: all dimensions are template arguments, weights are
+// constexpr aligned arrays and each layer is a direct call, so the
+// compiler can specialize and unroll the whole network. The generated code
+// works in NCHW and supports the feed-forward layer types; run
+// fold_batchnorm() first so BatchNorm costs nothing.
+template<typename T>
+class CodeGenerator {
+    struct Call {
+        std::string kernel;
+        std::string arguments;
+    };
+
+    std::ostringstream m_weights;
+    std::vector<Call> m_calls;
+    std::vector<std::string> m_kernels;
+    size_t m_size = 0;
+    size_t m_buffer_size = 0;
+
+    static const char* type_name() { return std::is_same<T, double>::value ? "double" : "float"; }
+
+    static std::string literal(T value) {
+        std::ostringstream oss;
+        oss << std::setprecision(std::numeric_limits<T>::max_digits10) << value;
+        std::string text = oss.str();
+        if (text.find_first_of(".en") == std::string::npos) text += ".0";
+        return std::is_same<T, float>::value ? text + "f" : text;
+    }
+
+    // Re-reads a layer's own save() output; the model file format is the
+    // contract for what a layer contains.
+    static std::istringstream saved(const Lay<T>& layer) {
+        std::ostringstream out;
+        out << std::setprecision(std::numeric_limits<T>::max_digits10);
+        layer.save(out);
+        return std::istringstream(out.str());
+    }
+
+    static std::vector<T> read_values(std::istream& in, size_t count) {
+        std::vector<T> values(count);
+        for (auto& v : values) {
+            if (!(in >> v)) throw std::runtime_error("CodeGenerator: truncated layer data");
+        }
+        return values;
+    }
+
+    std::string array(const std::string& name, const std::vector<T>& values) {
+        m_weights << "alignas(64) constexpr value_type " << name << "[" << values.size() << "] = {";
+        for (size_t i = 0; i < values.size(); ++i) {
+            m_weights << (i % 8 == 0 ? "\n    " : " ") << literal(values[i]) << ",";
+        }
+        m_weights << "\n};\n\n";
+        return name;
+    }
+
+    void use_kernel(const std::string& kernel) {
+        for (const auto& k : m_kernels) if (k == kernel) return;
+        m_kernels.push_back(kernel);
+    }
+
+    void expect_input(const std::string& type, size_t size) {
+        if (size != m_size) {
+            throw std::runtime_error("CodeGenerator: " + type + " expects " + std::to_string(size) +
+                                     " inputs but the previous layer produces " + std::to_string(m_size));
+        }
+    }
+
+    void call(const std::string& kernel, const std::string& arguments, size_t output_size) {
+        m_calls.push_back({kernel, arguments});
+        m_size = output_size;
+        m_buffer_size = std::max(m_buffer_size, output_size);
+    }
+
+    // Unknown names are linear, as in Activations<T>::select().
+    static std::string activation_enum(const std::string& name) {
+        bool known = name == "relu" || name == "leakyRelu" || name == "sigmoid" || name == "tanh";
+        return "Activation::" + (known ? name : std::string("linear"));
+    }
+
+    void emit_dense(const Lay<T>& layer, size_t index) {
+        auto in = saved(layer);
+        size_t inputs, outputs;
+        std::string activation;
+        in >> inputs >> outputs >> activation;
+        expect_input("Dense", inputs);
+        std::string prefix = "layer" + std::to_string(index);
+        std::string weights = array(prefix + "_weights", read_values(in, inputs * outputs));
+        std::string biases = array(prefix + "_biases", read_values(in, outputs));
+
+        use_kernel("dense");
+        std::ostringstream kernel;
+        kernel << "dense<" << inputs << ", " << outputs << ", " << activation_enum(activation) << ">";
+        call(kernel.str(), weights + ", " + biases, outputs);
+    }
+
+    void emit_conv(size_t height, size_t width, size_t channels, size_t kernel_size,
+                   size_t filters, size_t groups, size_t stride, size_t padding,
+                   std::istream& in, size_t index) {
+        expect_input("convolution", channels * height * width);
+        std::string prefix = "layer" + std::to_string(index);
+        size_t filter = channels / groups * kernel_size * kernel_size;
+        std::string weights = array(prefix + "_weights", read_values(in, filters * filter));
+        std::string biases = array(prefix + "_biases", read_values(in, filters));
+
+        size_t out_height = (height + 2 * padding - kernel_size) / stride + 1;
+        size_t out_width = (width + 2 * padding - kernel_size) / stride + 1;
+        use_kernel("conv");
+        std::ostringstream kernel;
+        kernel << "conv<" << channels << ", " << height << ", " << width << ", " << filters << ", "
+               << groups << ", " << kernel_size << ", " << stride << ", " << padding << ">";
+        call(kernel.str(), weights + ", " + biases, filters * out_height * out_width);
+    }
+
+    void emit_pool(const std::string& kernel_name, const std::string& type, std::istream& in) {
+        size_t height, width, channels, pool, stride, padding;
+        in >> height >> width >> channels >> pool >> stride >> padding;
+        expect_input(type, channels * height * width);
+        size_t out_height = (height + 2 * padding - pool) / stride + 1;
+        size_t out_width = (width + 2 * padding - pool) / stride + 1;
+
+        use_kernel(kernel_name);
+        std::ostringstream kernel;
+        kernel << kernel_name << "<" << channels << ", " << height << ", " << width << ", "
+               << pool << ", " << stride << ", " << padding << ">";
+        call(kernel.str(), "", channels * out_height * out_width);
+    }
+
+    void emit_layer(Lay<T>& layer, size_t index) {
+        std::string type = layer.getType();
+        if (type == "Dense") {
+            emit_dense(layer, index);
+        } else if (type == "Conv2D") {
+            auto in = saved(layer);
+            size_t h, w, c, k, filters, stride, padding;
+            in >> h >> w >> c >> k >> filters >> stride >> padding;
+            emit_conv(h, w, c, k, filters, 1, stride, padding, in, index);
+        } else if (dynamic_cast<GroupedConv2D<T>*>(&layer)) {
+            auto in = saved(layer);
+            size_t h, w, c, k, filters, groups, stride, padding;
+            in >> h >> w >> c >> k >> filters >> groups >> stride >> padding;
+            emit_conv(h, w, c, k, filters, groups, stride, padding, in, index);
+        } else if (type == "MaxPool") {
+            auto in = saved(layer);
+            emit_pool("max_pool", type, in);
+        } else if (type == "AvgPool") {
+            auto in = saved(layer);
+            emit_pool("avg_pool", type, in);
+        } else if (type == "GlobalAvgPool") {
+            auto in = saved(layer);
+            size_t height, width, channels;
+            in >> height >> width >> channels;
+            expect_input(type, channels * height * width);
+            use_kernel("global_avg_pool");
+            call("global_avg_pool<" + std::to_string(channels) + ", " +
+                 std::to_string(height * width) + ">", "", channels);
+        } else if (type == "BatchNorm") {
+            std::vector<T> scale, shift;
+            static_cast<BatchNorm<T>&>(layer).inference_affine(scale, shift);
+            if (scale.empty() || m_size % scale.size() != 0) {
+                throw std::runtime_error("CodeGenerator: BatchNorm does not match its input");
+            }
+            std::string prefix = "layer" + std::to_string(index);
+            std::string arguments = array(prefix + "_scale", scale) + ", " + array(prefix + "_shift", shift);
+            use_kernel("affine");
+            call("affine<" + std::to_string(scale.size()) + ", " +
+                 std::to_string(m_size / scale.size()) + ">", arguments, m_size);
+        } else if (type == "Activation") {
+            auto in = saved(layer);
+            std::string activation;
+            in >> activation;
+            use_kernel("activation");
+            call("activation<" + std::to_string(m_size) + ", " + activation_enum(activation) + ">",
+                 "", m_size);
+        } else if (type != "Flatten") {
+            throw std::runtime_error("CodeGenerator: layer type " + type + " is not supported");
+        }
+    }
+
+    static const char* kernel_source(const std::string& name) {
+        if (name == "dense") return R"(template<size_t In, size_t Out, Activation A>
+inline void dense(const value_type* __restrict in, const value_type* weights,
+                  const value_type* biases, value_type* __restrict out) {
+    for (size_t j = 0; j < Out; ++j) {
+        value_type sum = biases[j];
+        for (size_t i = 0; i < In; ++i) sum += weights[j * In + i] * in[i];
+        out[j] = activate<A>(sum);
+    }
+}
+)";
+        if (name == "conv") return R"(// Output rows accumulate one strided input row per tap; with padding the
+// input is first copied into a zero-bordered scratch plane.
+template<size_t C, size_t H, size_t W, size_t K, size_t G, size_t R, size_t S, size_t P>
+inline void conv(const value_type* __restrict in, const value_type* weights,
+                 const value_type* biases, value_type* __restrict out) {
+    constexpr size_t PH = H + 2 * P, PW = W + 2 * P;
+    constexpr size_t OH = (PH - R) / S + 1, OW = (PW - R) / S + 1;
+    constexpr size_t CG = C / G, KG = K / G;
+    const value_type* x = in;
+    if constexpr (P > 0) {
+        alignas(64) static thread_local value_type padded[C * PH * PW];
+        for (size_t c = 0; c < C; ++c)
+            for (size_t h = 0; h < H; ++h)
+                for (size_t w = 0; w < W; ++w)
+                    padded[(c * PH + h + P) * PW + w + P] = in[(c * H + h) * W + w];
+        x = padded;
+    }
+    for (size_t k = 0; k < K; ++k) {
+        const value_type* group = x + (k / KG) * CG * PH * PW;
+        const value_type* filter = weights + k * CG * R * R;
+        for (size_t oh = 0; oh < OH; ++oh) {
+            value_type* row = out + (k * OH + oh) * OW;
+            for (size_t ow = 0; ow < OW; ++ow) row[ow] = biases[k];
+            for (size_t c = 0; c < CG; ++c)
+                for (size_t kh = 0; kh < R; ++kh)
+                    for (size_t kw = 0; kw < R; ++kw) {
+                        value_type weight = filter[(c * R + kh) * R + kw];
+                        const value_type* src = group + (c * PH + oh * S + kh) * PW + kw;
+                        for (size_t ow = 0; ow < OW; ++ow) row[ow] += weight * src[ow * S];
+                    }
+        }
+    }
+}
+)";
+        if (name == "max_pool") return R"(template<size_t C, size_t H, size_t W, size_t R, size_t S, size_t P>
+inline void max_pool(const value_type* __restrict in, value_type* __restrict out) {
+    constexpr size_t OH = (H + 2 * P - R) / S + 1, OW = (W + 2 * P - R) / S + 1;
+    for (size_t c = 0; c < C; ++c)
+        for (size_t i = 0; i < OH; ++i)
+            for (size_t j = 0; j < OW; ++j) {
+                value_type best = std::numeric_limits<value_type>::lowest();
+                for (size_t ph = 0; ph < R; ++ph)
+                    for (size_t pw = 0; pw < R; ++pw) {
+                        size_t h = i * S + ph, w = j * S + pw;
+                        if (h < P || w < P || h - P >= H || w - P >= W) continue;
+                        value_type v = in[(c * H + h - P) * W + w - P];
+                        best = v > best ? v : best;
+                    }
+                out[(c * OH + i) * OW + j] = best;
+            }
+}
+)";
+        if (name == "avg_pool") return R"(// Padded positions are not counted, as in AvgPool.
+template<size_t C, size_t H, size_t W, size_t R, size_t S, size_t P>
+inline void avg_pool(const value_type* __restrict in, value_type* __restrict out) {
+    constexpr size_t OH = (H + 2 * P - R) / S + 1, OW = (W + 2 * P - R) / S + 1;
+    for (size_t c = 0; c < C; ++c)
+        for (size_t i = 0; i < OH; ++i)
+            for (size_t j = 0; j < OW; ++j) {
+                value_type sum = 0;
+                size_t count = 0;
+                for (size_t ph = 0; ph < R; ++ph)
+                    for (size_t pw = 0; pw < R; ++pw) {
+                        size_t h = i * S + ph, w = j * S + pw;
+                        if (h < P || w < P || h - P >= H || w - P >= W) continue;
+                        sum += in[(c * H + h - P) * W + w - P];
+                        ++count;
+                    }
+                out[(c * OH + i) * OW + j] = sum * (value_type(1) / static_cast<value_type>(count));
+            }
+}
+)";
+        if (name == "global_avg_pool") return R"(template<size_t C, size_t Plane>
+inline void global_avg_pool(const value_type* __restrict in, value_type* __restrict out) {
+    constexpr value_type scale = value_type(1) / static_cast<value_type>(Plane);
+    for (size_t c = 0; c < C; ++c) {
+        value_type sum = 0;
+        for (size_t p = 0; p < Plane; ++p) sum += in[c * Plane + p];
+        out[c] = sum * scale;
+    }
+}
+)";
+        if (name == "activation") return R"(template<size_t N, Activation A>
+inline void activation(const value_type* __restrict in, value_type* __restrict out) {
+    for (size_t i = 0; i < N; ++i) out[i] = activate<A>(in[i]);
+}
+)";
+        return R"(template<size_t C, size_t Plane>
+inline void affine(const value_type* __restrict in, const value_type* scale,
+                   const value_type* shift, value_type* __restrict out) {
+    for (size_t c = 0; c < C; ++c)
+        for (size_t p = 0; p < Plane; ++p)
+            out[c * Plane + p] = in[c * Plane + p] * scale[c] + shift[c];
+}
+)";
+    }
+
+public:
+    // input_shape must be the shape the model was compiled for.
+    void generate(Model<T>& model, const std::vector<size_t>& input_shape,
+                  const std::string& name, std::ostream& out) {
+        m_size = shape_size(input_shape);
+        size_t input_size = m_size;
+        for (size_t i = 0; i < model.layer_count(); ++i) emit_layer(model.layer(i), i);
+
+        out << "#pragma once\n"
+            << "// Generated from a saved model; do not edit.\n"
+            << "#include <cstddef>\n#include <cmath>\n#include <limits>\n#include <algorithm>\n\n"
+            << "namespace " << name << " {\n\n"
+            << "using value_type = " << type_name() << ";\n"
+            << "constexpr size_t kInputSize = " << input_size << ";\n"
+            << "constexpr size_t kOutputSize = " << m_size << ";\n\n"
+            << "enum class Activation { linear, relu, leakyRelu, sigmoid, tanh };\n\n"
+            << "template<Activation A>\ninline value_type activate(value_type x) {\n"
+            << "    if constexpr (A == Activation::relu) return x > 0 ? x : value_type(0);\n"
+            << "    else if constexpr (A == Activation::leakyRelu) return x > 0 ? x : value_type(0.01) * x;\n"
+            << "    else if constexpr (A == Activation::sigmoid) return 1 / (1 + std::exp(-x));\n"
+            << "    else if constexpr (A == Activation::tanh) return std::tanh(x);\n"
+            << "    else return x;\n}\n\n";
+        for (const auto& kernel : m_kernels) out << kernel_source(kernel) << "\n";
+        out << m_weights.str()
+            << "// input: kInputSize values (NCHW), output: kOutputSize values.\n"
+            << "inline void forward(const value_type* input, value_type* output) {\n";
+
+        // Layers ping-pong between two scratch buffers; the last one writes
+        // straight into the caller's output.
+        size_t count = m_calls.size();
+        if (count > 1) out << "    alignas(64) static thread_local value_type a[" << m_buffer_size << "];\n";
+        if (count > 2) out << "    alignas(64) static thread_local value_type b[" << m_buffer_size << "];\n";
+        if (count == 0) out << "    std::copy(input, input + kInputSize, output);\n";
+        for (size_t i = 0; i < count; ++i) {
+            const char* source = i == 0 ? "input" : (i - 1) % 2 == 0 ? "a" : "b";
+            const char* target = i + 1 == count ? "output" : i % 2 == 0 ? "a" : "b";
+            out << "    " << m_calls[i].kernel << "(" << source << ", ";
+            if (!m_calls[i].arguments.empty()) out << m_calls[i].arguments << ", ";
+            out << target << ");\n";
+        }
+        out << "}\n\n} // namespace " << name << "\n";
+    }
+};
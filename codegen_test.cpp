@@ -0,0 +1,49 @@
+#include "model.h"
+#include "random.h"
+#include "codegen_test_net.h"
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+using T = float;
+
+// Runs the header nn_codegen generated from codegen_test_model's output
+// and the library model it came from on the same inputs.
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " <model_file>\n";
+        return 1;
+    }
+
+    Model<T> model;
+    model.load(argv[1]);
+    model.compile({2, 8, 8});
+    model.set_inference(true);
+
+    const T tolerance = T(1e-4);
+    Philox rng(11);
+    vector<T> input(codegen_test_net::kInputSize);
+    vector<T> generated(codegen_test_net::kOutputSize);
+    T worst = 0;
+    for (size_t sample = 0; sample < 16; ++sample) {
+        rng.fill_uniform(input.data(), input.size(), T(-1), T(2), sample * 256);
+        vector<T> expected = model.forward(input);
+        if (expected.size() != generated.size()) {
+            cerr << "output size " << generated.size() << ", expected " << expected.size() << endl;
+            return 1;
+        }
+        codegen_test_net::forward(input.data(), generated.data());
+        for (size_t i = 0; i < expected.size(); ++i) {
+            T diff = std::abs(generated[i] - expected[i]) / max(T(1), std::abs(expected[i]));
+            worst = max(worst, diff);
+        }
+    }
+
+    cout << "max relative difference " << worst << endl;
+    if (!(worst <= tolerance)) {
+        cerr << "generated code differs from Model::forward by more than " << tolerance << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,49 @@
+#include "model.h"
+#include "trainer.h"
+#include "loss.h"
+#include "random.h"
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using namespace std;
+using T = float;
+
+// Writes the model codegen_test checks nn_codegen's output against. A few
+// training steps move the BatchNorm running statistics off their initial
+// values, so folding and the affine kernel have something to get wrong.
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " <model_file>\n";
+        return 1;
+    }
+
+    Model<T> model;
+    model.set_seed(42);
+    model.add(make_unique<Conv2D<T>>(8, 8, 2, 3, 4, 1, 1));
+    model.add(make_unique<BatchNorm<T>>(4));
+    model.add(make_unique<ActivationLayer<T>>("relu"));
+    model.add(make_unique<MaxPool<T>>(8, 8, 4, 2));
+    model.add(make_unique<BatchNorm<T>>(4));
+    model.add(make_unique<Flatten<T>>());
+    model.add(make_unique<Dense<T>>(16, "relu"));
+    model.add(make_unique<Dense<T>>(3));
+    model.add(make_unique<ActivationLayer<T>>("tanh"));
+    model.compile({2, 8, 8});
+
+    Philox rng(7);
+    const size_t samples = 8, input_size = 2 * 8 * 8;
+    vector<vector<T>> inputs(samples, vector<T>(input_size));
+    vector<vector<T>> targets(samples, vector<T>(3));
+    for (size_t i = 0; i < samples; ++i) {
+        rng.fill_uniform(inputs[i].data(), input_size, T(-1), T(2), i * 256);
+        rng.fill_uniform(targets[i].data(), 3, T(-1), T(1), i * 256 + input_size);
+    }
+
+    BackwardTrainer<T> trainer(model, T(0.01));
+    MSELoss<T> mse;
+    for (int step = 0; step < 20; ++step) trainer.train_batch(inputs, targets, mse);
+
+    model.save(argv[1]);
+    return 0;
+}
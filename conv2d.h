@@ -1,12 +1,17 @@
 #pragma once
 #include "lay.h"
+#include "layout.h"
+#include "kernels.h"
+#include "aligned_allocator.h"
+#include "random.h"
 #include <vector>
 #include <stdexcept>
 #include <cmath>
-#include <cstdlib>
 #include <functional>
 #include <iostream>
 #include <sstream>
+#include <algorithm>
+#include <string>
 
 template<typename T>
 class Conv2D : public Lay<T> {
@@ -22,11 +27,28 @@ private:
     size_t m_output_height;
     size_t m_output_width;
     
-    std::vector<T> m_weights;
+    AlignedVector<T> m_weights;
     std::vector<T> m_biases;
-    std::vector<T> m_padded_input;
-    std::vector<T> m_dweights;
+    AlignedVector<T> m_padded_input;
+    AlignedVector<T> m_dweights;
     std::vector<T> m_dbiases;
+    AlignedVector<T> m_padded_input_grad;
+
+    // Weights reordered as [K / KL][kh][kw][C][KL] for the NHWC and NCHWc kernels.
+    // Stale once the weights may have changed, e.g. through collect_params;
+    // forward() repacks before using them.
+    AlignedVector<T> m_packed_weights;
+    bool m_packed_stale = false;
+    Layout m_layout = Layout::NCHW;
+    bool m_auto_layout = true;
+    size_t m_input_lanes = 1;
+    size_t m_output_lanes = 1;
+    std::vector<size_t> m_padded_offsets;
+    std::vector<size_t> m_output_offsets;
+
+    bool m_compiled = false;
+    Philox m_rng{0, Philox::next_stream()};
+    void (Conv2D::*m_forward_kernel)(std::vector<T>&) const = &Conv2D::forward_generic;
     
     void initialize_weights() {
         size_t fan_in = m_input_channels * m_kernel_size * m_kernel_size;
@@ -34,13 +56,9 @@ private:
         T range = std::sqrt(6.0 / (fan_in + fan_out));
         
         m_weights.resize(m_output_channels * m_input_channels * m_kernel_size * m_kernel_size);
-        for (size_t i = 0; i < m_weights.size(); ++i) {
-            m_weights[i] = static_cast<T>(rand()) / RAND_MAX * 2 * range - range;
-        }
+        m_rng.fill_uniform(m_weights.data(), m_weights.size(), -range, range, 0);
         
         m_biases.resize(m_output_channels, 0);
-        m_dweights.resize(m_weights.size(), 0);
-        m_dbiases.resize(m_output_channels, 0);
     }
     
     void calculate_output_dimensions() {
@@ -52,19 +70,144 @@ private:
         }
     }
     
-    void apply_padding(const std::vector<T>& input, std::vector<T>& padded_input) {
+    // Copies one row of W * lanes values per channel block. Only the
+    // interior is written: the border was zeroed once in compile().
+    void apply_padding(const std::vector<T>& input, AlignedVector<T>& padded_input) {
         size_t padded_height = m_input_height + 2 * m_padding;
         size_t padded_width = m_input_width + 2 * m_padding;
-        padded_input.assign(m_input_channels * padded_height * padded_width, 0);
+        size_t lanes = m_input_lanes;
+        size_t row = m_input_width * lanes;
         
-        for (size_t c = 0; c < m_input_channels; ++c) {
+        for (size_t b = 0; b < m_input_channels / lanes; ++b) {
             for (size_t h = 0; h < m_input_height; ++h) {
-                for (size_t w = 0; w < m_input_width; ++w) {
-                    size_t input_idx = c * m_input_height * m_input_width + h * m_input_width + w;
-                    size_t padded_idx = c * padded_height * padded_width + 
-                                      (h + m_padding) * padded_width + 
-                                      (w + m_padding);
-                    padded_input[padded_idx] = input[input_idx];
+                const T* src = &input[(b * m_input_height + h) * row];
+                T* dst = &padded_input[((b * padded_height + h + m_padding) * padded_width + m_padding) * lanes];
+                std::copy(src, src + row, dst);
+            }
+        }
+    }
+
+    void remove_padding(const AlignedVector<T>& padded_input, std::vector<T>& input) const {
+        size_t padded_height = m_input_height + 2 * m_padding;
+        size_t padded_width = m_input_width + 2 * m_padding;
+        size_t lanes = m_input_lanes;
+        size_t row = m_input_width * lanes;
+
+        for (size_t b = 0; b < m_input_channels / lanes; ++b) {
+            for (size_t h = 0; h < m_input_height; ++h) {
+                const T* src = &padded_input[((b * padded_height + h + m_padding) * padded_width + m_padding) * lanes];
+                std::copy(src, src + row, &input[(b * m_input_height + h) * row]);
+            }
+        }
+    }
+
+    void pack_weights() {
+        m_packed_stale = false;
+        if (m_layout == Layout::NCHW) {
+            m_packed_weights.clear();
+            return;
+        }
+
+        size_t lanes = m_output_lanes;
+        size_t window = m_kernel_size * m_kernel_size;
+        m_packed_weights.resize(m_weights.size());
+        for (size_t k = 0; k < m_output_channels; ++k) {
+            for (size_t c = 0; c < m_input_channels; ++c) {
+                for (size_t kk = 0; kk < window; ++kk) {
+                    size_t packed = (((k / lanes) * window + kk) * m_input_channels + c) * lanes + k % lanes;
+                    m_packed_weights[packed] = m_weights[(k * m_input_channels + c) * window + kk];
+                }
+            }
+        }
+    }
+
+    void forward_generic(std::vector<T>& output) const {
+        conv2d_nchw(m_padded_input.data(), m_input_channels,
+                    m_input_height + 2 * m_padding, m_input_width + 2 * m_padding,
+                    m_weights.data(), m_biases.data(), m_output_channels, m_kernel_size, m_stride,
+                    output.data(), m_output_height, m_output_width);
+    }
+
+    // 1x1 kernel, stride 1, no padding: a plain (K x C) * (C x HW) product.
+    void forward_pointwise(std::vector<T>& output) const {
+        size_t plane = m_output_height * m_output_width;
+        for (size_t k = 0; k < m_output_channels; ++k) {
+            std::fill(&output[k * plane], &output[k * plane] + plane, m_biases[k]);
+        }
+        gemm(false, false, m_output_channels, plane, m_input_channels,
+             m_weights.data(), m_input_channels, m_padded_input.data(), plane,
+             output.data(), plane, true);
+    }
+
+    // NHWC: each output position accumulates a vector of all output
+    // channels, so the innermost loop runs over contiguous lanes.
+    void forward_blocked(std::vector<T>& output) const {
+        size_t padded_width = m_input_width + 2 * m_padding;
+        size_t lanes = m_output_lanes;
+        size_t window = m_kernel_size * m_kernel_size;
+        size_t out_plane = m_output_height * m_output_width;
+
+        for (size_t kb = 0; kb < m_output_channels / lanes; ++kb) {
+            const T* bias = &m_biases[kb * lanes];
+            for (size_t h = 0; h < m_output_height; ++h) {
+                for (size_t w = 0; w < m_output_width; ++w) {
+                    T* acc = &output[(kb * out_plane + h * m_output_width + w) * lanes];
+                    std::copy(bias, bias + lanes, acc);
+
+                    for (size_t kh = 0; kh < m_kernel_size; ++kh) {
+                        for (size_t kw = 0; kw < m_kernel_size; ++kw) {
+                            size_t position = ((h * m_stride + kh) * padded_width + w * m_stride + kw) * m_input_lanes;
+                            const T* weights = &m_packed_weights[((kb * window + kh * m_kernel_size + kw) *
+                                                                  m_input_channels) * lanes];
+                            for (size_t c = 0; c < m_input_channels; ++c) {
+                                T x = m_padded_input[m_padded_offsets[c] + position];
+                                const T* weight_row = weights + c * lanes;
+                                for (size_t l = 0; l < lanes; ++l) {
+                                    acc[l] += x * weight_row[l];
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // NCHWc: fixed-width blocks let the accumulator live in registers.
+    // Input lanes of a block are contiguous, as are the packed weights.
+    void forward_nchwc(std::vector<T>& output) const {
+        constexpr size_t lanes = kChannelBlock;
+        size_t padded_height = m_input_height + 2 * m_padding;
+        size_t padded_width = m_input_width + 2 * m_padding;
+        size_t in_block = padded_height * padded_width * lanes;
+        size_t window = m_kernel_size * m_kernel_size;
+        size_t out_plane = m_output_height * m_output_width;
+
+        for (size_t kb = 0; kb < m_output_channels / lanes; ++kb) {
+            for (size_t h = 0; h < m_output_height; ++h) {
+                for (size_t w = 0; w < m_output_width; ++w) {
+                    T acc[lanes];
+                    for (size_t l = 0; l < lanes; ++l) acc[l] = m_biases[kb * lanes + l];
+
+                    for (size_t kh = 0; kh < m_kernel_size; ++kh) {
+                        for (size_t kw = 0; kw < m_kernel_size; ++kw) {
+                            const T* in = &m_padded_input[((h * m_stride + kh) * padded_width +
+                                                           w * m_stride + kw) * lanes];
+                            const T* weights = &m_packed_weights[((kb * window + kh * m_kernel_size + kw) *
+                                                                  m_input_channels) * lanes];
+                            for (size_t cb = 0; cb < m_input_channels / lanes; ++cb) {
+                                const T* x = in + cb * in_block;
+                                const T* weight_block = weights + cb * lanes * lanes;
+                                for (size_t cl = 0; cl < lanes; ++cl) {
+                                    for (size_t l = 0; l < lanes; ++l) {
+                                        acc[l] += x[cl] * weight_block[cl * lanes + l];
+                                    }
+                                }
+                            }
+                        }
+                    }
+
+                    std::copy(acc, acc + lanes, &output[(kb * out_plane + h * m_output_width + w) * lanes]);
                 }
             }
         }
@@ -79,13 +222,63 @@ public:
           m_output_channels(output_channels), m_stride(stride), m_padding(padding) {
         
         calculate_output_dimensions();
-        initialize_weights();
     }
 
     Conv2D() = default;
 
     std::string getType() const override { return "Conv2D"; }
 
+    // Pins the memory layout instead of letting Model::compile choose it.
+    void set_layout(Layout layout) {
+        m_layout = layout;
+        m_auto_layout = false;
+        m_compiled = false;
+    }
+
+    Layout select_layout(const std::vector<size_t>& input_shape, Layout incoming) override {
+        if (!m_auto_layout) return m_layout;
+
+        // NCHW vectorizes along the output row, NHWC along the output
+        // channels; staying in the incoming layout saves a transform.
+        bool blocked = m_input_channels % kChannelBlock == 0 &&
+                       m_output_channels % kChannelBlock == 0;
+        bool pointwise = m_kernel_size == 1 && m_stride == 1 && m_padding == 0;
+
+        if (incoming == Layout::NCHWc && blocked) {
+            m_layout = Layout::NCHWc;
+        } else if (incoming == Layout::NHWC && m_output_channels >= kChannelBlock && !pointwise) {
+            m_layout = Layout::NHWC;
+        } else if (pointwise) {
+            m_layout = Layout::NCHW;
+        } else if (m_output_channels >= 4 * kChannelBlock ||
+                   (m_stride > 1 && m_output_channels >= 2 * kChannelBlock)) {
+            m_layout = Layout::NHWC;
+        } else {
+            m_layout = Layout::NCHW;
+        }
+        return m_layout;
+    }
+
+    std::vector<size_t> input_feature_shape() const override {
+        return {m_input_channels, m_input_height, m_input_width};
+    }
+
+    // Applies y = x * scale[k] + shift[k] to output channel k, e.g. to
+    // fold a following BatchNorm into this layer.
+    void fold_affine(const std::vector<T>& scale, const std::vector<T>& shift) {
+        if (scale.size() != m_output_channels || shift.size() != m_output_channels || m_weights.empty()) {
+            throw std::runtime_error("Conv2D: cannot fold an affine map of size " +
+                                     std::to_string(scale.size()));
+        }
+        size_t filter = m_input_channels * m_kernel_size * m_kernel_size;
+        for (size_t k = 0; k < m_output_channels; ++k) {
+            T* weights = &m_weights[k * filter];
+            for (size_t i = 0; i < filter; ++i) weights[i] *= scale[k];
+            m_biases[k] = m_biases[k] * scale[k] + shift[k];
+        }
+        m_packed_stale = true;
+    }
+
     void save(std::ostream& out) const override {
         out << m_input_height << " " << m_input_width << " "
             << m_input_channels << " " << m_kernel_size << " "
@@ -125,83 +318,92 @@ public:
             }
         }
         
-        m_dweights.resize(weights_size, 0);
-        m_dbiases.resize(m_output_channels, 0);
+        m_compiled = false;
     }
 
-    std::vector<T> forward(const std::vector<T>& input) override {
-        if (input.size() != m_input_height * m_input_width * m_input_channels) {
+    std::vector<size_t> compile(const std::vector<size_t>& input_shape) override {
+        size_t expected = m_input_channels * m_input_height * m_input_width;
+        bool matches = input_shape.size() == 3
+            ? input_shape == std::vector<size_t>{m_input_channels, m_input_height, m_input_width}
+            : shape_size(input_shape) == expected;
+        if (!matches) {
             std::ostringstream oss;
-            oss << "Conv2D: input size mismatch. Expected: " 
-                << m_input_height * m_input_width * m_input_channels
-                << ", Got: " << input.size();
+            oss << "Conv2D: input shape mismatch. Expected: " << m_input_channels
+                << "x" << m_input_height << "x" << m_input_width
+                << " (" << expected << " values), Got: " << shape_size(input_shape);
             throw std::runtime_error(oss.str());
         }
-        
-        apply_padding(input, m_padded_input);
-        
+
+        if (m_weights.empty()) initialize_weights();
+        this->allocate_gradient(m_dweights, m_weights.size());
+        this->allocate_gradient(m_dbiases, m_biases.size());
+
+        if (!layout_supports(m_layout, m_input_channels) ||
+            !layout_supports(m_layout, m_output_channels)) {
+            throw std::runtime_error("Conv2D: " + layout_name(m_layout) +
+                                     " needs channel counts divisible by " +
+                                     std::to_string(kChannelBlock));
+        }
+
         size_t padded_height = m_input_height + 2 * m_padding;
         size_t padded_width = m_input_width + 2 * m_padding;
-        std::vector<T> output(m_output_height * m_output_width * m_output_channels, 0);
-        
+        size_t padded_size = m_input_channels * padded_height * padded_width;
+        m_padded_input.assign(padded_size, 0);
+        m_padded_input_grad.assign(padded_size, 0);
+
+        m_input_lanes = layout_lanes(m_layout, m_input_channels);
+        m_output_lanes = layout_lanes(m_layout, m_output_channels);
+        m_padded_offsets.resize(m_input_channels);
+        for (size_t c = 0; c < m_input_channels; ++c) {
+            m_padded_offsets[c] = layout_index(m_input_lanes, padded_height, padded_width, c, 0, 0);
+        }
+        m_output_offsets.resize(m_output_channels);
         for (size_t k = 0; k < m_output_channels; ++k) {
-            for (size_t h = 0; h < m_output_height; ++h) {
-                for (size_t w = 0; w < m_output_width; ++w) {
-                    T sum = 0;
-                    
-                    for (size_t c = 0; c < m_input_channels; ++c) {
-                        for (size_t kh = 0; kh < m_kernel_size; ++kh) {
-                            for (size_t kw = 0; kw < m_kernel_size; ++kw) {
-                                size_t h_in = h * m_stride + kh;
-                                size_t w_in = w * m_stride + kw;
-                                
-                                size_t input_idx = c * padded_height * padded_width + 
-                                                 h_in * padded_width + w_in;
-                                size_t weight_idx = k * m_input_channels * m_kernel_size * m_kernel_size +
-                                                  c * m_kernel_size * m_kernel_size +
-                                                  kh * m_kernel_size + kw;
-                                
-                                sum += m_padded_input[input_idx] * m_weights[weight_idx];
-                            }
-                        }
-                    }
-                    
-                    sum += m_biases[k];
-                    size_t output_idx = k * m_output_height * m_output_width + 
-                                      h * m_output_width + w;
-                    output[output_idx] = sum;
-                }
-            }
+            m_output_offsets[k] = layout_index(m_output_lanes, m_output_height, m_output_width, k, 0, 0);
+        }
+        pack_weights();
+
+        if (m_layout == Layout::NCHWc) {
+            m_forward_kernel = &Conv2D::forward_nchwc;
+        } else if (m_layout == Layout::NHWC) {
+            m_forward_kernel = &Conv2D::forward_blocked;
+        } else if (m_kernel_size == 1 && m_stride == 1 && m_padding == 0) {
+            m_forward_kernel = &Conv2D::forward_pointwise;
+        } else {
+            m_forward_kernel = &Conv2D::forward_generic;
         }
+
+        m_compiled = true;
+        return {m_output_channels, m_output_height, m_output_width};
+    }
+
+    std::vector<T> forward(const std::vector<T>& input) override {
+        if (!m_compiled) compile({input.size()});
+        if (m_packed_stale) pack_weights();
+        
+        apply_padding(input, m_padded_input);
+        
+        std::vector<T> output(m_output_height * m_output_width * m_output_channels);
+        (this->*m_forward_kernel)(output);
         
         return output;
     }
 
     std::vector<T> backward(const std::vector<T>& output_gradient) override {
-        if (output_gradient.size() != m_output_height * m_output_width * m_output_channels) {
-            std::ostringstream oss;
-            oss << "Conv2D: output gradient size mismatch. Expected: " 
-                << m_output_height * m_output_width * m_output_channels
-                << ", Got: " << output_gradient.size();
-            throw std::runtime_error(oss.str());
-        }
-        
-        size_t padded_height = m_input_height + 2 * m_padding;
         size_t padded_width = m_input_width + 2 * m_padding;
-        std::vector<T> padded_input_grad(m_input_channels * padded_height * padded_width, 0);
-        
-        std::fill(m_dweights.begin(), m_dweights.end(), 0);
-        std::fill(m_dbiases.begin(), m_dbiases.end(), 0);
-        
+        AlignedVector<T>& padded_input_grad = m_padded_input_grad;
+        bool input_grad = this->m_input_gradient_required;
+        bool param_grad = this->m_trainable && !m_dweights.empty();
+        if (input_grad) std::fill(padded_input_grad.begin(), padded_input_grad.end(), 0);
 
+        // Parameter gradients accumulate across calls until update_weights.
         for (size_t k = 0; k < m_output_channels; ++k) {
             for (size_t h = 0; h < m_output_height; ++h) {
                 for (size_t w = 0; w < m_output_width; ++w) {
-                    size_t out_idx = k * m_output_height * m_output_width + 
-                                   h * m_output_width + w;
+                    size_t out_idx = m_output_offsets[k] + (h * m_output_width + w) * m_output_lanes;
                     T grad = output_gradient[out_idx];
                     
-                    m_dbiases[k] += grad;
+                    if (param_grad) m_dbiases[k] += grad;
                     
                     for (size_t c = 0; c < m_input_channels; ++c) {
                         for (size_t kh = 0; kh < m_kernel_size; ++kh) {
@@ -209,14 +411,14 @@ public:
                                 size_t h_in = h * m_stride + kh;
                                 size_t w_in = w * m_stride + kw;
                                 
-                                size_t input_idx = c * padded_height * padded_width + 
-                                                h_in * padded_width + w_in;
+                                size_t input_idx = m_padded_offsets[c] +
+                                                   (h_in * padded_width + w_in) * m_input_lanes;
                                 size_t weight_idx = k * m_input_channels * m_kernel_size * m_kernel_size +
                                                   c * m_kernel_size * m_kernel_size +
                                                   kh * m_kernel_size + kw;
                                 
-                                m_dweights[weight_idx] += m_padded_input[input_idx] * grad;
-                                padded_input_grad[input_idx] += m_weights[weight_idx] * grad;
+                                if (param_grad) m_dweights[weight_idx] += m_padded_input[input_idx] * grad;
+                                if (input_grad) padded_input_grad[input_idx] += m_weights[weight_idx] * grad;
                             }
                         }
                     }
@@ -224,30 +426,48 @@ public:
             }
         }
         
-        std::vector<T> input_grad(m_input_channels * m_input_height * m_input_width, 0);
-        for (size_t c = 0; c < m_input_channels; ++c) {
-            for (size_t h = 0; h < m_input_height; ++h) {
-                for (size_t w = 0; w < m_input_width; ++w) {
-                    size_t input_idx = c * m_input_height * m_input_width + 
-                                     h * m_input_width + w;
-                    size_t padded_idx = c * padded_height * padded_width + 
-                                     (h + m_padding) * padded_width + 
-                                     (w + m_padding);
-                    input_grad[input_idx] = padded_input_grad[padded_idx];
-                }
-            }
-        }
+        if (!input_grad) return {};
+
+        std::vector<T> input_gradient(m_input_channels * m_input_height * m_input_width);
+        remove_padding(padded_input_grad, input_gradient);
         
-        return input_grad;
+        return input_gradient;
+    }
+
+    // Takes effect the next time weights are initialized.
+    void seed(uint64_t seed, uint64_t stream) override {
+        m_rng = Philox(seed, stream);
+    }
+
+    void reinitialize() override {
+        if (m_weights.empty()) return;
+        initialize_weights();
+        std::fill(m_biases.begin(), m_biases.end(), T(0));
+        std::fill(m_dweights.begin(), m_dweights.end(), T(0));
+        std::fill(m_dbiases.begin(), m_dbiases.end(), T(0));
+        m_packed_stale = true;
+    }
+
+    // The caller may write through the pointers.
+    void collect_params(std::vector<ParamRef<T>>& params) override {
+        m_packed_stale = true;
+        bool frozen = m_dweights.empty();
+        params.push_back({m_weights.data(), frozen ? nullptr : m_dweights.data(), m_weights.size()});
+        params.push_back({m_biases.data(), frozen ? nullptr : m_dbiases.data(), m_biases.size()});
     }
 
     void update_weights(T learning_rate) override {
+        if (m_dweights.empty()) return;
         for (size_t i = 0; i < m_weights.size(); ++i) {
             m_weights[i] -= learning_rate * m_dweights[i];
+            m_dweights[i] = 0;
         }
         
         for (size_t i = 0; i < m_biases.size(); ++i) {
             m_biases[i] -= learning_rate * m_dbiases[i];
+            m_dbiases[i] = 0;
         }
+
+        m_packed_stale = true;
     }
 };
\ No newline at end of file
@@ -0,0 +1,108 @@
+#include "conv2d.h"
+#include "grouped_conv.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cmath>
+
+using namespace std;
+using T = float;
+
+struct Timing {
+    double forward_us;
+    double backward_us;
+};
+
+// Runs each layer in order, as one block, and reports the mean time per sample.
+Timing time_block(vector<Lay<T>*> layers, const vector<T>& input, size_t iterations) {
+    vector<vector<T>> outputs(layers.size());
+    auto run_forward = [&] {
+        const vector<T>* x = &input;
+        for (size_t i = 0; i < layers.size(); ++i) {
+            outputs[i] = layers[i]->forward(*x);
+            x = &outputs[i];
+        }
+    };
+    auto run_backward = [&] {
+        vector<T> grad(outputs.back().size(), T(1e-3));
+        for (size_t i = layers.size(); i-- > 0;) grad = layers[i]->backward(grad);
+    };
+
+    run_forward();
+    run_backward();
+
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) run_forward();
+    auto middle = chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) run_backward();
+    auto end = chrono::steady_clock::now();
+
+    return {chrono::duration<double, micro>(middle - start).count() / iterations,
+            chrono::duration<double, micro>(end - middle).count() / iterations};
+}
+
+void report(const string& name, size_t params, Timing timing, const Timing& baseline) {
+    cout << left << setw(28) << name << right
+         << setw(10) << params
+         << setw(12) << fixed << setprecision(1) << timing.forward_us
+         << setw(12) << timing.backward_us
+         << setw(10) << setprecision(2) << baseline.forward_us / timing.forward_us << "x\n";
+}
+
+size_t param_count(Lay<T>& layer) {
+    vector<ParamRef<T>> params;
+    layer.collect_params(params);
+    size_t count = 0;
+    for (const auto& p : params) count += p.size;
+    return count;
+}
+
+int main(int argc, char** argv) {
+    size_t height = argc > 1 ? stoul(argv[1]) : 56;
+    size_t width = argc > 2 ? stoul(argv[2]) : 56;
+    size_t channels = argc > 3 ? stoul(argv[3]) : 32;
+    size_t filters = argc > 4 ? stoul(argv[4]) : 64;
+    size_t groups = argc > 5 ? stoul(argv[5]) : 4;
+    size_t iterations = argc > 6 ? stoul(argv[6]) : 20;
+
+    vector<T> input(channels * height * width);
+    for (size_t i = 0; i < input.size(); ++i) input[i] = static_cast<T>(sin(0.01 * i));
+    vector<size_t> shape{channels, height, width};
+
+    Conv2D<T> full(height, width, channels, 3, filters, 1, 1);
+    full.compile(shape);
+    Timing baseline = time_block({&full}, input, iterations);
+
+    GroupedConv2D<T> grouped(height, width, channels, 3, filters, groups, 1, 1);
+    grouped.compile(shape);
+    Timing grouped_timing = time_block({&grouped}, input, iterations);
+
+    DepthwiseConv2D<T> depthwise(height, width, channels, 3, 1, 1);
+    PointwiseConv2D<T> pointwise(height, width, channels, filters);
+    depthwise.compile(shape);
+    pointwise.compile(shape);
+    Timing depthwise_timing = time_block({&depthwise}, input, iterations);
+    Timing separable_timing = time_block({&depthwise, &pointwise}, input, iterations);
+
+    Conv2D<T> full_pointwise(height, width, channels, 1, filters);
+    full_pointwise.compile(shape);
+    Timing full_pointwise_timing = time_block({&full_pointwise}, input, iterations);
+    Timing pointwise_timing = time_block({&pointwise}, input, iterations);
+
+    cout << channels << "x" << height << "x" << width << " -> " << filters
+         << " channels, 3x3 kernels, " << iterations << " iterations\n\n"
+         << left << setw(28) << "layer" << right << setw(10) << "params"
+         << setw(12) << "fwd us" << setw(12) << "bwd us" << setw(11) << "speedup\n";
+    report("Conv2D 3x3", param_count(full), baseline, baseline);
+    report("GroupedConv2D 3x3 g=" + to_string(groups), param_count(grouped), grouped_timing, baseline);
+    report("DepthwiseConv2D 3x3", param_count(depthwise), depthwise_timing, baseline);
+    report("Depthwise + Pointwise", param_count(depthwise) + param_count(pointwise),
+           separable_timing, baseline);
+    cout << "\n";
+    report("Conv2D 1x1", param_count(full_pointwise), full_pointwise_timing, full_pointwise_timing);
+    report("PointwiseConv2D", param_count(pointwise), pointwise_timing, full_pointwise_timing);
+    return 0;
+}
@@ -1,14 +1,17 @@
 #pragma once
 #include "lay.h"
 #include "activations.h"
+#include "kernels.h"
+#include "aligned_allocator.h"
+#include "random.h"
 #include <memory>
 #include <vector>
 #include <stdexcept>
-#include <cstdlib>
 #include <iostream>
 #include <sstream>
 #include <map>
 #include <cmath>
+#include <algorithm>
 
 template<typename T>
 class Dense : public Lay<T> {
@@ -16,46 +19,31 @@ class Dense : public Lay<T> {
     size_t m_outputSize;
     std::function<T(T)> m_activation;
     std::function<T(T)> m_activation_deriv;
-    std::vector<T> m_weights;
+    AlignedVector<T> m_weights;
     std::vector<T> m_biases;
     std::vector<T> m_last_input;
     std::vector<T> m_last_preactivation;
-    std::vector<T> m_dweights;
+    AlignedVector<T> m_dweights;
+    AlignedVector<T> m_batch_inputs;  // [in][count] for forward_batch
+    AlignedVector<T> m_batch_outputs; // [out][count]
     std::vector<T> m_dbiases;
     std::string m_activation_name = "linear";
+    bool m_compiled = false;
+    Philox m_rng{0, Philox::next_stream()};
 
     void initializeWeights() {
         m_weights.resize(m_inputSize * m_outputSize);
         m_biases.resize(m_outputSize);
-        m_dweights.resize(m_inputSize * m_outputSize);
-        m_dbiases.resize(m_outputSize);
         
         T range = sqrt(6.0 / (m_inputSize + m_outputSize));
-        for (size_t i = 0; i < m_weights.size(); ++i) {
-            m_weights[i] = static_cast<T>(rand()) / RAND_MAX * 2 * range - range;
-        }
+        m_rng.fill_uniform(m_weights.data(), m_weights.size(), -range, range, 0);
     }
 
 public:
   
     void set_activation(const std::string& name) {
         m_activation_name = name;
-        if (name == "sigmoid") {
-            m_activation = Activations<T>::sigmoid;
-            m_activation_deriv = Activations<T>::sigmoid_deriv;
-        } else if (name == "relu") {
-            m_activation = Activations<T>::relu;
-            m_activation_deriv = Activations<T>::relu_deriv;
-        } else if (name == "leakyRelu") {
-            m_activation = Activations<T>::leakyRelu;
-            m_activation_deriv = Activations<T>::leakyRelu_deriv;
-        } else if (name == "tanh") {
-            m_activation = Activations<T>::tanh;
-            m_activation_deriv = Activations<T>::tanh_deriv;
-        } else {
-            m_activation = [](T x) { return x; };
-            m_activation_deriv = [](T) { return 1; };
-        }
+        Activations<T>::select(name, m_activation, m_activation_deriv);
     }
 
     Dense(size_t outputSize, const std::string& activation_name = "linear")
@@ -67,6 +55,26 @@ public:
 
     std::string getType() const override { return "Dense"; }
 
+    size_t input_size() const { return m_inputSize; }
+    size_t output_size() const { return m_outputSize; }
+    const std::string& activation_name() const { return m_activation_name; }
+    const AlignedVector<T>& weights() const { return m_weights; }
+    const std::vector<T>& biases() const { return m_biases; }
+
+    // Applies y = x * scale[j] + shift[j] to the pre-activation outputs,
+    // e.g. to fold a following BatchNorm into this layer.
+    void fold_affine(const std::vector<T>& scale, const std::vector<T>& shift) {
+        if (scale.size() != m_outputSize || shift.size() != m_outputSize || m_weights.empty()) {
+            throw std::runtime_error("Dense: cannot fold an affine map of size " +
+                                     std::to_string(scale.size()));
+        }
+        for (size_t j = 0; j < m_outputSize; ++j) {
+            T* row = &m_weights[j * m_inputSize];
+            for (size_t i = 0; i < m_inputSize; ++i) row[i] *= scale[j];
+            m_biases[j] = m_biases[j] * scale[j] + shift[j];
+        }
+    }
+
     void save(std::ostream& out) const override {
         out << m_inputSize << " " << m_outputSize << "\n";
         out << m_activation_name << "\n";
@@ -87,54 +95,122 @@ public:
         m_biases.resize(m_outputSize);
         for (size_t i = 0; i < m_biases.size(); ++i) in >> m_biases[i];
         
-        m_dweights.resize(m_weights.size(), 0);
-        m_dbiases.resize(m_biases.size(), 0);
+        m_compiled = false;
     }
 
-    std::vector<T> forward(const std::vector<T>& input) override {
+    std::vector<size_t> compile(const std::vector<size_t>& input_shape) override {
+        size_t input_size = shape_size(input_shape);
         if (m_weights.empty()) {
-            m_inputSize = input.size();
+            m_inputSize = input_size;
             initializeWeights();
-        } else if (input.size() != m_inputSize) {
-            throw std::runtime_error("Input size mismatch in Dense layer");
+        } else if (input_size != m_inputSize) {
+            std::ostringstream oss;
+            oss << "Dense: input size mismatch. Expected: " << m_inputSize
+                << ", Got: " << input_size;
+            throw std::runtime_error(oss.str());
         }
 
-        m_last_input = input;
-        std::vector<T> output(m_outputSize);
+        this->allocate_gradient(m_dweights, m_weights.size());
+        this->allocate_gradient(m_dbiases, m_biases.size());
+        m_last_input.resize(m_inputSize);
         m_last_preactivation.resize(m_outputSize);
+        m_compiled = true;
+        return {m_outputSize};
+    }
+
+    std::vector<T> forward(const std::vector<T>& input) override {
+        if (!m_compiled) compile({input.size()});
+
+        bool keep = !this->m_inference;
+        if (keep) std::copy(input.begin(), input.end(), m_last_input.begin());
+        std::vector<T> output(m_biases);
+        gemm(false, true, 1, m_outputSize, m_inputSize,
+             input.data(), m_inputSize, m_weights.data(), m_inputSize,
+             output.data(), m_outputSize, true);
 
         for (size_t j = 0; j < m_outputSize; ++j) {
-            T sum = m_biases[j];
-            for (size_t i = 0; i < m_inputSize; ++i) {
-                sum += input[i] * m_weights[j * m_inputSize + i];
-            }
-            m_last_preactivation[j] = sum;
-            output[j] = m_activation(sum);
+            if (keep) m_last_preactivation[j] = output[j];
+            output[j] = m_activation(output[j]);
         }
         return output;
     }
 
+    // One GEMM for the whole batch, computed transposed as
+    // out^T = W * in^T so that the GEMM takes its row form and vectorizes
+    // across the samples. Only the small input and output blocks are
+    // transposed; each output sums its products in the same order as
+    // forward().
+    std::vector<T> forward_batch(const std::vector<T>& inputs, size_t count) override {
+        if (!m_compiled) compile({count ? inputs.size() / count : 0});
+        if (!this->m_inference) this->m_saved_batch = inputs;
+
+        m_batch_inputs.resize(m_inputSize * count);
+        m_batch_outputs.resize(m_outputSize * count);
+        for (size_t n = 0; n < count; ++n) {
+            for (size_t i = 0; i < m_inputSize; ++i) m_batch_inputs[i * count + n] = inputs[n * m_inputSize + i];
+        }
+        for (size_t j = 0; j < m_outputSize; ++j) {
+            std::fill(m_batch_outputs.begin() + j * count, m_batch_outputs.begin() + (j + 1) * count, m_biases[j]);
+        }
+        gemm(false, false, m_outputSize, count, m_inputSize,
+             m_weights.data(), m_inputSize, m_batch_inputs.data(), count,
+             m_batch_outputs.data(), count, true);
+
+        std::vector<T> outputs(count * m_outputSize);
+        for (size_t n = 0; n < count; ++n) {
+            for (size_t j = 0; j < m_outputSize; ++j) {
+                outputs[n * m_outputSize + j] = m_activation(m_batch_outputs[j * count + n]);
+            }
+        }
+        return outputs;
+    }
+
     std::vector<T> backward(const std::vector<T>& output_gradient) override {
-        std::vector<T> input_gradient(m_inputSize, 0);
+        std::vector<T> input_gradient;
         std::vector<T> preact_gradient(m_outputSize);
 
         for (size_t j = 0; j < m_outputSize; ++j) {
             preact_gradient[j] = output_gradient[j] * m_activation_deriv(m_last_preactivation[j]);
         }
 
-        for (size_t j = 0; j < m_outputSize; ++j) {
-            for (size_t i = 0; i < m_inputSize; ++i) {
-                size_t index = j * m_inputSize + i;
-                m_dweights[index] += preact_gradient[j] * m_last_input[i];
-                input_gradient[i] += m_weights[index] * preact_gradient[j];
-            }
-            m_dbiases[j] += preact_gradient[j];
+        if (this->m_trainable && !m_dweights.empty()) {
+            gemm(true, false, m_outputSize, m_inputSize, 1,
+                 preact_gradient.data(), m_outputSize, m_last_input.data(), m_inputSize,
+                 m_dweights.data(), m_inputSize, true);
+            for (size_t j = 0; j < m_outputSize; ++j) m_dbiases[j] += preact_gradient[j];
+        }
+
+        if (this->m_input_gradient_required) {
+            input_gradient.resize(m_inputSize);
+            gemm(false, false, 1, m_inputSize, m_outputSize,
+                 preact_gradient.data(), m_outputSize, m_weights.data(), m_inputSize,
+                 input_gradient.data(), m_inputSize, false);
         }
 
         return input_gradient;
     }
 
+    // Takes effect the next time weights are initialized.
+    void seed(uint64_t seed, uint64_t stream) override {
+        m_rng = Philox(seed, stream);
+    }
+
+    void reinitialize() override {
+        if (m_weights.empty()) return;
+        initializeWeights();
+        std::fill(m_biases.begin(), m_biases.end(), T(0));
+        std::fill(m_dweights.begin(), m_dweights.end(), T(0));
+        std::fill(m_dbiases.begin(), m_dbiases.end(), T(0));
+    }
+
+    void collect_params(std::vector<ParamRef<T>>& params) override {
+        bool frozen = m_dweights.empty();
+        params.push_back({m_weights.data(), frozen ? nullptr : m_dweights.data(), m_weights.size()});
+        params.push_back({m_biases.data(), frozen ? nullptr : m_dbiases.data(), m_biases.size()});
+    }
+
     void update_weights(T learning_rate) override {
+        if (m_dweights.empty()) return;
         for (size_t i = 0; i < m_weights.size(); ++i) {
             m_weights[i] -= learning_rate * m_dweights[i];
             m_dweights[i] = 0;
@@ -0,0 +1,205 @@
+#pragma once
+#include "prefix_cache.h"
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+inline uint16_t float_to_half(float value) {
+    uint32_t x;
+    std::memcpy(&x, &value, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t abs = x & 0x7fffffff;
+
+    if (abs >= 0x7f800000) return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+    if (abs >= 0x477ff000) return sign | 0x7c00;
+    if (abs < 0x38800000) {
+        if (abs < 0x33000000) return sign;
+        uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+        uint32_t shift = 126 - (abs >> 23);
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t midpoint = 1u << (shift - 1);
+        if (rest > midpoint || (rest == midpoint && (half & 1))) ++half;
+        return static_cast<uint16_t>(sign | half);
+    }
+
+    uint32_t half = (abs - 0x38000000) >> 13;
+    uint32_t rest = abs & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) ++half;
+    return static_cast<uint16_t>(sign | half);
+}
+
+inline float half_to_float(uint16_t half) {
+    uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+
+    if (exponent == 0) {
+        float value = static_cast<float>(mantissa) * 5.9604644775390625e-8f;
+        return sign ? -value : value;
+    }
+
+    uint32_t x = exponent == 31
+        ? sign | 0x7f800000 | (mantissa << 13)
+        : sign | ((exponent + 112) << 23) | (mantissa << 13);
+    float value;
+    std::memcpy(&value, &x, sizeof(value));
+    return value;
+}
+
+// Prefix cache backed by a memory-mapped file (or anonymous memory when
+// the path is empty), holding a fixed number of samples. Features can be
+// stored as fp16 to halve the footprint. The file header records the
+// feature size and backbone fingerprint, so a file from an earlier run is
+// reused when the frozen prefix is unchanged and reset otherwise.
+template<typename T>
+class FeatureCache : public PrefixCache<T> {
+public:
+    enum class Precision : uint32_t { Full = 0, Half = 1 };
+
+private:
+    struct Header {
+        uint32_t magic;
+        uint32_t precision;
+        uint64_t value_size;
+        uint64_t feature_size;
+        uint64_t sample_count;
+        uint64_t fingerprint;
+    };
+
+    static constexpr uint32_t kMagic = 0x46434e4e;  // "NNCF"
+    static constexpr size_t kAlignment = 64;
+
+    std::string m_path;
+    size_t m_sample_count;
+    Precision m_precision;
+    size_t m_feature_size = 0;
+    size_t m_stride = 0;
+    size_t m_data_offset = 0;
+    void* m_map = nullptr;
+    size_t m_map_size = 0;
+    int m_fd = -1;
+    std::vector<uint16_t> m_half_row;
+
+    static size_t align(size_t size) {
+        return (size + kAlignment - 1) / kAlignment * kAlignment;
+    }
+
+    Header* header() const { return static_cast<Header*>(m_map); }
+    uint8_t* filled() const { return static_cast<uint8_t*>(m_map) + align(sizeof(Header)); }
+    uint8_t* row(size_t sample) const {
+        return static_cast<uint8_t*>(m_map) + m_data_offset + sample * m_stride;
+    }
+
+    void unmap() {
+        if (m_map) ::munmap(m_map, m_map_size);
+        if (m_fd >= 0) ::close(m_fd);
+        m_map = nullptr;
+        m_fd = -1;
+    }
+
+    void map(size_t feature_size, uint64_t fingerprint) {
+        size_t value_size = m_precision == Precision::Half ? sizeof(uint16_t) : sizeof(T);
+        m_feature_size = feature_size;
+        m_stride = align(feature_size * value_size);
+        m_data_offset = align(sizeof(Header)) + align(m_sample_count);
+        m_map_size = m_data_offset + m_sample_count * m_stride;
+
+        bool reuse = false;
+        if (m_path.empty()) {
+            m_map = ::mmap(nullptr, m_map_size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        } else {
+            m_fd = ::open(m_path.c_str(), O_RDWR | O_CREAT, 0644);
+            if (m_fd < 0) {
+                throw std::runtime_error("FeatureCache: cannot open " + m_path + ": " +
+                                         std::strerror(errno));
+            }
+            struct stat info;
+            reuse = ::fstat(m_fd, &info) == 0 && static_cast<size_t>(info.st_size) == m_map_size;
+            if (!reuse && (::ftruncate(m_fd, 0) != 0 ||
+                           ::ftruncate(m_fd, static_cast<off_t>(m_map_size)) != 0)) {
+                unmap();
+                throw std::runtime_error("FeatureCache: cannot size " + m_path);
+            }
+            m_map = ::mmap(nullptr, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+        }
+        if (m_map == MAP_FAILED) {
+            m_map = nullptr;
+            unmap();
+            throw std::runtime_error("FeatureCache: mmap failed");
+        }
+
+        Header* h = header();
+        reuse = reuse && h->magic == kMagic &&
+                h->precision == static_cast<uint32_t>(m_precision) &&
+                h->value_size == sizeof(T) && h->feature_size == feature_size &&
+                h->sample_count == m_sample_count && h->fingerprint == fingerprint;
+        if (!reuse) {
+            std::memset(filled(), 0, m_sample_count);
+            *h = Header{kMagic, static_cast<uint32_t>(m_precision), sizeof(T),
+                        feature_size, m_sample_count, fingerprint};
+        }
+        m_half_row.resize(m_precision == Precision::Half ? feature_size : 0);
+    }
+
+public:
+    FeatureCache(const std::string& path, size_t sample_count,
+                 Precision precision = Precision::Full)
+        : m_path(path), m_sample_count(sample_count), m_precision(precision) {}
+
+    ~FeatureCache() { unmap(); }
+
+    FeatureCache(const FeatureCache&) = delete;
+    FeatureCache& operator=(const FeatureCache&) = delete;
+
+    void bind(size_t feature_size, uint64_t fingerprint) override {
+        if (m_map && header()->feature_size == feature_size &&
+            header()->fingerprint == fingerprint) return;
+        unmap();
+        map(feature_size, fingerprint);
+    }
+
+    bool lookup(size_t sample, std::vector<T>& features) override {
+        if (!m_map || sample >= m_sample_count || !filled()[sample]) return false;
+
+        features.resize(m_feature_size);
+        if (m_precision == Precision::Half) {
+            const uint16_t* src = reinterpret_cast<const uint16_t*>(row(sample));
+            for (size_t i = 0; i < m_feature_size; ++i) {
+                features[i] = static_cast<T>(half_to_float(src[i]));
+            }
+        } else {
+            std::memcpy(features.data(), row(sample), m_feature_size * sizeof(T));
+        }
+        return true;
+    }
+
+    // Samples outside [0, sample_count) are simply not cached.
+    void store(size_t sample, const std::vector<T>& features) override {
+        if (!m_map || sample >= m_sample_count || features.size() != m_feature_size) return;
+
+        if (m_precision == Precision::Half) {
+            for (size_t i = 0; i < m_feature_size; ++i) {
+                m_half_row[i] = float_to_half(static_cast<float>(features[i]));
+            }
+            std::memcpy(row(sample), m_half_row.data(), m_feature_size * sizeof(uint16_t));
+        } else {
+            std::memcpy(row(sample), features.data(), m_feature_size * sizeof(T));
+        }
+        filled()[sample] = 1;
+    }
+
+    size_t cached_count() const {
+        size_t count = 0;
+        for (size_t i = 0; m_map && i < m_sample_count; ++i) count += filled()[i];
+        return count;
+    }
+};
@@ -21,17 +21,26 @@ public:
     void load(std::istream& in) override {
         in >> m_input_size; }
 
+    std::vector<size_t> compile(const std::vector<size_t>& input_shape) override {
+        m_input_size = shape_size(input_shape);
+        return {m_input_size};
+    }
+
     std::vector<T> forward(const std::vector<T>& input) override {
-        m_input_size = input.size();
         return input;
     }
 
+    std::vector<T> forward(std::vector<T>&& input) override {
+        return std::move(input);
+    }
+
     std::vector<T> backward(const std::vector<T>& output_gradient) override {
-        if (output_gradient.size() != m_input_size) {
-            throw std::runtime_error("Flatten: output gradient size mismatch");
-        }
         return output_gradient;
     }
 
+    std::vector<T> backward(std::vector<T>&& output_gradient) override {
+        return std::move(output_gradient);
+    }
+
     void update_weights(T learning_rate) override {}
 };
\ No newline at end of file
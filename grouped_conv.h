@@ -0,0 +1,433 @@
+#pragma once
+#include "lay.h"
+#include "random.h"
+#include "kernels.h"
+#include <vector>
+#include <stdexcept>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <string>
+
+// Convolution where input and output channels are split into `groups`
+// independent slices: output channel k only sees the C / groups input
+// channels of its group. Weights are stored as [K][C / groups][kh][kw],
+// which for groups == 1 is the Conv2D order. Works in NCHW only.
+template<typename T>
+class GroupedConv2D : public Lay<T> {
+protected:
+    size_t m_input_height = 0;
+    size_t m_input_width = 0;
+    size_t m_input_channels = 0;
+    size_t m_kernel_size = 1;
+    size_t m_output_channels = 0;
+    size_t m_groups = 1;
+    size_t m_stride = 1;
+    size_t m_padding = 0;
+
+    size_t m_output_height = 0;
+    size_t m_output_width = 0;
+
+    std::vector<T> m_weights;
+    std::vector<T> m_biases;
+    std::vector<T> m_padded_input;
+    std::vector<T> m_dweights;
+    std::vector<T> m_dbiases;
+    std::vector<T> m_padded_input_grad;
+
+    bool m_compiled = false;
+    Philox m_rng{0, Philox::next_stream()};
+    void (GroupedConv2D::*m_forward_kernel)(std::vector<T>&) const = &GroupedConv2D::forward_direct;
+    void (GroupedConv2D::*m_backward_kernel)(const std::vector<T>&, bool, bool) = &GroupedConv2D::backward_direct;
+
+    // Plane positions per cache tile in the 1x1 kernel.
+    static constexpr size_t kGemmTile = 512;
+
+    size_t group_inputs() const { return m_input_channels / m_groups; }
+    size_t group_outputs() const { return m_output_channels / m_groups; }
+    size_t filter_size() const { return group_inputs() * m_kernel_size * m_kernel_size; }
+    bool is_pointwise() const { return m_kernel_size == 1 && m_stride == 1 && m_padding == 0; }
+
+    void initialize_weights() {
+        size_t window = m_kernel_size * m_kernel_size;
+        size_t fan_in = group_inputs() * window;
+        size_t fan_out = group_outputs() * window;
+        T range = std::sqrt(6.0 / (fan_in + fan_out));
+
+        m_weights.resize(m_output_channels * filter_size());
+        m_rng.fill_uniform(m_weights.data(), m_weights.size(), -range, range, 0);
+
+        m_biases.resize(m_output_channels, 0);
+    }
+
+    void validate() {
+        if (m_groups == 0 || m_input_channels % m_groups != 0 || m_output_channels % m_groups != 0) {
+            std::ostringstream oss;
+            oss << getType() << ": " << m_input_channels << " input and " << m_output_channels
+                << " output channels cannot be split into " << m_groups << " groups";
+            throw std::runtime_error(oss.str());
+        }
+        if (m_kernel_size == 0 || m_stride == 0 ||
+            m_input_height + 2 * m_padding < m_kernel_size ||
+            m_input_width + 2 * m_padding < m_kernel_size) {
+            throw std::runtime_error("Invalid convolution parameters: output dimensions <= 0");
+        }
+        m_output_height = (m_input_height + 2 * m_padding - m_kernel_size) / m_stride + 1;
+        m_output_width = (m_input_width + 2 * m_padding - m_kernel_size) / m_stride + 1;
+    }
+
+    void apply_padding(const std::vector<T>& input) {
+        pad_nchw(input.data(), m_input_channels, m_input_height, m_input_width,
+                 m_padding, m_padded_input.data());
+    }
+
+    void remove_padding(std::vector<T>& input) const {
+        unpad_nchw(m_padded_input_grad.data(), m_input_channels, m_input_height, m_input_width,
+                   m_padding, input.data());
+    }
+
+    // One output row at a time: every (channel, kh, kw) tap adds a strided
+    // input row into it, so the row stays in L1 and the inner loop runs
+    // along the width. With one input channel per group this is the
+    // depthwise kernel.
+    void forward_direct(std::vector<T>& output) const {
+        size_t padded_height = m_input_height + 2 * m_padding;
+        size_t padded_width = m_input_width + 2 * m_padding;
+        size_t in_plane = padded_height * padded_width;
+        size_t out_plane = m_output_height * m_output_width;
+        size_t filter = filter_size();
+        size_t window = m_kernel_size * m_kernel_size;
+
+        for (size_t k = 0; k < m_output_channels; ++k) {
+            const T* input = &m_padded_input[(k / group_outputs()) * group_inputs() * in_plane];
+            const T* weights = &m_weights[k * filter];
+
+            for (size_t h = 0; h < m_output_height; ++h) {
+                T* out = &output[k * out_plane + h * m_output_width];
+                std::fill(out, out + m_output_width, m_biases[k]);
+
+                for (size_t c = 0; c < group_inputs(); ++c) {
+                    for (size_t kh = 0; kh < m_kernel_size; ++kh) {
+                        const T* in_row = input + c * in_plane + (h * m_stride + kh) * padded_width;
+                        const T* taps = weights + c * window + kh * m_kernel_size;
+                        for (size_t kw = 0; kw < m_kernel_size; ++kw) {
+                            T weight = taps[kw];
+                            const T* in = in_row + kw;
+                            if (m_stride == 1) {
+                                for (size_t w = 0; w < m_output_width; ++w) out[w] += weight * in[w];
+                            } else {
+                                for (size_t w = 0; w < m_output_width; ++w) out[w] += weight * in[w * m_stride];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // 1x1 kernel, stride 1, no padding: per group a (K/G x C/G) * (C/G x HW)
+    // product, over tiles of the plane that fit in L1.
+    void forward_gemm(std::vector<T>& output) const {
+        size_t plane = m_output_height * m_output_width;
+        size_t inputs = group_inputs();
+        size_t outputs = group_outputs();
+
+        for (size_t g = 0; g < m_groups; ++g) {
+            const T* input = &m_padded_input[g * inputs * plane];
+            const T* weights = &m_weights[g * outputs * inputs];
+            T* out = &output[g * outputs * plane];
+            for (size_t k = 0; k < outputs; ++k) {
+                std::fill(out + k * plane, out + (k + 1) * plane, m_biases[g * outputs + k]);
+            }
+            for (size_t p0 = 0; p0 < plane; p0 += kGemmTile) {
+                size_t tile = std::min(kGemmTile, plane - p0);
+                gemm(false, false, outputs, tile, inputs, weights, inputs,
+                     input + p0, plane, out + p0, plane, true);
+            }
+        }
+    }
+
+    void backward_direct(const std::vector<T>& output_gradient, bool input_grad, bool param_grad) {
+        size_t padded_height = m_input_height + 2 * m_padding;
+        size_t padded_width = m_input_width + 2 * m_padding;
+        size_t in_plane = padded_height * padded_width;
+        size_t out_plane = m_output_height * m_output_width;
+        size_t filter = filter_size();
+        size_t window = m_kernel_size * m_kernel_size;
+
+        for (size_t k = 0; k < m_output_channels; ++k) {
+            size_t base = (k / group_outputs()) * group_inputs() * in_plane;
+            const T* weights = &m_weights[k * filter];
+            T* dweights = param_grad ? &m_dweights[k * filter] : nullptr;
+
+            for (size_t h = 0; h < m_output_height; ++h) {
+                const T* grad = &output_gradient[k * out_plane + h * m_output_width];
+                if (param_grad) {
+                    T sum = 0;
+                    for (size_t w = 0; w < m_output_width; ++w) sum += grad[w];
+                    m_dbiases[k] += sum;
+                }
+
+                for (size_t c = 0; c < group_inputs(); ++c) {
+                    for (size_t kh = 0; kh < m_kernel_size; ++kh) {
+                        size_t row = base + c * in_plane + (h * m_stride + kh) * padded_width;
+                        size_t tap = c * window + kh * m_kernel_size;
+                        for (size_t kw = 0; kw < m_kernel_size; ++kw) {
+                            if (param_grad) {
+                                const T* in = &m_padded_input[row + kw];
+                                T sum = 0;
+                                for (size_t w = 0; w < m_output_width; ++w) sum += grad[w] * in[w * m_stride];
+                                dweights[tap + kw] += sum;
+                            }
+                            if (input_grad) {
+                                T weight = weights[tap + kw];
+                                T* in_grad = &m_padded_input_grad[row + kw];
+                                for (size_t w = 0; w < m_output_width; ++w) in_grad[w * m_stride] += weight * grad[w];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    void backward_gemm(const std::vector<T>& output_gradient, bool input_grad, bool param_grad) {
+        size_t plane = m_output_height * m_output_width;
+        size_t inputs = group_inputs();
+        size_t outputs = group_outputs();
+
+        for (size_t g = 0; g < m_groups; ++g) {
+            const T* grad = &output_gradient[g * outputs * plane];
+            size_t base = g * inputs * plane;
+            size_t filters = g * outputs * inputs;
+
+            if (param_grad) {
+                for (size_t k = 0; k < outputs; ++k) {
+                    const T* row = grad + k * plane;
+                    T sum = 0;
+                    for (size_t p = 0; p < plane; ++p) sum += row[p];
+                    m_dbiases[g * outputs + k] += sum;
+                }
+                // dW (K/G x C/G) += grad (K/G x HW) * input^T.
+                gemm(false, true, outputs, inputs, plane, grad, plane,
+                     &m_padded_input[base], plane, &m_dweights[filters], inputs, true);
+            }
+            if (input_grad) {
+                // input_grad (C/G x HW) += W^T * grad.
+                gemm(true, false, inputs, plane, outputs, &m_weights[filters], inputs,
+                     grad, plane, &m_padded_input_grad[base], plane, true);
+            }
+        }
+    }
+
+    void read_parameters(std::istream& in) {
+        in >> m_input_height >> m_input_width >> m_input_channels >> m_kernel_size
+           >> m_output_channels >> m_groups >> m_stride >> m_padding;
+        if (in.fail()) {
+            throw std::runtime_error(getType() + ": failed to read parameters");
+        }
+        validate();
+    }
+
+public:
+    GroupedConv2D(size_t input_height, size_t input_width, size_t input_channels,
+                  size_t kernel_size, size_t output_channels, size_t groups,
+                  size_t stride = 1, size_t padding = 0)
+        : m_input_height(input_height), m_input_width(input_width),
+          m_input_channels(input_channels), m_kernel_size(kernel_size),
+          m_output_channels(output_channels), m_groups(groups),
+          m_stride(stride), m_padding(padding) {
+        validate();
+    }
+
+    GroupedConv2D() = default;
+
+    std::string getType() const override { return "GroupedConv2D"; }
+
+    size_t groups() const { return m_groups; }
+
+    // Applies y = x * scale[k] + shift[k] to output channel k, e.g. to
+    // fold a following BatchNorm into this layer.
+    void fold_affine(const std::vector<T>& scale, const std::vector<T>& shift) {
+        if (scale.size() != m_output_channels || shift.size() != m_output_channels || m_weights.empty()) {
+            throw std::runtime_error(getType() + ": cannot fold an affine map of size " +
+                                     std::to_string(scale.size()));
+        }
+        size_t filter = filter_size();
+        for (size_t k = 0; k < m_output_channels; ++k) {
+            T* weights = &m_weights[k * filter];
+            for (size_t i = 0; i < filter; ++i) weights[i] *= scale[k];
+            m_biases[k] = m_biases[k] * scale[k] + shift[k];
+        }
+    }
+
+    void save(std::ostream& out) const override {
+        out << m_input_height << " " << m_input_width << " "
+            << m_input_channels << " " << m_kernel_size << " "
+            << m_output_channels << " " << m_groups << " "
+            << m_stride << " " << m_padding << "\n";
+
+        for (const auto& w : m_weights) out << w << " ";
+        out << "\n";
+
+        for (const auto& b : m_biases) out << b << " ";
+        out << "\n";
+    }
+
+    void load(std::istream& in) override {
+        read_parameters(in);
+
+        m_weights.resize(m_output_channels * filter_size());
+        for (size_t i = 0; i < m_weights.size(); ++i) {
+            if (!(in >> m_weights[i])) {
+                throw std::runtime_error(getType() + ": weight data truncated");
+            }
+        }
+
+        m_biases.resize(m_output_channels);
+        for (size_t i = 0; i < m_output_channels; ++i) {
+            if (!(in >> m_biases[i])) {
+                throw std::runtime_error(getType() + ": bias data truncated");
+            }
+        }
+
+        m_compiled = false;
+    }
+
+    std::vector<size_t> compile(const std::vector<size_t>& input_shape) override {
+        size_t expected = m_input_channels * m_input_height * m_input_width;
+        bool matches = input_shape.size() == 3
+            ? input_shape == std::vector<size_t>{m_input_channels, m_input_height, m_input_width}
+            : shape_size(input_shape) == expected;
+        if (!matches) {
+            std::ostringstream oss;
+            oss << getType() << ": input shape mismatch. Expected: " << m_input_channels
+                << "x" << m_input_height << "x" << m_input_width
+                << " (" << expected << " values), Got: " << shape_size(input_shape);
+            throw std::runtime_error(oss.str());
+        }
+
+        if (m_weights.empty()) initialize_weights();
+        this->allocate_gradient(m_dweights, m_weights.size());
+        this->allocate_gradient(m_dbiases, m_biases.size());
+
+        size_t padded_size = m_input_channels * (m_input_height + 2 * m_padding) *
+                             (m_input_width + 2 * m_padding);
+        m_padded_input.assign(padded_size, 0);
+        m_padded_input_grad.assign(padded_size, 0);
+
+        if (is_pointwise()) {
+            m_forward_kernel = &GroupedConv2D::forward_gemm;
+            m_backward_kernel = &GroupedConv2D::backward_gemm;
+        } else {
+            m_forward_kernel = &GroupedConv2D::forward_direct;
+            m_backward_kernel = &GroupedConv2D::backward_direct;
+        }
+
+        m_compiled = true;
+        return {m_output_channels, m_output_height, m_output_width};
+    }
+
+    std::vector<T> forward(const std::vector<T>& input) override {
+        if (!m_compiled) compile({input.size()});
+
+        apply_padding(input);
+
+        std::vector<T> output(m_output_channels * m_output_height * m_output_width);
+        (this->*m_forward_kernel)(output);
+
+        return output;
+    }
+
+    std::vector<T> backward(const std::vector<T>& output_gradient) override {
+        bool input_grad = this->m_input_gradient_required;
+        bool param_grad = this->m_trainable && !m_dweights.empty();
+        if (input_grad) std::fill(m_padded_input_grad.begin(), m_padded_input_grad.end(), 0);
+
+        // Parameter gradients accumulate across calls until update_weights.
+        (this->*m_backward_kernel)(output_gradient, input_grad, param_grad);
+
+        if (!input_grad) return {};
+
+        std::vector<T> input_gradient(m_input_channels * m_input_height * m_input_width);
+        remove_padding(input_gradient);
+        return input_gradient;
+    }
+
+    // Takes effect the next time weights are initialized.
+    void seed(uint64_t seed, uint64_t stream) override {
+        m_rng = Philox(seed, stream);
+    }
+
+    void reinitialize() override {
+        if (m_weights.empty()) return;
+        initialize_weights();
+        std::fill(m_biases.begin(), m_biases.end(), T(0));
+        std::fill(m_dweights.begin(), m_dweights.end(), T(0));
+        std::fill(m_dbiases.begin(), m_dbiases.end(), T(0));
+    }
+
+    void collect_params(std::vector<ParamRef<T>>& params) override {
+        bool frozen = m_dweights.empty();
+        params.push_back({m_weights.data(), frozen ? nullptr : m_dweights.data(), m_weights.size()});
+        params.push_back({m_biases.data(), frozen ? nullptr : m_dbiases.data(), m_biases.size()});
+    }
+
+    void update_weights(T learning_rate) override {
+        if (m_dweights.empty()) return;
+        for (size_t i = 0; i < m_weights.size(); ++i) {
+            m_weights[i] -= learning_rate * m_dweights[i];
+            m_dweights[i] = 0;
+        }
+
+        for (size_t i = 0; i < m_biases.size(); ++i) {
+            m_biases[i] -= learning_rate * m_dbiases[i];
+            m_dbiases[i] = 0;
+        }
+    }
+};
+
+// One filter per input channel (times a channel multiplier): output
+// channel k reads only input channel k / multiplier.
+template<typename T>
+class DepthwiseConv2D : public GroupedConv2D<T> {
+public:
+    DepthwiseConv2D(size_t input_height, size_t input_width, size_t channels,
+                    size_t kernel_size, size_t stride = 1, size_t padding = 0,
+                    size_t multiplier = 1)
+        : GroupedConv2D<T>(input_height, input_width, channels, kernel_size,
+                           channels * multiplier, channels, stride, padding) {}
+
+    DepthwiseConv2D() = default;
+
+    std::string getType() const override { return "DepthwiseConv2D"; }
+
+    void load(std::istream& in) override {
+        GroupedConv2D<T>::load(in);
+        if (this->m_groups != this->m_input_channels) {
+            throw std::runtime_error("DepthwiseConv2D: groups must equal the input channels");
+        }
+    }
+};
+
+// 1x1 convolution across all channels, computed as a matrix product.
+template<typename T>
+class PointwiseConv2D : public GroupedConv2D<T> {
+public:
+    PointwiseConv2D(size_t input_height, size_t input_width, size_t input_channels,
+                    size_t output_channels)
+        : GroupedConv2D<T>(input_height, input_width, input_channels, 1,
+                           output_channels, 1) {}
+
+    PointwiseConv2D() = default;
+
+    std::string getType() const override { return "PointwiseConv2D"; }
+
+    void load(std::istream& in) override {
+        GroupedConv2D<T>::load(in);
+        if (!this->is_pointwise() || this->m_groups != 1) {
+            throw std::runtime_error("PointwiseConv2D: expected a 1x1 kernel, stride 1, no padding");
+        }
+    }
+};
@@ -0,0 +1,470 @@
+#pragma once
+#include "model.h"
+#include "trainer.h"
+#include "loss.h"
+#include "random.h"
+#include "thread_pool.h"
+#include <vector>
+#include <map>
+#include <string>
+#include <sstream>
+#include <memory>
+#include <functional>
+#include <future>
+#include <exception>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <cmath>
+#include <limits>
+#include <mutex>
+
+// One point of a SearchSpace. Integer parameters are stored as numbers.
+struct TrialConfig {
+    std::map<std::string, double> numbers;
+    std::map<std::string, std::string> choices;
+
+    double number(const std::string& name, double fallback) const {
+        auto it = numbers.find(name);
+        return it == numbers.end() ? fallback : it->second;
+    }
+
+    size_t integer(const std::string& name, size_t fallback) const {
+        auto it = numbers.find(name);
+        return it == numbers.end() ? fallback : static_cast<size_t>(std::llround(it->second));
+    }
+
+    const std::string& choice(const std::string& name) const {
+        auto it = choices.find(name);
+        if (it == choices.end()) throw std::runtime_error("TrialConfig: no parameter " + name);
+        return it->second;
+    }
+
+    std::string describe() const {
+        std::ostringstream oss;
+        for (const auto& [name, value] : numbers) oss << name << "=" << value << " ";
+        for (const auto& [name, value] : choices) oss << name << "=" << value << " ";
+        std::string text = oss.str();
+        if (!text.empty()) text.pop_back();
+        return text;
+    }
+};
+
+class SearchSpace {
+    enum class Kind { Uniform, LogUniform, Integer, Choice };
+
+    struct Dimension {
+        std::string name;
+        Kind kind;
+        double low;
+        double high;
+        size_t grid_points;
+        std::vector<std::string> options;
+    };
+
+    std::vector<Dimension> m_dimensions;
+
+    // Maps u in [0, 1] onto the dimension; returns the option index for choices.
+    static double place(const Dimension& d, double u) {
+        switch (d.kind) {
+        case Kind::Uniform: return d.low + u * (d.high - d.low);
+        case Kind::LogUniform: return std::exp(std::log(d.low) + u * (std::log(d.high) - std::log(d.low)));
+        case Kind::Integer: return std::min(d.high, std::floor(d.low + u * (d.high - d.low + 1)));
+        case Kind::Choice: return std::min<double>(d.options.size() - 1, std::floor(u * d.options.size()));
+        }
+        return d.low;
+    }
+
+    static void assign(const Dimension& d, double value, TrialConfig& config) {
+        if (d.kind == Kind::Choice) {
+            config.choices[d.name] = d.options[static_cast<size_t>(value)];
+        } else {
+            config.numbers[d.name] = value;
+        }
+    }
+
+    std::vector<double> grid_values(const Dimension& d) const {
+        std::vector<double> values;
+        if (d.kind == Kind::Choice) {
+            for (size_t i = 0; i < d.options.size(); ++i) values.push_back(static_cast<double>(i));
+        } else if (d.kind == Kind::Integer && d.grid_points == 0) {
+            for (double v = d.low; v <= d.high; ++v) values.push_back(v);
+        } else {
+            size_t points = std::max<size_t>(d.grid_points, 1);
+            for (size_t i = 0; i < points; ++i) {
+                double u = points == 1 ? 0.5 : static_cast<double>(i) / (points - 1);
+                double value = place(d, u);
+                if (values.empty() || values.back() != value) values.push_back(value);
+            }
+        }
+        return values;
+    }
+
+    SearchSpace& add(Dimension dimension) {
+        for (const auto& d : m_dimensions) {
+            if (d.name == dimension.name) throw std::runtime_error("SearchSpace: duplicate " + d.name);
+        }
+        m_dimensions.push_back(std::move(dimension));
+        return *this;
+    }
+
+public:
+    // grid_points is the number of evenly spaced values grid() uses.
+    SearchSpace& uniform(const std::string& name, double low, double high, size_t grid_points = 3) {
+        return add({name, Kind::Uniform, low, high, grid_points, {}});
+    }
+
+    SearchSpace& log_uniform(const std::string& name, double low, double high, size_t grid_points = 3) {
+        if (low <= 0 || high <= 0) throw std::runtime_error("SearchSpace: " + name + " needs positive bounds");
+        return add({name, Kind::LogUniform, low, high, grid_points, {}});
+    }
+
+    // Inclusive range; grid() tries every value unless grid_points is set.
+    SearchSpace& integer(const std::string& name, long low, long high, size_t grid_points = 0) {
+        return add({name, Kind::Integer, static_cast<double>(low), static_cast<double>(high), grid_points, {}});
+    }
+
+    SearchSpace& choice(const std::string& name, std::vector<std::string> options) {
+        if (options.empty()) throw std::runtime_error("SearchSpace: " + name + " has no options");
+        return add({name, Kind::Choice, 0, 0, 0, std::move(options)});
+    }
+
+    // Draw number `index` of the stream; the same index always gives the
+    // same configuration.
+    TrialConfig sample(const Philox& rng, uint64_t index) const {
+        std::vector<double> u(m_dimensions.size());
+        rng.fill_uniform(u.data(), u.size(), 0.0, 1.0, index * m_dimensions.size());
+        TrialConfig config;
+        for (size_t i = 0; i < m_dimensions.size(); ++i) {
+            assign(m_dimensions[i], place(m_dimensions[i], u[i]), config);
+        }
+        return config;
+    }
+
+    std::vector<TrialConfig> grid() const {
+        std::vector<TrialConfig> configs(1);
+        for (const auto& d : m_dimensions) {
+            std::vector<TrialConfig> expanded;
+            for (const auto& config : configs) {
+                for (double value : grid_values(d)) {
+                    expanded.push_back(config);
+                    assign(d, value, expanded.back());
+                }
+            }
+            configs = std::move(expanded);
+        }
+        return configs;
+    }
+};
+
+template<typename T>
+struct SearchConfig {
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    uint64_t seed = 0;
+    // Learning rate for configurations without a "learning_rate" number.
+    T learning_rate = T(0.01);
+    // A trial stops when its validation loss is not finite or exceeds
+    // divergence_ratio times its first-epoch loss...
+    T divergence_ratio = T(10);
+    // ...or has not improved for this many epochs (0 disables).
+    size_t patience = 0;
+    // Released models kept for later trials of the same structure.
+    size_t idle_models = 8;
+};
+
+template<typename T>
+struct TrialResult {
+    size_t id;
+    TrialConfig config;
+    // Validation loss after each epoch.
+    std::vector<T> losses;
+    // Stopped for diverging or stalling, as opposed to being outranked
+    // by successive halving or running out of budget.
+    bool stopped_early = false;
+
+    T loss() const {
+        if (losses.empty() || !std::isfinite(losses.back())) return std::numeric_limits<T>::infinity();
+        return losses.back();
+    }
+};
+
+// Trains many configurations of one model family concurrently on a
+// shared thread pool. All trials read the same training and validation
+// sets. The builder adds and compiles the layers for a configuration; it
+// is called from worker threads. Learning rate comes from the
+// "learning_rate" number of each configuration.
+//
+// random() and grid() train every configuration for the full budget.
+// successive_halving() trains all for a few epochs, keeps the best
+// 1 / eta and repeats with eta times the epochs; hyperband() runs
+// successive halving over several trade-offs between the number of
+// configurations and their starting budget. Results are sorted by final
+// validation loss, best first.
+//
+// Configurations that differ only in "learning_rate" are assumed to build
+// the same layers. A new trial takes the model and trainer of a released
+// one with such a configuration and reinitializes them under its own
+// seed, so its weight, gradient and activation buffers are not allocated
+// again.
+template<typename T>
+class HyperparameterSearch {
+public:
+    using Samples = std::vector<std::pair<std::vector<T>, std::vector<T>>>;
+    using Builder = std::function<void(const TrialConfig&, Model<T>&)>;
+
+private:
+    struct Trial {
+        TrialResult<T> result;
+        std::unique_ptr<Model<T>> model;
+        std::unique_ptr<BackwardTrainer<T>> trainer;
+        bool finished = false;
+    };
+
+    // Scratch reused by every trial a worker runs.
+    struct Workspace {
+        std::vector<size_t> order;
+        std::vector<uint32_t> bits;
+    };
+
+    // A released trial's model, waiting for a trial with the same structure.
+    struct Idle {
+        std::string structure;
+        std::unique_ptr<Model<T>> model;
+        std::unique_ptr<BackwardTrainer<T>> trainer;
+    };
+
+    const SearchSpace& m_space;
+    const Samples& m_train;
+    const Samples& m_validation;
+    Builder m_builder;
+    const LossFunction<T>& m_loss;
+    SearchConfig<T> m_config;
+    ThreadPool m_pool;
+    std::vector<Workspace> m_workspaces;
+    // Oldest first, at most m_config.idle_models.
+    std::vector<Idle> m_idle;
+    std::mutex m_idle_mutex;
+    // Trial shuffles use stream = trial id; configurations come from the last stream.
+    Philox m_sampler;
+    size_t m_next_id = 0;
+
+    static std::string structure(const TrialConfig& config) {
+        TrialConfig layers = config;
+        layers.numbers.erase("learning_rate");
+        return layers.describe();
+    }
+
+    void release(Trial& trial) {
+        trial.finished = true;
+        if (trial.model && m_config.idle_models > 0) {
+            std::lock_guard<std::mutex> lock(m_idle_mutex);
+            if (m_idle.size() >= m_config.idle_models) m_idle.erase(m_idle.begin());
+            m_idle.push_back({structure(trial.result.config), std::move(trial.model), std::move(trial.trainer)});
+        }
+        trial.trainer.reset();
+        trial.model.reset();
+    }
+
+    // Reuses an idle model of the same structure, or builds a new one.
+    void prepare(Trial& trial) {
+        uint64_t seed = m_config.seed + trial.result.id;
+        T lr = static_cast<T>(trial.result.config.number("learning_rate", m_config.learning_rate));
+        {
+            std::lock_guard<std::mutex> lock(m_idle_mutex);
+            std::string wanted = structure(trial.result.config);
+            for (auto it = m_idle.begin(); it != m_idle.end(); ++it) {
+                if (it->structure != wanted) continue;
+                trial.model = std::move(it->model);
+                trial.trainer = std::move(it->trainer);
+                m_idle.erase(it);
+                break;
+            }
+        }
+        if (trial.model) {
+            trial.model->reinitialize(seed);
+            trial.trainer->reset(lr);
+            return;
+        }
+        trial.model = std::make_unique<Model<T>>();
+        trial.model->set_seed(seed);
+        m_builder(trial.result.config, *trial.model);
+        trial.trainer = std::make_unique<BackwardTrainer<T>>(*trial.model, lr);
+    }
+
+    void shuffle(const Trial& trial, Workspace& workspace) const {
+        size_t count = m_train.size();
+        workspace.order.resize(count);
+        std::iota(workspace.order.begin(), workspace.order.end(), size_t(0));
+        workspace.bits.resize(count);
+        Philox rng(m_config.seed, trial.result.id);
+        rng.fill_bits(workspace.bits.data(), count, trial.result.losses.size() * count);
+        for (size_t i = count; i > 1; --i) {
+            std::swap(workspace.order[i - 1], workspace.order[workspace.bits[i - 1] % i]);
+        }
+    }
+
+    T validation_loss(Model<T>& model) const {
+        const Samples& samples = m_validation.empty() ? m_train : m_validation;
+        model.set_inference(true);
+        T total = 0;
+        for (const auto& [input, target] : samples) total += m_loss.value(model.forward(input), target);
+        model.set_inference(false);
+        return total / static_cast<T>(std::max<size_t>(samples.size(), 1));
+    }
+
+    bool should_stop(const std::vector<T>& losses) const {
+        T latest = losses.back();
+        if (!std::isfinite(latest) || latest > m_config.divergence_ratio * losses.front()) return true;
+        if (m_config.patience == 0 || losses.size() <= m_config.patience) return false;
+        T best_before = *std::min_element(losses.begin(), losses.end() - m_config.patience);
+        T best_since = *std::min_element(losses.end() - m_config.patience, losses.end());
+        return best_since >= best_before;
+    }
+
+    // A trial on its last round hands its model back as soon as it is done.
+    void train(Trial& trial, size_t epochs, bool last, Workspace& workspace) {
+        if (!trial.model) prepare(trial);
+
+        while (trial.result.losses.size() < epochs) {
+            shuffle(trial, workspace);
+            for (size_t index : workspace.order) {
+                trial.trainer->train_step(m_train[index].first, m_train[index].second, m_loss);
+            }
+            trial.trainer->flush();
+            trial.result.losses.push_back(validation_loss(*trial.model));
+
+            if (should_stop(trial.result.losses)) {
+                trial.result.stopped_early = true;
+                release(trial);
+                return;
+            }
+        }
+        if (last) release(trial);
+    }
+
+    // Brings every unfinished trial up to `epochs` epochs in parallel.
+    void run(std::vector<Trial>& trials, size_t epochs, bool last) {
+        std::vector<std::future<void>> pending;
+        for (auto& trial : trials) {
+            if (trial.finished) continue;
+            pending.push_back(m_pool.submit([this, &trial, epochs, last](size_t worker) {
+                train(trial, epochs, last, m_workspaces[worker]);
+            }));
+        }
+        // Every task refers to a trial, so all of them must finish before an
+        // exception from any one can unwind the caller's trials.
+        std::exception_ptr error;
+        for (auto& done : pending) {
+            try {
+                done.get();
+            } catch (...) {
+                if (!error) error = std::current_exception();
+            }
+        }
+        if (error) std::rethrow_exception(error);
+    }
+
+    std::vector<Trial> make_trials(const std::vector<TrialConfig>& configs) {
+        std::vector<Trial> trials(configs.size());
+        for (size_t i = 0; i < configs.size(); ++i) {
+            trials[i].result.id = m_next_id++;
+            trials[i].result.config = configs[i];
+        }
+        return trials;
+    }
+
+    std::vector<TrialConfig> sample(size_t count) {
+        std::vector<TrialConfig> configs;
+        for (size_t i = 0; i < count; ++i) configs.push_back(m_space.sample(m_sampler, m_next_id + i));
+        return configs;
+    }
+
+    static std::vector<TrialResult<T>> collect(std::vector<Trial>& trials) {
+        std::vector<TrialResult<T>> results;
+        for (auto& trial : trials) results.push_back(std::move(trial.result));
+        std::stable_sort(results.begin(), results.end(),
+                         [](const TrialResult<T>& a, const TrialResult<T>& b) { return a.loss() < b.loss(); });
+        return results;
+    }
+
+    std::vector<Trial> halving(const std::vector<TrialConfig>& configs, size_t min_epochs,
+                               size_t max_epochs, size_t eta) {
+        std::vector<Trial> trials = make_trials(configs);
+        size_t epochs = std::max<size_t>(std::min(min_epochs, max_epochs), 1);
+        eta = std::max<size_t>(eta, 2);
+
+        for (;;) {
+            run(trials, epochs, epochs >= max_epochs);
+
+            std::vector<Trial*> alive;
+            for (auto& trial : trials) if (!trial.finished) alive.push_back(&trial);
+            if (epochs >= max_epochs || alive.size() <= 1) break;
+
+            std::stable_sort(alive.begin(), alive.end(), [](const Trial* a, const Trial* b) {
+                return a->result.loss() < b->result.loss();
+            });
+            size_t keep = std::max<size_t>(alive.size() / eta, 1);
+            for (size_t i = keep; i < alive.size(); ++i) release(*alive[i]);
+            epochs = std::min(epochs * eta, max_epochs);
+        }
+
+        for (auto& trial : trials) release(trial);
+        return trials;
+    }
+
+public:
+    HyperparameterSearch(const SearchSpace& space, const Samples& train, const Samples& validation,
+                         Builder builder, const LossFunction<T>& loss,
+                         const SearchConfig<T>& config = SearchConfig<T>())
+        : m_space(space), m_train(train), m_validation(validation),
+          m_builder(std::move(builder)), m_loss(loss), m_config(config),
+          m_pool(config.threads), m_workspaces(m_pool.size()),
+          m_sampler(config.seed, ~uint64_t(0)) {
+        if (train.empty()) throw std::runtime_error("HyperparameterSearch: no training samples");
+    }
+
+    std::vector<TrialResult<T>> evaluate(const std::vector<TrialConfig>& configs, size_t epochs) {
+        std::vector<Trial> trials = make_trials(configs);
+        run(trials, epochs, true);
+        return collect(trials);
+    }
+
+    std::vector<TrialResult<T>> random(size_t count, size_t epochs) {
+        return evaluate(sample(count), epochs);
+    }
+
+    std::vector<TrialResult<T>> grid(size_t epochs) {
+        return evaluate(m_space.grid(), epochs);
+    }
+
+    std::vector<TrialResult<T>> successive_halving(const std::vector<TrialConfig>& configs,
+                                                   size_t min_epochs, size_t max_epochs, size_t eta = 3) {
+        std::vector<Trial> trials = halving(configs, min_epochs, max_epochs, eta);
+        return collect(trials);
+    }
+
+    std::vector<TrialResult<T>> successive_halving(size_t count, size_t min_epochs,
+                                                   size_t max_epochs, size_t eta = 3) {
+        return successive_halving(sample(count), min_epochs, max_epochs, eta);
+    }
+
+    // Brackets s = s_max .. 0 start ceil((s_max + 1) / (s + 1) * eta^s)
+    // configurations at max_epochs / eta^s epochs each.
+    std::vector<TrialResult<T>> hyperband(size_t max_epochs, size_t eta = 3) {
+        eta = std::max<size_t>(eta, 2);
+        size_t s_max = 0;
+        for (size_t r = max_epochs; r >= eta; r /= eta) ++s_max;
+
+        std::vector<Trial> all;
+        for (size_t s = s_max + 1; s-- > 0;) {
+            size_t scale = 1;
+            for (size_t i = 0; i < s; ++i) scale *= eta;
+            size_t count = ((s_max + 1) * scale + s) / (s + 1);
+            size_t epochs = std::max<size_t>(max_epochs / scale, 1);
+
+            std::vector<Trial> bracket = halving(sample(count), epochs, max_epochs, eta);
+            for (auto& trial : bracket) all.push_back(std::move(trial));
+        }
+        return collect(all);
+    }
+};
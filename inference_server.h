@@ -0,0 +1,422 @@
+#pragma once
+#include "model.h"
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <iostream>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Wire format on the socket, host byte order: uint32 count followed by
+// count values of T. Requests and responses use the same framing.
+
+inline bool read_exact(int fd, void* buffer, size_t size) {
+    char* ptr = static_cast<char*>(buffer);
+    while (size > 0) {
+        ssize_t n = ::read(fd, ptr, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        ptr += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+inline bool write_exact(int fd, const void* buffer, size_t size) {
+    const char* ptr = static_cast<const char*>(buffer);
+    while (size > 0) {
+        ssize_t n = ::send(fd, ptr, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        ptr += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+template<typename T>
+bool send_values(int fd, const std::vector<T>& values) {
+    uint32_t count = static_cast<uint32_t>(values.size());
+    return write_exact(fd, &count, sizeof(count)) &&
+           write_exact(fd, values.data(), values.size() * sizeof(T));
+}
+
+template<typename T>
+bool recv_values(int fd, std::vector<T>& values) {
+    uint32_t count = 0;
+    if (!read_exact(fd, &count, sizeof(count))) return false;
+    values.resize(count);
+    return read_exact(fd, values.data(), values.size() * sizeof(T));
+}
+
+inline int connect_unix_socket(const std::string& path) {
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) throw std::runtime_error("Cannot create socket");
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+        ::close(fd);
+        throw std::runtime_error("Cannot connect to " + path);
+    }
+    return fd;
+}
+
+class LatencyStats {
+    std::vector<double> m_samples_us;
+    mutable std::mutex m_mutex;
+
+public:
+    struct Summary {
+        size_t count = 0;
+        double mean_us = 0;
+        double p50_us = 0;
+        double p99_us = 0;
+        double max_us = 0;
+    };
+
+    void record(double latency_us) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_samples_us.push_back(latency_us);
+    }
+
+    void merge(const LatencyStats& other) {
+        std::scoped_lock lock(m_mutex, other.m_mutex);
+        m_samples_us.insert(m_samples_us.end(), other.m_samples_us.begin(), other.m_samples_us.end());
+    }
+
+    // Returns the summary and, if reset is set, starts a new window.
+    Summary summarize(bool reset = false) {
+        std::vector<double> samples;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            samples = reset ? std::move(m_samples_us) : m_samples_us;
+            if (reset) m_samples_us.clear();
+        }
+
+        Summary summary;
+        summary.count = samples.size();
+        if (samples.empty()) return summary;
+
+        double total = 0;
+        for (double s : samples) total += s;
+        summary.mean_us = total / samples.size();
+
+        auto percentile = [&samples](double p) {
+            size_t index = static_cast<size_t>(p * (samples.size() - 1));
+            std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+            return samples[index];
+        };
+        summary.p50_us = percentile(0.50);
+        summary.p99_us = percentile(0.99);
+        summary.max_us = *std::max_element(samples.begin(), samples.end());
+        return summary;
+    }
+};
+
+// Serves a saved model over a Unix domain socket. Requests from all
+// connections are queued and grouped into micro-batches: a batch is
+// dispatched when it is full or when its oldest request has waited
+// max_delay. Each worker owns its own copy of the model, because layers
+// keep per-call state.
+template<typename T>
+class InferenceServer {
+public:
+    struct Config {
+        std::string socket_path = "/tmp/nn_server.sock";
+        size_t workers = std::max(1u, std::thread::hardware_concurrency());
+        size_t max_batch = 32;
+        std::chrono::microseconds max_delay{2000};
+        std::chrono::seconds report_interval{5};
+    };
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Request {
+        std::vector<T> input;
+        std::promise<std::vector<T>> result;
+        Clock::time_point arrival;
+    };
+    using Batch = std::vector<std::unique_ptr<Request>>;
+
+    Config m_config;
+    std::string m_model_file;
+    size_t m_input_size;
+
+    std::deque<std::unique_ptr<Request>> m_requests;
+    std::mutex m_requests_mutex;
+    std::condition_variable m_requests_cv;
+
+    std::deque<Batch> m_batches;
+    std::mutex m_batches_mutex;
+    std::condition_variable m_batches_cv;
+    // Set once the batcher has pushed its last batch; workers drain the
+    // queue and exit only after that.
+    bool m_batcher_done = false;
+
+    std::atomic<bool> m_running{false};
+    int m_listen_fd = -1;
+    std::thread m_accept_thread;
+    std::thread m_batcher_thread;
+    std::thread m_reporter_thread;
+    std::vector<std::thread> m_workers;
+    // Live connection threads by id. A connection that ends closes its fd
+    // and moves its thread to m_finished_connections, which accept_loop
+    // joins on the next accept and stop() joins at the end.
+    std::unordered_map<size_t, std::thread> m_connections;
+    std::vector<std::thread> m_finished_connections;
+    std::vector<int> m_client_fds;
+    size_t m_next_connection = 0;
+    std::mutex m_connections_mutex;
+
+    LatencyStats m_latency;
+    std::atomic<size_t> m_batches_run{0};
+    std::atomic<size_t> m_requests_run{0};
+    Clock::time_point m_window_start;
+    std::mutex m_window_mutex;
+    std::mutex m_report_mutex;
+    std::condition_variable m_report_cv;
+
+    void accept_loop() {
+        while (m_running) {
+            int client_fd = ::accept(m_listen_fd, nullptr, nullptr);
+            if (client_fd < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            std::vector<std::thread> finished;
+            {
+                std::lock_guard<std::mutex> lock(m_connections_mutex);
+                finished.swap(m_finished_connections);
+                size_t id = m_next_connection++;
+                m_client_fds.push_back(client_fd);
+                m_connections.emplace(id, std::thread(&InferenceServer::serve_connection, this, id, client_fd));
+            }
+            for (auto& connection : finished) connection.join();
+        }
+    }
+
+    // One request in flight per connection; clients open several
+    // connections to get concurrency.
+    void serve_connection(size_t id, int fd) {
+        std::vector<T> input;
+        while (m_running && recv_values(fd, input)) {
+            std::vector<T> output;
+            if (input.size() == m_input_size) {
+                output = submit(std::move(input)).get();
+            }
+            if (!send_values(fd, output)) break;
+        }
+        {
+            // Once the fd is out of m_client_fds stop() no longer shuts it
+            // down, so closing it cannot hit a reused descriptor.
+            std::lock_guard<std::mutex> lock(m_connections_mutex);
+            m_client_fds.erase(std::find(m_client_fds.begin(), m_client_fds.end(), fd));
+            auto self = m_connections.find(id);
+            if (self != m_connections.end()) {
+                m_finished_connections.push_back(std::move(self->second));
+                m_connections.erase(self);
+            }
+        }
+        ::close(fd);
+    }
+
+    void batch_loop() {
+        while (true) {
+            Batch batch;
+            {
+                std::unique_lock<std::mutex> lock(m_requests_mutex);
+                m_requests_cv.wait(lock, [this] { return !m_running || !m_requests.empty(); });
+                if (!m_running && m_requests.empty()) break;
+
+                auto deadline = m_requests.front()->arrival + m_config.max_delay;
+                m_requests_cv.wait_until(lock, deadline, [this] {
+                    return !m_running || m_requests.size() >= m_config.max_batch;
+                });
+
+                size_t count = std::min(m_config.max_batch, m_requests.size());
+                batch.reserve(count);
+                for (size_t i = 0; i < count; ++i) {
+                    batch.push_back(std::move(m_requests.front()));
+                    m_requests.pop_front();
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(m_batches_mutex);
+                m_batches.push_back(std::move(batch));
+            }
+            m_batches_cv.notify_one();
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_batches_mutex);
+            m_batcher_done = true;
+        }
+        m_batches_cv.notify_all();
+    }
+
+    void worker_loop(std::shared_ptr<Model<T>> model) {
+        std::vector<std::vector<T>> inputs;
+        while (true) {
+            Batch batch;
+            {
+                std::unique_lock<std::mutex> lock(m_batches_mutex);
+                m_batches_cv.wait(lock, [this] { return m_batcher_done || !m_batches.empty(); });
+                if (m_batches.empty()) break;
+                batch = std::move(m_batches.front());
+                m_batches.pop_front();
+            }
+
+            inputs.resize(batch.size());
+            for (size_t i = 0; i < batch.size(); ++i) {
+                inputs[i] = std::move(batch[i]->input);
+            }
+
+            auto outputs = model->forward_batch(inputs);
+            auto done = Clock::now();
+            for (size_t i = 0; i < batch.size(); ++i) {
+                m_latency.record(std::chrono::duration<double, std::micro>(done - batch[i]->arrival).count());
+                batch[i]->result.set_value(std::move(outputs[i]));
+            }
+            m_batches_run++;
+            m_requests_run += batch.size();
+        }
+    }
+
+    void report_loop() {
+        std::unique_lock<std::mutex> lock(m_report_mutex);
+        while (m_running) {
+            m_report_cv.wait_for(lock, m_config.report_interval);
+            if (m_running) report(std::cout);
+        }
+    }
+
+public:
+    InferenceServer(const std::string& model_file, size_t input_size, Config config = Config())
+        : m_config(std::move(config)), m_model_file(model_file), m_input_size(input_size) {
+        if (m_config.workers == 0 || m_config.max_batch == 0) {
+            throw std::runtime_error("InferenceServer: workers and max_batch must be positive");
+        }
+    }
+
+    ~InferenceServer() { stop(); }
+
+    void start() {
+        std::vector<std::shared_ptr<Model<T>>> models;
+        for (size_t i = 0; i < m_config.workers; ++i) {
+            auto model = std::make_shared<Model<T>>();
+            model->load(m_model_file);
+            model->compile({m_input_size});
+            model->set_inference(true);
+            models.push_back(model);
+        }
+
+        m_listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (m_listen_fd < 0) throw std::runtime_error("Cannot create socket");
+
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, m_config.socket_path.c_str(), sizeof(addr.sun_path) - 1);
+        ::unlink(m_config.socket_path.c_str());
+        if (::bind(m_listen_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+            ::listen(m_listen_fd, 128) < 0) {
+            throw std::runtime_error("Cannot listen on " + m_config.socket_path);
+        }
+
+        m_batcher_done = false;
+        m_running = true;
+        m_window_start = Clock::now();
+        for (auto& model : models) {
+            m_workers.emplace_back(&InferenceServer::worker_loop, this, model);
+        }
+        m_batcher_thread = std::thread(&InferenceServer::batch_loop, this);
+        m_accept_thread = std::thread(&InferenceServer::accept_loop, this);
+        m_reporter_thread = std::thread(&InferenceServer::report_loop, this);
+    }
+
+    void stop() {
+        // Flipped under the lock batch_loop waits with, so it cannot check
+        // the flag and then miss the notification below.
+        {
+            std::lock_guard<std::mutex> lock(m_requests_mutex);
+            if (!m_running.exchange(false)) return;
+        }
+
+        ::shutdown(m_listen_fd, SHUT_RDWR);
+        ::close(m_listen_fd);
+        m_accept_thread.join();
+        {
+            std::lock_guard<std::mutex> lock(m_connections_mutex);
+            for (int fd : m_client_fds) ::shutdown(fd, SHUT_RDWR);
+        }
+
+        m_requests_cv.notify_all();
+        m_batcher_thread.join();
+        m_batches_cv.notify_all();
+        for (auto& worker : m_workers) worker.join();
+
+        std::vector<std::thread> connections;
+        {
+            std::lock_guard<std::mutex> lock(m_connections_mutex);
+            connections.swap(m_finished_connections);
+            for (auto& connection : m_connections) connections.push_back(std::move(connection.second));
+            m_connections.clear();
+        }
+        for (auto& connection : connections) connection.join();
+        { std::lock_guard<std::mutex> lock(m_report_mutex); } // same for report_loop
+        m_report_cv.notify_all();
+        m_reporter_thread.join();
+        ::unlink(m_config.socket_path.c_str());
+    }
+
+    std::future<std::vector<T>> submit(std::vector<T> input) {
+        auto request = std::make_unique<Request>();
+        request->input = std::move(input);
+        request->arrival = Clock::now();
+        auto future = request->result.get_future();
+        {
+            std::lock_guard<std::mutex> lock(m_requests_mutex);
+            if (!m_running) {
+                request->result.set_value({});
+                return future;
+            }
+            m_requests.push_back(std::move(request));
+        }
+        m_requests_cv.notify_one();
+        return future;
+    }
+
+    // Prints the statistics collected since the previous report.
+    void report(std::ostream& out) {
+        std::lock_guard<std::mutex> lock(m_window_mutex);
+        auto now = Clock::now();
+        double seconds = std::chrono::duration<double>(now - m_window_start).count();
+        m_window_start = now;
+
+        auto summary = m_latency.summarize(true);
+        size_t batches = m_batches_run.exchange(0);
+        size_t requests = m_requests_run.exchange(0);
+
+        out << "requests: " << requests
+            << ", throughput: " << (seconds > 0 ? requests / seconds : 0) << " req/s"
+            << ", mean batch: " << (batches ? static_cast<double>(requests) / batches : 0)
+            << ", p50: " << summary.p50_us << " us"
+            << ", p99: " << summary.p99_us << " us" << std::endl;
+    }
+};
@@ -0,0 +1,256 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+// Compute kernels shared by the Lay<T> layers and the new cnn layers. They
+// work on row-major buffers addressed by pointer and row stride, so each
+// front end calls them on its own storage (std::vector<T> or Tensor)
+// without copying, and an optimization made here reaches both.
+
+// C (+)= op(A) * op(B), with op(A) M x K and op(B) K x N. A flag stores the
+// matrix transposed; lda, ldb and ldc are the row strides as stored.
+// Each output element accumulates its K products in order, starting from
+// the existing C when accumulate is set.
+template<typename T>
+void gemm(bool trans_a, bool trans_b, size_t M, size_t N, size_t K,
+          const T* A, size_t lda, const T* B, size_t ldb,
+          T* C, size_t ldc, bool accumulate) {
+    if (trans_b) {
+        for (size_t i = 0; i < M; ++i) {
+            for (size_t j = 0; j < N; ++j) {
+                const T* b = B + j * ldb;
+                T sum = accumulate ? C[i * ldc + j] : T(0);
+                if (trans_a) {
+                    for (size_t p = 0; p < K; ++p) sum += A[p * lda + i] * b[p];
+                } else {
+                    const T* a = A + i * lda;
+                    for (size_t p = 0; p < K; ++p) sum += a[p] * b[p];
+                }
+                C[i * ldc + j] = sum;
+            }
+        }
+        return;
+    }
+    // Row form: each A value scales a contiguous row of B into a row of C,
+    // which vectorizes along N. Four rows of C share every load of a B row.
+    auto a_at = [&](size_t i, size_t p) { return trans_a ? A[p * lda + i] : A[i * lda + p]; };
+    size_t i = 0;
+    for (; i + 4 <= M; i += 4) {
+        T* c0 = C + i * ldc;
+        T* c1 = c0 + ldc;
+        T* c2 = c1 + ldc;
+        T* c3 = c2 + ldc;
+        if (!accumulate) {
+            std::fill(c0, c0 + N, T(0));
+            std::fill(c1, c1 + N, T(0));
+            std::fill(c2, c2 + N, T(0));
+            std::fill(c3, c3 + N, T(0));
+        }
+        for (size_t p = 0; p < K; ++p) {
+            T a0 = a_at(i, p), a1 = a_at(i + 1, p), a2 = a_at(i + 2, p), a3 = a_at(i + 3, p);
+            const T* b = B + p * ldb;
+            for (size_t j = 0; j < N; ++j) {
+                T x = b[j];
+                c0[j] += a0 * x;
+                c1[j] += a1 * x;
+                c2[j] += a2 * x;
+                c3[j] += a3 * x;
+            }
+        }
+    }
+    for (; i < M; ++i) {
+        T* c = C + i * ldc;
+        if (!accumulate) std::fill(c, c + N, T(0));
+        for (size_t p = 0; p < K; ++p) {
+            T a = a_at(i, p);
+            const T* b = B + p * ldb;
+            for (size_t j = 0; j < N; ++j) c[j] += a * b[j];
+        }
+    }
+}
+
+// Copies a C x H x W image into the interior of a zero-bordered
+// C x (H + 2p) x (W + 2p) buffer. The border is left untouched.
+template<typename T>
+void pad_nchw(const T* input, size_t channels, size_t height, size_t width,
+              size_t padding, T* padded) {
+    size_t padded_height = height + 2 * padding;
+    size_t padded_width = width + 2 * padding;
+    for (size_t c = 0; c < channels; ++c) {
+        for (size_t h = 0; h < height; ++h) {
+            const T* src = input + (c * height + h) * width;
+            std::copy(src, src + width, padded + (c * padded_height + h + padding) * padded_width + padding);
+        }
+    }
+}
+
+// Inverse of pad_nchw: copies the interior of a padded buffer back into a
+// C x H x W image, e.g. to drop the border of an input gradient.
+template<typename T>
+void unpad_nchw(const T* padded, size_t channels, size_t height, size_t width,
+                size_t padding, T* output) {
+    size_t padded_height = height + 2 * padding;
+    size_t padded_width = width + 2 * padding;
+    for (size_t c = 0; c < channels; ++c) {
+        for (size_t h = 0; h < height; ++h) {
+            const T* src = padded + (c * padded_height + h + padding) * padded_width + padding;
+            std::copy(src, src + width, output + (c * height + h) * width);
+        }
+    }
+}
+
+// Direct convolution of one padded NCHW image with weights stored
+// [filters][channels][kernel][kernel]. Each weight is applied to a whole
+// output row, which the compiler vectorizes.
+template<typename T>
+void conv2d_nchw(const T* padded, size_t channels, size_t padded_height, size_t padded_width,
+                 const T* weights, const T* biases, size_t filters, size_t kernel, size_t stride,
+                 T* output, size_t output_height, size_t output_width) {
+    size_t out_plane = output_height * output_width;
+    for (size_t k = 0; k < filters; ++k) {
+        T* out = output + k * out_plane;
+        std::fill(out, out + out_plane, biases[k]);
+
+        for (size_t c = 0; c < channels; ++c) {
+            for (size_t kh = 0; kh < kernel; ++kh) {
+                for (size_t kw = 0; kw < kernel; ++kw) {
+                    T weight = weights[((k * channels + c) * kernel + kh) * kernel + kw];
+
+                    for (size_t h = 0; h < output_height; ++h) {
+                        const T* in = padded + (c * padded_height + h * stride + kh) * padded_width + kw;
+                        T* out_row = out + h * output_width;
+                        for (size_t w = 0; w < output_width; ++w) {
+                            out_row[w] += weight * in[w * stride];
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Max pooling of one NCHW image with implicit padding. offsets receives the
+// position of each maximum inside its window (ph * pool + pw); a window that
+// lies entirely in the padding yields lowest() and offset 0. Works a whole
+// output row at a time so the comparisons vectorize across the width.
+template<typename T>
+void max_pool_nchw(const T* input, size_t channels, size_t height, size_t width,
+                   size_t pool, size_t stride, size_t padding,
+                   T* output, uint8_t* offsets, size_t output_height, size_t output_width) {
+    std::fill(output, output + channels * output_height * output_width, std::numeric_limits<T>::lowest());
+    std::fill(offsets, offsets + channels * output_height * output_width, uint8_t(0));
+
+    for (size_t c = 0; c < channels; ++c) {
+        const T* channel = input + c * height * width;
+        for (size_t i = 0; i < output_height; ++i) {
+            size_t out_index = (c * output_height + i) * output_width;
+            T* out_row = output + out_index;
+            uint8_t* offset_row = offsets + out_index;
+
+            for (size_t ph = 0; ph < pool; ++ph) {
+                size_t h = i * stride + ph;
+                if (h < padding || h - padding >= height) continue;
+                const T* in_row = channel + (h - padding) * width;
+
+                for (size_t pw = 0; pw < pool; ++pw) {
+                    // Output columns whose input column j * stride + pw - padding is inside the row.
+                    size_t j_begin = pw < padding ? (padding - pw + stride - 1) / stride : 0;
+                    size_t j_end = pw < width + padding
+                        ? std::min(output_width, (width + padding - pw - 1) / stride + 1)
+                        : 0;
+                    uint8_t offset = static_cast<uint8_t>(ph * pool + pw);
+
+                    for (size_t j = j_begin; j < j_end; ++j) {
+                        T val = in_row[j * stride + pw - padding];
+                        bool greater = val > out_row[j];
+                        out_row[j] = greater ? val : out_row[j];
+                        offset_row[j] = greater ? offset : offset_row[j];
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Softmax of each of `rows` rows, `dim` values wide. Subtracting the row
+// maximum keeps exp() finite.
+template<typename T>
+void softmax_rows(const T* input, size_t rows, size_t dim, T* output) {
+    for (size_t n = 0; n < rows; ++n) {
+        const T* z = input + n * dim;
+        T* out = output + n * dim;
+        T max_val = *std::max_element(z, z + dim);
+        T sum = 0;
+        for (size_t i = 0; i < dim; ++i) {
+            out[i] = std::exp(z[i] - max_val);
+            sum += out[i];
+        }
+        for (size_t i = 0; i < dim; ++i) out[i] /= sum;
+    }
+}
+
+// The losses return the mean over their elements (rows for cross-entropy)
+// and, unless gradient is null, write the gradient of that mean with
+// respect to the predictions in the same pass.
+
+template<typename T>
+T mse_loss(const T* prediction, const T* target, size_t count, T* gradient) {
+    T scale = T(2) / static_cast<T>(count);
+    T sum = 0;
+    for (size_t i = 0; i < count; ++i) {
+        T diff = prediction[i] - target[i];
+        sum += diff * diff;
+        if (gradient) gradient[i] = scale * diff;
+    }
+    return sum / static_cast<T>(count);
+}
+
+// Softmax followed by cross-entropy over rows of raw logits. Fusing the two
+// makes the gradient simply softmax(z) - y, and log-sum-exp keeps it stable.
+template<typename T>
+T softmax_cross_entropy(const T* logits, const T* target, size_t batch, size_t dim, T* gradient) {
+    T inv_batch = T(1) / static_cast<T>(batch);
+    T total = 0;
+    for (size_t n = 0; n < batch; ++n) {
+        const T* z = logits + n * dim;
+        const T* y = target + n * dim;
+        T max_val = *std::max_element(z, z + dim);
+
+        T sum_exp = 0;
+        for (size_t i = 0; i < dim; ++i) sum_exp += std::exp(z[i] - max_val);
+        T log_sum = std::log(sum_exp);
+        T inv_sum = T(1) / sum_exp;
+
+        T loss = 0;
+        T* g = gradient ? gradient + n * dim : nullptr;
+        for (size_t i = 0; i < dim; ++i) {
+            T shifted = z[i] - max_val;
+            loss -= y[i] * (shifted - log_sum);
+            if (g) g[i] = (std::exp(shifted) * inv_sum - y[i]) * inv_batch;
+        }
+        total += loss;
+    }
+    return total * inv_batch;
+}
+
+// Sigmoid followed by binary cross-entropy on raw logits, in the
+// overflow-free form max(z, 0) - z * y + log(1 + exp(-|z|)). The gradient
+// is sigmoid(z) - y.
+template<typename T>
+T sigmoid_cross_entropy(const T* logits, const T* target, size_t count, T* gradient) {
+    T scale = T(1) / static_cast<T>(count);
+    T sum = 0;
+    for (size_t i = 0; i < count; ++i) {
+        T z = logits[i];
+        T e = std::exp(-std::abs(z));
+        sum += std::max(z, T(0)) - z * target[i] + std::log1p(e);
+        if (gradient) {
+            T sigmoid = z >= 0 ? T(1) / (1 + e) : e / (1 + e);
+            gradient[i] = (sigmoid - target[i]) * scale;
+        }
+    }
+    return sum * scale;
+}
@@ -2,16 +2,152 @@
 #include <vector>
 #include <iostream>
 #include <string>
+#include <cstdint>
+#include <algorithm>
 #pragma once
+#include "layout.h"
+
+inline size_t shape_size(const std::vector<size_t>& shape) {
+    size_t size = 1;
+    for (size_t dim : shape) size *= dim;
+    return size;
+}
+
+// A contiguous parameter buffer and its gradient, owned by a layer.
+// grads is null while the layer is frozen and for state that is not
+// trained by gradient descent, such as running statistics.
+// Layers that keep derived copies of the values refresh them at the next
+// forward() after collect_params, so collect again before writing values
+// rather than keeping refs across forward passes.
+template<typename T>
+struct ParamRef {
+    T* values;
+    T* grads;
+    size_t size;
+};
 
 template<typename T>
 class Lay {
+protected:
+    bool m_trainable = true;
+    bool m_input_gradient_required = true;
+    bool m_inference = false;
+    // forward_batch() input, kept for the default backward_batch().
+    std::vector<T> m_saved_batch;
+
+    // Gradient buffers exist only while the layer is trainable.
+    template<typename Buffer>
+    void allocate_gradient(Buffer& gradient, size_t size) const {
+        if (m_trainable) {
+            gradient.resize(size, T(0));
+        } else {
+            gradient.clear();
+            gradient.shrink_to_fit();
+        }
+    }
+
 public:
     Lay() = default;
     virtual ~Lay() = default;
     virtual std::vector<T> forward(const std::vector<T>& input) = 0;
     virtual std::vector<T> backward(const std::vector<T>& output_gradient) = 0;
+    // backward() adds into the parameter gradients; update_weights applies
+    // them and resets them to zero.
     virtual void update_weights(T learning_rate) {}
+
+    // Gives the layer its own random stream. Model numbers streams by layer
+    // position, so initialization does not depend on construction order.
+    virtual void seed(uint64_t seed, uint64_t stream) {}
+
+    // Draws the weights again from the layer's stream and clears its
+    // gradients, reusing the buffers. A no-op before the first compile.
+    virtual void reinitialize() {}
+
+    // A frozen layer keeps its weights and skips its weight gradients.
+    // Takes effect at the next Model::compile.
+    void set_trainable(bool trainable) { m_trainable = trainable; }
+    bool trainable() const { return m_trainable; }
+
+    // Set by Model::compile. When false, backward() may skip computing
+    // the input gradient and return an empty vector.
+    void set_input_gradient_required(bool required) { m_input_gradient_required = required; }
+    bool input_gradient_required() const { return m_input_gradient_required; }
+
+    // Set by Model::compile for layers backward() never reaches; they need
+    // not keep anything from forward() around.
+    void set_inference(bool inference) { m_inference = inference; }
+    bool inference() const { return m_inference; }
+
+    // Appends the layer's parameter buffers; layers without weights add none.
+    virtual void collect_params(std::vector<ParamRef<T>>& params) {}
+
+    // Used when the caller gives up its buffer. Layers that can work in
+    // place (or pass the buffer straight through) override these.
+    virtual std::vector<T> forward(std::vector<T>&& input) {
+        return forward(static_cast<const std::vector<T>&>(input));
+    }
+    virtual std::vector<T> backward(std::vector<T>&& output_gradient) {
+        return backward(static_cast<const std::vector<T>&>(output_gradient));
+    }
+
+    // Runs count samples stored back to back in inputs and returns their
+    // outputs the same way. Outside inference mode the inputs are kept for
+    // backward_batch(). Layers with a real batched kernel, or that need the
+    // whole batch at once (BatchNorm), override this; the default runs
+    // forward() once per sample.
+    virtual std::vector<T> forward_batch(const std::vector<T>& inputs, size_t count) {
+        if (count == 0) return {};
+        if (!m_inference) m_saved_batch = inputs;
+        size_t input_size = inputs.size() / count;
+        std::vector<T> outputs;
+        std::vector<T> sample(input_size);
+        for (size_t n = 0; n < count; ++n) {
+            std::copy(inputs.begin() + n * input_size, inputs.begin() + (n + 1) * input_size, sample.begin());
+            std::vector<T> output = forward(sample);
+            if (n == 0) outputs.reserve(output.size() * count);
+            outputs.insert(outputs.end(), output.begin(), output.end());
+        }
+        return outputs;
+    }
+
+    // Backward pass of the last forward_batch(); parameter gradients add up
+    // over the samples. The default re-runs forward() on each saved sample
+    // to restore its per-sample state and then calls backward().
+    virtual std::vector<T> backward_batch(const std::vector<T>& output_gradients, size_t count) {
+        if (count == 0) return {};
+        size_t input_size = m_saved_batch.size() / count;
+        size_t output_size = output_gradients.size() / count;
+        std::vector<T> input_gradients;
+        std::vector<T> sample(input_size);
+        std::vector<T> gradient(output_size);
+        for (size_t n = 0; n < count; ++n) {
+            std::copy(m_saved_batch.begin() + n * input_size, m_saved_batch.begin() + (n + 1) * input_size, sample.begin());
+            forward(sample);
+            std::copy(output_gradients.begin() + n * output_size, output_gradients.begin() + (n + 1) * output_size,
+                      gradient.begin());
+            std::vector<T> input_gradient = backward(gradient);
+            if (input_gradient.empty()) continue;
+            if (n == 0) input_gradients.reserve(input_gradient.size() * count);
+            input_gradients.insert(input_gradients.end(), input_gradient.begin(), input_gradient.end());
+        }
+        return input_gradients;
+    }
+
+    // Validates the input shape, allocates weights and work buffers and
+    // returns the output shape. After this forward/backward skip shape checks.
+    virtual std::vector<size_t> compile(const std::vector<size_t>& input_shape) = 0;
+
+    // Called by Model::compile before compile(). Layers that can work in
+    // more than one memory layout pick one for the given input shape and
+    // the layout their input arrives in.
+    virtual Layout select_layout(const std::vector<size_t>& input_shape, Layout incoming) {
+        return Layout::NCHW;
+    }
+
+    // The C x H x W shape this layer reads, for layers whose parameters
+    // fix it; empty otherwise. Lets Model::compile give a flat model input
+    // its shape before converting it to another layout.
+    virtual std::vector<size_t> input_feature_shape() const { return {}; }
     
     virtual void save(std::ostream& out) const = 0;
     virtual void load(std::istream& in) = 0;
@@ -0,0 +1,51 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+// Memory layouts for C x H x W feature maps. All three are "channel blocks
+// of L lanes": NCHW has L = 1, NHWC a single block of L = C, and NCHWc
+// blocks of kChannelBlock lanes, stored as [C / L][H][W][L].
+enum class Layout { NCHW, NHWC, NCHWc };
+
+constexpr size_t kChannelBlock = 8;
+
+inline std::string layout_name(Layout layout) {
+    switch (layout) {
+        case Layout::NHWC: return "NHWC";
+        case Layout::NCHWc: return "NCHWc";
+        default: return "NCHW";
+    }
+}
+
+inline size_t layout_lanes(Layout layout, size_t channels) {
+    switch (layout) {
+        case Layout::NHWC: return channels;
+        case Layout::NCHWc: return kChannelBlock;
+        default: return 1;
+    }
+}
+
+inline bool layout_supports(Layout layout, size_t channels) {
+    return layout != Layout::NCHWc || channels % kChannelBlock == 0;
+}
+
+inline size_t layout_index(size_t lanes, size_t height, size_t width,
+                           size_t c, size_t h, size_t w) {
+    return (c / lanes) * height * width * lanes + (h * width + w) * lanes + c % lanes;
+}
+
+template<typename T>
+void convert_layout(const T* src, Layout from, T* dst, Layout to,
+                    size_t channels, size_t height, size_t width) {
+    size_t from_lanes = layout_lanes(from, channels);
+    size_t to_lanes = layout_lanes(to, channels);
+    for (size_t c = 0; c < channels; ++c) {
+        for (size_t h = 0; h < height; ++h) {
+            for (size_t w = 0; w < width; ++w) {
+                dst[layout_index(to_lanes, height, width, c, h, w)] =
+                    src[layout_index(from_lanes, height, width, c, h, w)];
+            }
+        }
+    }
+}
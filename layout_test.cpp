@@ -0,0 +1,86 @@
+#include "model.h"
+#include "random.h"
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using namespace std;
+using T = float;
+
+// A Conv2D with 64 filters picks NHWC, so Model::compile has to put a
+// layout transform in front of it even when the input shape is flat, as
+// it is for a lazy compile from forward() or InferenceServer::start.
+unique_ptr<Model<T>> make_model(bool force_nchw) {
+    auto model = make_unique<Model<T>>();
+    model->set_seed(3);
+    auto conv = make_unique<Conv2D<T>>(8, 8, 3, 3, 64, 1, 1);
+    if (force_nchw) conv->set_layout(Layout::NCHW);
+    model->add(move(conv));
+    model->add(make_unique<MaxPool<T>>(8, 8, 64, 2));
+    model->add(make_unique<Flatten<T>>());
+    model->add(make_unique<Dense<T>>(4));
+    return model;
+}
+
+int main() {
+    auto flat = make_model(false);
+    auto shaped = make_model(false);
+    auto lazy = make_model(false);
+    auto reference = make_model(true);
+    try {
+        flat->compile({3 * 8 * 8});
+        shaped->compile({3, 8, 8});
+        reference->compile({3, 8, 8});
+    } catch (const exception& e) {
+        cerr << "compile failed: " << e.what() << endl;
+        return 1;
+    }
+
+    vector<T> input(3 * 8 * 8);
+    Philox(5).fill_uniform(input.data(), input.size(), T(-1), T(1), 0);
+    vector<Model<T>*> models = {flat.get(), shaped.get(), lazy.get()};
+    auto worst_difference = [&](T& worst) {
+        vector<T> expected = reference->forward(input);
+        worst = 0;
+        for (Model<T>* model : models) {
+            vector<T> output;
+            try {
+                output = model->forward(input);
+            } catch (const exception& e) {
+                cerr << "forward failed: " << e.what() << endl;
+                return false;
+            }
+            if (output.size() != expected.size()) {
+                cerr << "output size " << output.size() << ", expected " << expected.size() << endl;
+                return false;
+            }
+            for (size_t i = 0; i < output.size(); ++i) worst = max(worst, std::abs(output[i] - expected[i]));
+        }
+        return true;
+    };
+
+    T worst;
+    if (!worst_difference(worst)) return 1;
+    cout << "max difference from NCHW " << worst << endl;
+    if (!(worst <= T(1e-4))) {
+        cerr << "NHWC model differs from the NCHW one" << endl;
+        return 1;
+    }
+
+    // Weights written through params(), as a checkpoint restore does, must
+    // reach the packed copy the NHWC kernel reads.
+    models.push_back(reference.get());
+    for (Model<T>* model : models) {
+        ParamRef<T> weights = model->params()[0];
+        for (size_t i = 0; i < weights.size; ++i) weights.values[i] = T(0.5) - weights.values[i];
+    }
+    models.pop_back();
+    if (!worst_difference(worst)) return 1;
+    cout << "max difference after writing the weights " << worst << endl;
+    if (!(worst <= T(1e-4))) {
+        cerr << "NHWC model did not pick up weights written through params()" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include "lay.h"
+#include "layout.h"
+#include <vector>
+#include <stdexcept>
+#include <iostream>
+
+// Reorders a C x H x W feature map between layouts. Model::compile inserts
+// these where neighbouring layers disagree; they are never saved with it.
+template<typename T>
+class LayoutTransform : public Lay<T> {
+private:
+    Layout m_from = Layout::NCHW;
+    Layout m_to = Layout::NCHW;
+    size_t m_channels = 0;
+    size_t m_height = 0;
+    size_t m_width = 0;
+
+public:
+    LayoutTransform(Layout from, Layout to) : m_from(from), m_to(to) {}
+
+    LayoutTransform() = default;
+
+    std::string getType() const override { return "LayoutTransform"; }
+
+    void save(std::ostream& out) const override {
+        out << static_cast<int>(m_from) << " " << static_cast<int>(m_to) << "\n";
+    }
+
+    void load(std::istream& in) override {
+        int from, to;
+        in >> from >> to;
+        if (in.fail()) {
+            throw std::runtime_error("LayoutTransform: failed to read parameters");
+        }
+        m_from = static_cast<Layout>(from);
+        m_to = static_cast<Layout>(to);
+    }
+
+    std::vector<size_t> compile(const std::vector<size_t>& input_shape) override {
+        if (input_shape.size() != 3) {
+            throw std::runtime_error("LayoutTransform: expected a C x H x W input shape");
+        }
+        m_channels = input_shape[0];
+        m_height = input_shape[1];
+        m_width = input_shape[2];
+        if (!layout_supports(m_from, m_channels) || !layout_supports(m_to, m_channels)) {
+            throw std::runtime_error("LayoutTransform: channel count does not fit the layout");
+        }
+        return input_shape;
+    }
+
+    std::vector<T> forward(const std::vector<T>& input) override {
+        std::vector<T> output(input.size());
+        convert_layout(input.data(), m_from, output.data(), m_to, m_channels, m_height, m_width);
+        return output;
+    }
+
+    std::vector<T> backward(const std::vector<T>& output_gradient) override {
+        std::vector<T> input_gradient(output_gradient.size());
+        convert_layout(output_gradient.data(), m_to, input_gradient.data(), m_from,
+                       m_channels, m_height, m_width);
+        return input_gradient;
+    }
+};
\ No newline at end of file
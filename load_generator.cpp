@@ -0,0 +1,62 @@
+#include "inference_server.h"
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cmath>
+
+using namespace std;
+using T = float;
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0]
+             << " <input_size> [socket_path] [connections] [requests_per_connection]\n";
+        return 1;
+    }
+
+    size_t input_size = stoul(argv[1]);
+    string socket_path = argc > 2 ? argv[2] : "/tmp/nn_server.sock";
+    size_t connections = argc > 3 ? stoul(argv[3]) : 16;
+    size_t requests = argc > 4 ? stoul(argv[4]) : 1000;
+
+    LatencyStats latency;
+    vector<thread> clients;
+    size_t failures = 0;
+    mutex failures_mutex;
+
+    auto start = chrono::steady_clock::now();
+    for (size_t c = 0; c < connections; ++c) {
+        clients.emplace_back([&, c] {
+            int fd = connect_unix_socket(socket_path);
+            vector<T> input(input_size), output;
+            LatencyStats local;
+
+            for (size_t r = 0; r < requests; ++r) {
+                for (size_t i = 0; i < input_size; ++i) {
+                    input[i] = static_cast<T>(sin(0.1 * (c * requests + r + i)));
+                }
+
+                auto sent = chrono::steady_clock::now();
+                if (!send_values(fd, input) || !recv_values(fd, output) || output.empty()) {
+                    lock_guard<mutex> lock(failures_mutex);
+                    ++failures;
+                    break;
+                }
+                local.record(chrono::duration<double, micro>(chrono::steady_clock::now() - sent).count());
+            }
+
+            ::close(fd);
+            latency.merge(local);
+        });
+    }
+    for (auto& client : clients) client.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    auto summary = latency.summarize();
+    cout << "requests: " << summary.count << ", failed connections: " << failures
+         << ", throughput: " << summary.count / seconds << " req/s\n"
+         << "latency mean: " << summary.mean_us << " us, p50: " << summary.p50_us
+         << " us, p99: " << summary.p99_us << " us, max: " << summary.max_us << " us" << endl;
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "kernels.h"
+#include <vector>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+// Losses work on a batch of rows, each `dim` values wide, and return the
+// mean loss. The gradient with respect to the predictions is written into
+// a caller-owned buffer in the same pass; pass nullptr to skip it.
+template<typename T>
+class LossFunction {
+public:
+    virtual ~LossFunction() = default;
+    virtual std::string name() const = 0;
+
+    virtual T compute_batch(const T* prediction, const T* target,
+                            size_t batch, size_t dim, T* gradient) const = 0;
+
+    T compute(const std::vector<T>& prediction, const std::vector<T>& target,
+              std::vector<T>& gradient) const {
+        if (prediction.size() != target.size()) {
+            throw std::runtime_error(name() + ": prediction and target sizes differ");
+        }
+        gradient.resize(prediction.size());
+        return compute_batch(prediction.data(), target.data(), 1, prediction.size(), gradient.data());
+    }
+
+    T value(const std::vector<T>& prediction, const std::vector<T>& target) const {
+        if (prediction.size() != target.size()) {
+            throw std::runtime_error(name() + ": prediction and target sizes differ");
+        }
+        return compute_batch(prediction.data(), target.data(), 1, prediction.size(), nullptr);
+    }
+};
+
+template<typename T>
+class MSELoss : public LossFunction<T> {
+public:
+    std::string name() const override { return "MSELoss"; }
+
+    T compute_batch(const T* prediction, const T* target,
+                    size_t batch, size_t dim, T* gradient) const override {
+        return mse_loss(prediction, target, batch * dim, gradient);
+    }
+};
+
+// Softmax followed by cross-entropy, taking raw logits; see
+// softmax_cross_entropy() in kernels.h.
+template<typename T>
+class SoftmaxCrossEntropyLoss : public LossFunction<T> {
+public:
+    std::string name() const override { return "SoftmaxCrossEntropyLoss"; }
+
+    T compute_batch(const T* logits, const T* target,
+                    size_t batch, size_t dim, T* gradient) const override {
+        return softmax_cross_entropy(logits, target, batch, dim, gradient);
+    }
+};
+
+// Sigmoid followed by binary cross-entropy, taking raw logits; see
+// sigmoid_cross_entropy() in kernels.h.
+template<typename T>
+class SigmoidBCELoss : public LossFunction<T> {
+public:
+    std::string name() const override { return "SigmoidBCELoss"; }
+
+    T compute_batch(const T* logits, const T* target,
+                    size_t batch, size_t dim, T* gradient) const override {
+        return sigmoid_cross_entropy(logits, target, batch * dim, gradient);
+    }
+};
@@ -5,6 +5,7 @@
 #include "model.h"
 #include "dense.h"
 #include "trainer.h"
+#include "loss.h"
 #include "maxpool.h"
 #include "flatten.h"
 #include "conv2d.h"
@@ -19,23 +20,6 @@ const vector<pair<vector<T>, vector<T>>> train_data = {
     {{1, 1}, {0}}
 };
 
-T mse_loss(const vector<T>& pred, const vector<T>& target) {
-    T loss = 0;
-    for (size_t i = 0; i < pred.size(); ++i) {
-        T diff = pred[i] - target[i];
-        loss += diff * diff;
-    }
-    return loss / pred.size();
-}
-
-vector<T> mse_loss_deriv(const vector<T>& pred, const vector<T>& target) {
-    vector<T> deriv(pred.size());
-    for (size_t i = 0; i < pred.size(); ++i) {
-        deriv[i] = 2 * (pred[i] - target[i]) / pred.size();
-    }
-    return deriv;
-}
-
 int main() {
     Model<T> model;
     
@@ -44,8 +28,10 @@ int main() {
     
     model.add(move(layer1));
     model.add(move(layer2));
+    model.compile({2});
 
     BackwardTrainer<T> trainer(model, 0.1);
+    MSELoss<T> mse;
     const T target_mse = 0.1;
     const int max_epochs = 100000; 
     T epoch_loss = 1;
@@ -53,9 +39,7 @@ int main() {
     for (int epoch = 0; epoch < max_epochs && epoch_loss > target_mse; ++epoch) {
         epoch_loss = 0;
         for (const auto& [input, target] : train_data) {
-            trainer.train_step(input, target, mse_loss, mse_loss_deriv);
-            auto output = model.forward(input);
-            epoch_loss += mse_loss(output, target);
+            epoch_loss += trainer.train_step(input, target, mse);
         }
         epoch_loss /= train_data.size();
         
@@ -1,9 +1,15 @@
 #pragma once
 #include "lay.h"
+#include "layout.h"
+#include "kernels.h"
 #include <vector>
 #include <stdexcept>
 #include <limits>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <algorithm>
+#include <cstdint>
 
 template<typename T>
 class MaxPool : public Lay<T> {
@@ -12,29 +18,125 @@ private:
     size_t m_input_width;
     size_t m_channels;
     size_t m_pool_size;
+    size_t m_stride;
+    size_t m_padding;
     size_t m_output_height;
     size_t m_output_width;
-    std::vector<size_t> m_max_indices;
+    // Position of the maximum inside its window (ph * pool_size + pw).
+    std::vector<uint8_t> m_max_offsets;
+    Layout m_layout = Layout::NCHW;
+    bool m_auto_layout = true;
+    size_t m_lanes = 1;
+    bool m_compiled = false;
+
+    void calculate_output_dimensions() {
+        if (m_pool_size == 0 || m_stride == 0) {
+            throw std::runtime_error("MaxPool: pool_size and stride must be positive");
+        }
+        if (m_pool_size * m_pool_size > 256) {
+            throw std::runtime_error("MaxPool: pool_size must not exceed 16");
+        }
+        if (m_padding >= m_pool_size) {
+            throw std::runtime_error("MaxPool: padding must be smaller than pool_size");
+        }
+        if (m_input_height + 2 * m_padding < m_pool_size ||
+            m_input_width + 2 * m_padding < m_pool_size) {
+            throw std::runtime_error("MaxPool: pool_size exceeds padded input dimensions");
+        }
+        m_output_height = (m_input_height + 2 * m_padding - m_pool_size) / m_stride + 1;
+        m_output_width = (m_input_width + 2 * m_padding - m_pool_size) / m_stride + 1;
+    }
+
+    // Returns false for offsets that fall into the padding; that only
+    // happens when no input in the window compared greater than lowest().
+    bool input_index(size_t c, size_t i, size_t j, uint8_t offset, size_t& index) const {
+        size_t h = i * m_stride + offset / m_pool_size;
+        size_t w = j * m_stride + offset % m_pool_size;
+        if (h < m_padding || w < m_padding) return false;
+        h -= m_padding;
+        w -= m_padding;
+        if (h >= m_input_height || w >= m_input_width) return false;
+        index = layout_index(m_lanes, m_input_height, m_input_width, c, h, w);
+        return true;
+    }
+
+    void decode_output_index(size_t out_index, size_t& c, size_t& i, size_t& j) const {
+        size_t block = m_output_height * m_output_width * m_lanes;
+        size_t position = out_index % block / m_lanes;
+        c = out_index / block * m_lanes + out_index % m_lanes;
+        i = position / m_output_width;
+        j = position % m_output_width;
+    }
+
+    // NHWC and NCHWc: each window position is compared across a vector of
+    // channel lanes instead of across the output width.
+    void forward_blocked(const std::vector<T>& input, std::vector<T>& output) {
+        for (size_t b = 0; b < m_channels / m_lanes; ++b) {
+            for (size_t i = 0; i < m_output_height; ++i) {
+                for (size_t j = 0; j < m_output_width; ++j) {
+                    size_t out_index = ((b * m_output_height + i) * m_output_width + j) * m_lanes;
+                    T* out = &output[out_index];
+                    uint8_t* offsets = &m_max_offsets[out_index];
+
+                    for (size_t ph = 0; ph < m_pool_size; ++ph) {
+                        size_t h = i * m_stride + ph;
+                        if (h < m_padding || h - m_padding >= m_input_height) continue;
+
+                        for (size_t pw = 0; pw < m_pool_size; ++pw) {
+                            size_t w = j * m_stride + pw;
+                            if (w < m_padding || w - m_padding >= m_input_width) continue;
+
+                            uint8_t offset = static_cast<uint8_t>(ph * m_pool_size + pw);
+                            const T* in = &input[((b * m_input_height + h - m_padding) * m_input_width +
+                                                  w - m_padding) * m_lanes];
+                            for (size_t l = 0; l < m_lanes; ++l) {
+                                bool greater = in[l] > out[l];
+                                out[l] = greater ? in[l] : out[l];
+                                offsets[l] = greater ? offset : offsets[l];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
 
 public:
-    MaxPool(size_t input_height, size_t input_width, size_t channels, size_t pool_size)
-        : m_input_height(input_height), m_input_width(input_width), 
+    MaxPool(size_t input_height, size_t input_width, size_t channels, size_t pool_size,
+            size_t stride = 0, size_t padding = 0)
+        : m_input_height(input_height), m_input_width(input_width),
           m_channels(channels), m_pool_size(pool_size),
-          m_output_height(input_height / pool_size),
-          m_output_width(input_width / pool_size) 
+          m_stride(stride ? stride : pool_size), m_padding(padding)
     {
-        if (input_height % pool_size != 0 || input_width % pool_size != 0) {
-            throw std::runtime_error("Input dimensions must be divisible by pool_size");
-        }
+        calculate_output_dimensions();
     }
 
     MaxPool() = default;
 
     std::string getType() const override { return "MaxPool"; }
 
+    // Pins the memory layout instead of following the incoming one.
+    void set_layout(Layout layout) {
+        m_layout = layout;
+        m_auto_layout = false;
+        m_compiled = false;
+    }
+
+    std::vector<size_t> input_feature_shape() const override {
+        return {m_channels, m_input_height, m_input_width};
+    }
+
+    Layout select_layout(const std::vector<size_t>& input_shape, Layout incoming) override {
+        if (m_auto_layout) {
+            m_layout = layout_supports(incoming, m_channels) ? incoming : Layout::NCHW;
+        }
+        return m_layout;
+    }
+
     void save(std::ostream& out) const override {
         out << m_input_height << " " << m_input_width << " "
-            << m_channels << " " << m_pool_size << "\n";
+            << m_channels << " " << m_pool_size << " "
+            << m_stride << " " << m_padding << "\n";
     }
 
     void load(std::istream& in) override {
@@ -42,90 +144,100 @@ public:
         if (in.fail()) {
             throw std::runtime_error("MaxPool: failed to read parameters");
         }
-        
-        m_output_height = m_input_height / m_pool_size;
-        m_output_width = m_input_width / m_pool_size;
-        m_max_indices.clear();  
-        
-        if (m_input_height % m_pool_size != 0 || m_input_width % m_pool_size != 0) {
-            throw std::runtime_error("Input dimensions must be divisible by pool_size");
+
+        // Files written before stride and padding existed end the line here.
+        std::string rest;
+        std::getline(in, rest);
+        std::istringstream extra(rest);
+        if (!(extra >> m_stride >> m_padding)) {
+            m_stride = m_pool_size;
+            m_padding = 0;
         }
+
+        calculate_output_dimensions();
+        m_max_offsets.clear();
+        m_compiled = false;
     }
 
-    std::vector<T> forward(const std::vector<T>& input) override {
-        if (input.size() != m_input_height * m_input_width * m_channels) {
+    std::vector<size_t> compile(const std::vector<size_t>& input_shape) override {
+        size_t expected = m_channels * m_input_height * m_input_width;
+        bool matches = input_shape.size() == 3
+            ? input_shape == std::vector<size_t>{m_channels, m_input_height, m_input_width}
+            : shape_size(input_shape) == expected;
+        if (!matches) {
             std::ostringstream oss;
-            oss << "MaxPool: input size mismatch. Expected: " 
-                << m_input_height * m_input_width * m_channels
-                << ", Got: " << input.size();
+            oss << "MaxPool: input shape mismatch. Expected: " << m_channels
+                << "x" << m_input_height << "x" << m_input_width
+                << " (" << expected << " values), Got: " << shape_size(input_shape);
             throw std::runtime_error(oss.str());
         }
 
-        size_t output_size = m_output_height * m_output_width * m_channels;
-        std::vector<T> output(output_size, T(0));
-        m_max_indices.resize(output_size);
+        if (!layout_supports(m_layout, m_channels)) {
+            throw std::runtime_error("MaxPool: " + layout_name(m_layout) +
+                                     " needs a channel count divisible by " +
+                                     std::to_string(kChannelBlock));
+        }
 
-        for (size_t c = 0; c < m_channels; ++c) {
-            for (size_t i = 0; i < m_output_height; ++i) {
-                for (size_t j = 0; j < m_output_width; ++j) {
-                    T max_val = std::numeric_limits<T>::lowest();
-                    size_t max_index_in_region = 0;
-                    size_t start_h = i * m_pool_size;
-                    size_t start_w = j * m_pool_size;
-
-                    for (size_t h = 0; h < m_pool_size; ++h) {
-                        for (size_t w = 0; w < m_pool_size; ++w) {
-                            size_t input_index = c * (m_input_height * m_input_width) 
-                                              + (start_h + h) * m_input_width 
-                                              + (start_w + w);
-                            T val = input[input_index];
-                            if (val > max_val) {
-                                max_val = val;
-                                max_index_in_region = h * m_pool_size + w;
-                            }
-                        }
-                    }
+        m_lanes = layout_lanes(m_layout, m_channels);
+        m_max_offsets.resize(m_output_height * m_output_width * m_channels);
+        m_compiled = true;
+        return {m_channels, m_output_height, m_output_width};
+    }
 
-                    size_t out_index = c * (m_output_height * m_output_width) 
-                                    + i * m_output_width + j;
-                    output[out_index] = max_val;
-                    m_max_indices[out_index] = max_index_in_region;
-                }
-            }
+    std::vector<T> forward(const std::vector<T>& input) override {
+        if (!m_compiled) compile({input.size()});
+
+        size_t output_size = m_output_height * m_output_width * m_channels;
+        if (m_layout != Layout::NCHW) {
+            std::vector<T> output(output_size, std::numeric_limits<T>::lowest());
+            std::fill(m_max_offsets.begin(), m_max_offsets.end(), 0);
+            forward_blocked(input, output);
+            return output;
         }
 
+        std::vector<T> output(output_size);
+        max_pool_nchw(input.data(), m_channels, m_input_height, m_input_width,
+                      m_pool_size, m_stride, m_padding,
+                      output.data(), m_max_offsets.data(), m_output_height, m_output_width);
         return output;
     }
 
     std::vector<T> backward(const std::vector<T>& output_gradient) override {
-        if (output_gradient.size() != m_output_height * m_output_width * m_channels) {
-            std::ostringstream oss;
-            oss << "MaxPool: output gradient size mismatch. Expected: " 
-                << m_output_height * m_output_width * m_channels
-                << ", Got: " << output_gradient.size();
-            throw std::runtime_error(oss.str());
-        }
-
-        std::vector<T> input_gradient(m_input_height * m_input_width * m_channels, T(0));
+        return backward(std::vector<T>(output_gradient));
+    }
 
-        for (size_t c = 0; c < m_channels; ++c) {
-            for (size_t i = 0; i < m_output_height; ++i) {
-                for (size_t j = 0; j < m_output_width; ++j) {
-                    size_t out_index = c * (m_output_height * m_output_width) 
-                                    + i * m_output_width + j;
-                    T grad_val = output_gradient[out_index];
-                    size_t max_index_in_region = m_max_indices[out_index];
-                    size_t h_offset = max_index_in_region / m_pool_size;
-                    size_t w_offset = max_index_in_region % m_pool_size;
-                    size_t h = i * m_pool_size + h_offset;
-                    size_t w = j * m_pool_size + w_offset;
-                    size_t input_index = c * (m_input_height * m_input_width) 
-                                      + h * m_input_width + w;
-                    input_gradient[input_index] += grad_val;
-                }
+    // With non-overlapping windows and no padding this scatters into the
+    // upstream gradient buffer itself: in every layout output index o maps
+    // to an input index >= o, so walking the outputs backwards never
+    // overwrites an unread gradient. Overlapping or padded windows
+    // accumulate into a separate buffer.
+    std::vector<T> backward(std::vector<T>&& output_gradient) override {
+        size_t input_size = m_input_height * m_input_width * m_channels;
+        size_t c, i, j;
+
+        if (m_stride >= m_pool_size && m_padding == 0) {
+            std::vector<T> input_gradient = std::move(output_gradient);
+            input_gradient.resize(input_size, T(0));
+
+            for (size_t out_index = m_max_offsets.size(); out_index-- > 0;) {
+                decode_output_index(out_index, c, i, j);
+                T grad_val = input_gradient[out_index];
+                input_gradient[out_index] = T(0);
+                size_t index = 0;
+                input_index(c, i, j, m_max_offsets[out_index], index);
+                input_gradient[index] += grad_val;
             }
+            return input_gradient;
         }
 
+        std::vector<T> input_gradient(input_size, T(0));
+        for (size_t out_index = 0; out_index < m_max_offsets.size(); ++out_index) {
+            decode_output_index(out_index, c, i, j);
+            size_t index;
+            if (input_index(c, i, j, m_max_offsets[out_index], index)) {
+                input_gradient[index] += output_gradient[out_index];
+            }
+        }
         return input_gradient;
     }
 
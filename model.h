@@ -2,10 +2,19 @@
 #include <vector>
 #include <memory>
 #include "lay.h"
+#include "random.h"
 #include "dense.h"
+#include "sparse_dense.h"
+#include "batchnorm.h"
 #include "conv2d.h"
+#include "grouped_conv.h"
+#include "recurrent.h"
 #include "maxpool.h"
+#include "avgpool.h"
 #include "flatten.h"
+#include "activation_layer.h"
+#include "layout_transform.h"
+#include "prefix_cache.h"
 #include <fstream>
 #include <string>
 #include <stdexcept>
@@ -16,9 +25,19 @@ template<typename T>
 std::unique_ptr<Lay<T>> create_layer(const std::string& type) {
     static const std::unordered_map<std::string, std::function<std::unique_ptr<Lay<T>>()>> creators = {
         {"Dense", []() { return std::make_unique<Dense<T>>(); }},
+        {"SparseDense", []() { return std::make_unique<SparseDense<T>>(); }},
         {"Conv2D", []() { return std::make_unique<Conv2D<T>>(); }},
+        {"GroupedConv2D", []() { return std::make_unique<GroupedConv2D<T>>(); }},
+        {"DepthwiseConv2D", []() { return std::make_unique<DepthwiseConv2D<T>>(); }},
+        {"PointwiseConv2D", []() { return std::make_unique<PointwiseConv2D<T>>(); }},
         {"MaxPool", []() { return std::make_unique<MaxPool<T>>(); }},
-        {"Flatten", []() { return std::make_unique<Flatten<T>>(); }}
+        {"AvgPool", []() { return std::make_unique<AvgPool<T>>(); }},
+        {"GlobalAvgPool", []() { return std::make_unique<GlobalAvgPool<T>>(); }},
+        {"Flatten", []() { return std::make_unique<Flatten<T>>(); }},
+        {"Activation", []() { return std::make_unique<ActivationLayer<T>>(); }},
+        {"BatchNorm", []() { return std::make_unique<BatchNorm<T>>(); }},
+        {"LSTM", []() { return std::make_unique<LSTM<T>>(); }},
+        {"GRU", []() { return std::make_unique<GRU<T>>(); }}
     };
 
     auto it = creators.find(type);
@@ -31,31 +50,343 @@ std::unique_ptr<Lay<T>> create_layer(const std::string& type) {
 template<typename T>
 class Model {
     std::vector<std::unique_ptr<Lay<T>>> m_layers;
+    // Execution order built by compile(): the layers plus any layout
+    // transforms between them. The transforms are owned here, not saved.
+    std::vector<Lay<T>*> m_plan;
+    std::vector<size_t> m_plan_output_sizes;
+    std::vector<std::unique_ptr<Lay<T>>> m_transforms;
+    std::vector<size_t> m_input_shape;
+    std::vector<size_t> m_output_shape;
+    size_t m_input_size = 0;
+    bool m_compiled = false;
+    // Distinct per model until set_seed, so unseeded models still differ.
+    uint64_t m_seed = Philox::next_seed();
+    bool m_input_gradient_required = false;
+    bool m_inference = false;
+    // backward() runs m_plan[m_backward_begin..]; everything before it
+    // has no trainable parameters upstream of a trainable layer.
+    size_t m_backward_begin = 0;
+    // Outputs of the frozen prefix m_plan[0..m_backward_begin), by sample id.
+    std::shared_ptr<PrefixCache<T>> m_prefix_cache;
+    std::vector<T> m_prefix_features;
+
+    // A layer needs its input gradient only if some trainable layer
+    // (or the caller, for the model input) sits before it. Layers before
+    // the first one backward() reaches run in inference mode.
+    void plan_gradients() {
+        bool upstream = m_input_gradient_required;
+        m_backward_begin = upstream ? 0 : m_plan.size();
+        std::vector<ParamRef<T>> params;
+        for (size_t i = 0; i < m_plan.size(); ++i) {
+            m_plan[i]->set_input_gradient_required(upstream);
+            params.clear();
+            m_plan[i]->collect_params(params);
+            if (m_plan[i]->trainable() && !params.empty() && !upstream) {
+                m_backward_begin = i;
+                upstream = true;
+            }
+        }
+        for (size_t i = 0; i < m_plan.size(); ++i) {
+            m_plan[i]->set_inference(m_inference || i < m_backward_begin);
+        }
+        bind_prefix_cache();
+    }
+
+    void bind_prefix_cache() {
+        if (m_prefix_cache && m_backward_begin > 0) {
+            m_prefix_cache->bind(frozen_prefix_size(), frozen_prefix_fingerprint());
+        }
+    }
+
+    void check_input(const std::vector<T>& input) {
+        if (!m_compiled) {
+            compile({input.size()});
+        } else if (input.size() != m_input_size) {
+            throw std::runtime_error("Model input size mismatch. Expected: " +
+                                     std::to_string(m_input_size) + ", Got: " +
+                                     std::to_string(input.size()));
+        }
+    }
+
+    std::vector<T> run(const std::vector<T>& input, size_t begin, size_t end) {
+        if (begin == end) return input;
+        std::vector<T> result = m_plan[begin]->forward(input);
+        for (size_t i = begin + 1; i < end; ++i) {
+            result = m_plan[i]->forward(std::move(result));
+        }
+        return result;
+    }
 
 public:
     void add(std::unique_ptr<Lay<T>> layer) {
+        layer->seed(m_seed, m_layers.size());
         m_layers.push_back(std::move(layer));
+        m_compiled = false;
     }
 
+    // Re-seeds every layer. Layers whose weights are not initialized yet
+    // (they are on their first compile) draw them from the new seed.
+    void set_seed(uint64_t seed) {
+        m_seed = seed;
+        for (size_t i = 0; i < m_layers.size(); ++i) m_layers[i]->seed(seed, i);
+    }
+
+    // Re-seeds and draws every weight again in the existing buffers; the
+    // model then matches one built with set_seed(seed) and compiled anew.
+    void reinitialize(uint64_t seed) {
+        set_seed(seed);
+        for (auto& layer : m_layers) layer->reinitialize();
+        if (m_compiled) bind_prefix_cache();
+    }
+
+    // Propagates the input shape through every layer once, so misconfigured
+    // models fail here instead of in the middle of training. Each layer also
+    // picks its memory layout; where neighbours disagree a LayoutTransform
+    // is inserted, and the model input and output are always NCHW.
+    std::vector<size_t> compile(const std::vector<size_t>& input_shape) {
+        if (m_layers.empty()) throw std::runtime_error("Cannot compile an empty model");
+
+        m_plan.clear();
+        m_plan_output_sizes.clear();
+        m_transforms.clear();
+        std::vector<size_t> shape = input_shape;
+        Layout layout = Layout::NCHW;
+
+        auto convert = [&](Layout to) {
+            if (to == layout) return;
+            m_transforms.push_back(std::make_unique<LayoutTransform<T>>(layout, to));
+            shape = m_transforms.back()->compile(shape);
+            m_plan.push_back(m_transforms.back().get());
+            m_plan_output_sizes.push_back(shape_size(shape));
+            layout = to;
+        };
+
+        for (size_t i = 0; i < m_layers.size(); ++i) {
+            try {
+                Layout wanted = m_layers[i]->select_layout(shape, layout);
+                if (wanted != layout && shape.size() != 3) {
+                    std::vector<size_t> feature_shape = m_layers[i]->input_feature_shape();
+                    if (!feature_shape.empty() && shape_size(feature_shape) == shape_size(shape)) {
+                        shape = feature_shape;
+                    }
+                }
+                convert(wanted);
+                shape = m_layers[i]->compile(shape);
+            } catch (const std::exception& e) {
+                throw std::runtime_error("Error compiling layer " + std::to_string(i) +
+                                         " '" + m_layers[i]->getType() + "': " + e.what());
+            }
+            m_plan.push_back(m_layers[i].get());
+            m_plan_output_sizes.push_back(shape_size(shape));
+        }
+        convert(Layout::NCHW);
+
+        m_input_shape = input_shape;
+        m_output_shape = shape;
+        m_input_size = shape_size(input_shape);
+        m_compiled = true;
+        plan_gradients();
+        return shape;
+    }
+
+    const std::vector<size_t>& input_shape() const { return m_input_shape; }
+    const std::vector<size_t>& output_shape() const { return m_output_shape; }
+
     std::vector<T> forward(const std::vector<T>& input) {
-        std::vector<T> result = input;
-        for (auto& layer : m_layers) {
-            result = layer->forward(result);
+        check_input(input);
+        return run(input, 0, m_plan.size());
+    }
+
+    // Like forward(), but with a prefix cache attached the output of the
+    // frozen prefix is kept per sample id and reused on later epochs.
+    std::vector<T> forward(size_t sample, const std::vector<T>& input) {
+        check_input(input);
+        if (!m_prefix_cache || m_backward_begin == 0) return run(input, 0, m_plan.size());
+
+        if (!m_prefix_cache->lookup(sample, m_prefix_features)) {
+            m_prefix_features = run(input, 0, m_backward_begin);
+            m_prefix_cache->store(sample, m_prefix_features);
         }
-        return result;
+        return run(m_prefix_features, m_backward_begin, m_plan.size());
+    }
+
+    void set_prefix_cache(std::shared_ptr<PrefixCache<T>> cache) {
+        m_prefix_cache = std::move(cache);
+        if (m_compiled) bind_prefix_cache();
+    }
+
+    void set_prefix_cache(bool enabled) {
+        set_prefix_cache(enabled ? std::make_shared<MemoryPrefixCache<T>>() : nullptr);
+    }
+
+    // Number of values the frozen prefix produces; 0 when nothing is frozen.
+    size_t frozen_prefix_size() const {
+        return m_backward_begin > 0 && m_backward_begin <= m_plan_output_sizes.size()
+            ? m_plan_output_sizes[m_backward_begin - 1] : 0;
+    }
+
+    // Hash of the frozen prefix's weights, so cached features are not
+    // reused after the backbone changes.
+    uint64_t frozen_prefix_fingerprint() const {
+        uint64_t hash = 1469598103934665603ull;
+        auto mix = [&hash](uint64_t value) {
+            hash ^= value;
+            hash *= 1099511628211ull;
+        };
+        std::vector<ParamRef<T>> params;
+        for (size_t i = 0; i < m_backward_begin && i < m_plan.size(); ++i) {
+            mix(std::hash<std::string>()(m_plan[i]->getType()));
+            params.clear();
+            m_plan[i]->collect_params(params);
+            for (const auto& param : params) {
+                mix(param.size);
+                const unsigned char* bytes = reinterpret_cast<const unsigned char*>(param.values);
+                for (size_t b = 0; b < param.size * sizeof(T); ++b) mix(bytes[b]);
+            }
+        }
+        mix(frozen_prefix_size());
+        return hash;
+    }
+
+    size_t layer_count() const { return m_layers.size(); }
+    Lay<T>& layer(size_t index) { return *m_layers.at(index); }
+
+    // Freezes or unfreezes a layer; a compiled model is recompiled so
+    // gradient buffers and the backward plan follow.
+    void set_trainable(size_t index, bool trainable) {
+        m_layers.at(index)->set_trainable(trainable);
+        if (m_compiled) compile(m_input_shape);
+    }
+
+    // Inference mode: every layer runs forward only and uses its stored
+    // statistics (BatchNorm) instead of training-time ones. backward() must
+    // not be called until it is switched off again.
+    void set_inference(bool inference) {
+        m_inference = inference;
+        if (m_compiled) plan_gradients();
+    }
+
+    // Folds each BatchNorm that directly follows a convolution, or a Dense with
+    // linear activation, into that layer's weights and removes it, so
+    // inference pays nothing for it. Call after training, before saving.
+    // Returns the number of layers folded.
+    size_t fold_batchnorm() {
+        size_t folded = 0;
+        std::vector<T> scale, shift;
+        for (size_t i = 1; i < m_layers.size();) {
+            auto* norm = dynamic_cast<BatchNorm<T>*>(m_layers[i].get());
+            auto* conv = dynamic_cast<Conv2D<T>*>(m_layers[i - 1].get());
+            auto* grouped = dynamic_cast<GroupedConv2D<T>*>(m_layers[i - 1].get());
+            auto* dense = dynamic_cast<Dense<T>*>(m_layers[i - 1].get());
+            if (dense && dense->activation_name() != "linear") dense = nullptr;
+            if (!norm || (!conv && !grouped && !dense)) {
+                ++i;
+                continue;
+            }
+
+            norm->inference_affine(scale, shift);
+            if (conv) {
+                conv->fold_affine(scale, shift);
+            } else if (grouped) {
+                grouped->fold_affine(scale, shift);
+            } else {
+                dense->fold_affine(scale, shift);
+            }
+            m_layers.erase(m_layers.begin() + i);
+            ++folded;
+        }
+        if (folded > 0 && m_compiled) compile(m_input_shape);
+        return folded;
+    }
+
+    // Replaces the Dense layer at index with a magnitude-pruned SparseDense.
+    // Returns the fraction of weights kept.
+    double prune(size_t index, const PruneConfig& config) {
+        auto* dense = dynamic_cast<Dense<T>*>(m_layers.at(index).get());
+        if (!dense) {
+            throw std::runtime_error("Cannot prune layer " + std::to_string(index) + " '" +
+                                     m_layers[index]->getType() + "': not a Dense layer");
+        }
+
+        auto sparse = std::make_unique<SparseDense<T>>(*dense, config);
+        sparse->set_trainable(dense->trainable());
+        double density = sparse->density();
+        m_layers[index] = std::move(sparse);
+        if (m_compiled) compile(m_input_shape);
+        return density;
+    }
+
+    // Runs the samples through each layer's forward_batch, so Dense layers
+    // do one GEMM over the whole batch and BatchNorm normalizes with the
+    // statistics of the batch. Outside inference mode backward_batch() can
+    // follow.
+    std::vector<std::vector<T>> forward_batch(const std::vector<std::vector<T>>& inputs) {
+        if (inputs.empty()) return {};
+        std::vector<T> batch;
+        batch.reserve(inputs.size() * inputs[0].size());
+        for (const auto& input : inputs) {
+            check_input(input);
+            batch.insert(batch.end(), input.begin(), input.end());
+        }
+        for (Lay<T>* layer : m_plan) batch = layer->forward_batch(batch, inputs.size());
+
+        size_t output_size = batch.size() / inputs.size();
+        std::vector<std::vector<T>> outputs(inputs.size());
+        for (size_t n = 0; n < inputs.size(); ++n) {
+            outputs[n].assign(batch.begin() + n * output_size, batch.begin() + (n + 1) * output_size);
+        }
+        return outputs;
+    }
+
+    // By default backward() stops at the first trainable layer and returns
+    // an empty vector; ask for the gradient with respect to the model input
+    // here if you need it.
+    void set_input_gradient_required(bool required) {
+        m_input_gradient_required = required;
+        if (m_compiled) plan_gradients();
     }
 
     std::vector<T> backward(const std::vector<T>& output_gradient) {
-        std::vector<T> grad = output_gradient;
-        for (auto it = m_layers.rbegin(); it != m_layers.rend(); ++it) {
-            grad = (*it)->backward(grad);
+        if (m_backward_begin >= m_plan.size()) return {};
+        std::vector<T> grad = m_plan.back()->backward(output_gradient);
+        for (size_t i = m_plan.size() - 1; i-- > m_backward_begin;) {
+            grad = m_plan[i]->backward(std::move(grad));
         }
         return grad;
     }
 
+    // Gradients for the samples of the last forward_batch(). Returns the
+    // input gradients only if set_input_gradient_required(true).
+    std::vector<std::vector<T>> backward_batch(const std::vector<std::vector<T>>& output_gradients) {
+        if (output_gradients.empty() || m_backward_begin >= m_plan.size()) return {};
+        size_t count = output_gradients.size();
+        std::vector<T> grad;
+        grad.reserve(count * output_gradients[0].size());
+        for (const auto& gradient : output_gradients) grad.insert(grad.end(), gradient.begin(), gradient.end());
+        for (size_t i = m_plan.size(); i-- > m_backward_begin;) {
+            grad = m_plan[i]->backward_batch(grad, count);
+        }
+        if (grad.empty()) return {};
+
+        size_t input_size = grad.size() / count;
+        std::vector<std::vector<T>> input_gradients(count);
+        for (size_t n = 0; n < count; ++n) {
+            input_gradients[n].assign(grad.begin() + n * input_size, grad.begin() + (n + 1) * input_size);
+        }
+        return input_gradients;
+    }
+
+    std::vector<ParamRef<T>> params() {
+        std::vector<ParamRef<T>> result;
+        for (auto& layer : m_layers) {
+            layer->collect_params(result);
+        }
+        return result;
+    }
+
     void update_weights(T learning_rate) {
         for (auto& layer : m_layers) {
-            layer->update_weights(learning_rate);
+            if (layer->trainable()) layer->update_weights(learning_rate);
         }
     }
 
@@ -64,7 +395,7 @@ public:
         if (!out) throw std::runtime_error("Cannot open file for writing");
         
         for (const auto& layer : m_layers) {
-            out << layer->getType() << "\n";
+            out << layer->getType() << (layer->trainable() ? "" : ":frozen") << "\n";
             layer->save(out);
         }
     }
@@ -74,10 +405,20 @@ public:
         if (!in) throw std::runtime_error("Cannot open file for reading");
         
         m_layers.clear();
+        m_plan.clear();
+        m_transforms.clear();
+        m_compiled = false;
         std::string layer_type;
         
         while (in >> layer_type) {
+            const std::string frozen_suffix = ":frozen";
+            bool frozen = layer_type.size() > frozen_suffix.size() &&
+                layer_type.compare(layer_type.size() - frozen_suffix.size(),
+                                   frozen_suffix.size(), frozen_suffix) == 0;
+            if (frozen) layer_type.erase(layer_type.size() - frozen_suffix.size());
+
             auto layer = create_layer<T>(layer_type);
+            layer->set_trainable(!frozen);
             
             try {
                 layer->load(in);
@@ -1,17 +1,23 @@
 #pragma once
 #include "Layer.h"
-#include <random>
+#include "../random.h"
 #include <vector>
-#include <chrono>
+#include <cstdint>
 class DropoutLayer : public Layer {
 private:
     float rate;
     Tensor mask;
     bool is_training = true;
-    std::default_random_engine generator;
+    uint64_t base_seed;
+    Philox generator;
 public:
-    DropoutLayer(float dropout_rate) : rate(dropout_rate) {
-        generator.seed(std::chrono::system_clock::now().time_since_epoch().count());
+    // Masks come from a counter-based stream, so a given seed and stream
+    // reproduce the same masks regardless of threading.
+    DropoutLayer(float dropout_rate, uint64_t seed = 0, uint64_t stream = Philox::next_stream())
+        : rate(dropout_rate), base_seed(seed), generator(seed, stream) {}
+    void seed(uint64_t seed, uint64_t stream) override {
+        base_seed = seed;
+        generator = Philox(seed, stream);
     }
     void set_training_mode(bool training) {
         is_training = training;
@@ -21,17 +27,11 @@ public:
             return input;
         }
         mask = Tensor(input.shape);
-        std::bernoulli_distribution distribution(1.0f - rate);
         float scale = (rate < 1.0f) ? (1.0f / (1.0f - rate)) : 0.0f;
+        generator.bernoulli(mask.data.data(), mask.data.size(), 1.0 - rate, scale);
         Tensor output = input;
         for (size_t i = 0; i < mask.data.size(); ++i) {
-            if (distribution(generator)) {
-                mask.data[i] = 1.0f;
-                output.data[i] *= scale; 
-            } else {
-                mask.data[i] = 0.0f;
-                output.data[i] = 0.0f;
-            }
+            output.data[i] *= mask.data[i];
         }
         return output;
     }
@@ -40,10 +40,15 @@ public:
             return output_gradient;
         }
         Tensor input_gradient = output_gradient;
-        float scale = (rate < 1.0f) ? (1.0f / (1.0f - rate)) : 0.0f;
         for (size_t i = 0; i < input_gradient.data.size(); ++i) {
-            input_gradient.data[i] *= mask.data[i] * scale;
+            input_gradient.data[i] *= mask.data[i];
         }
         return input_gradient;
     }
+    // Same seed, but a stream of its own, so clones draw different masks.
+    std::unique_ptr<Layer> clone() const override {
+        auto copy = std::make_unique<DropoutLayer>(*this);
+        copy->generator = Philox(base_seed, Philox::next_stream());
+        return copy;
+    }
 };
\ No newline at end of file
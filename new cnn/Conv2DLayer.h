@@ -1,15 +1,16 @@
 #pragma once
 #include "Layer.h"
 #include <random>
+#include <algorithm>
 class Conv2DLayer : public Layer {
 public:
     Tensor kernels; 
     Tensor biases;  
     Tensor grad_kernels;
     Tensor grad_biases;
-private:
     int in_channels, out_channels;
     int kernel_size, stride, padding;
+private:
     Tensor last_input;
 public:
     Conv2DLayer(int input_channels, int output_channels, int kernel_size, int stride = 1, int padding = 0)
@@ -17,45 +18,68 @@ public:
           kernel_size(kernel_size), stride(stride), padding(padding) {
         kernels = Tensor({out_channels, in_channels, kernel_size, kernel_size});
         biases = Tensor({1, out_channels}); 
+        grad_kernels = Tensor(kernels.shape);
+        grad_biases = Tensor(biases.shape);
         std::default_random_engine generator;
         std::uniform_real_distribution<float> distribution(-0.1f, 0.1f);
         for (auto& w : kernels.data) w = distribution(generator);
     }
     Tensor forward(const Tensor& input) override {
         last_input = input;
-        int N = input.shape[0], C_in = input.shape[1], H_in = input.shape[2], W_in = input.shape[3];
-        int H_out = (H_in + 2 * padding - kernel_size) / stride + 1;
-        int W_out = (W_in + 2 * padding - kernel_size) / stride + 1;
+        int N = input.shape[0], H_in = input.shape[2], W_in = input.shape[3];
+        int H_pad = H_in + 2 * padding, W_pad = W_in + 2 * padding;
+        int H_out = (H_pad - kernel_size) / stride + 1;
+        int W_out = (W_pad - kernel_size) / stride + 1;
         Tensor output({N, out_channels, H_out, W_out});
+        AlignedVector<float> padded(static_cast<size_t>(in_channels) * H_pad * W_pad, 0.0f);
+        for (int n = 0; n < N; ++n) {
+            pad_nchw(&input.data[static_cast<size_t>(n) * in_channels * H_in * W_in], in_channels, H_in, W_in, padding, padded.data());
+            conv2d_nchw(padded.data(), in_channels, H_pad, W_pad, kernels.data.data(), biases.data.data(),
+                        out_channels, kernel_size, stride, &output.data[static_cast<size_t>(n) * out_channels * H_out * W_out], H_out, W_out);
+        }
+        return output;
+    }
+    Tensor backward(const Tensor& output_gradient) override {
+        int N = last_input.shape[0], C_in = last_input.shape[1], H_in = last_input.shape[2], W_in = last_input.shape[3];
+        int H_out = output_gradient.shape[2], W_out = output_gradient.shape[3];
+        int K = kernel_size;
+        std::fill(grad_kernels.data.begin(), grad_kernels.data.end(), 0.0f);
+        std::fill(grad_biases.data.begin(), grad_biases.data.end(), 0.0f);
+        Tensor input_gradient(last_input.shape);
         for (int n = 0; n < N; ++n) {
             for (int c_out = 0; c_out < out_channels; ++c_out) {
                 for (int h = 0; h < H_out; ++h) {
                     for (int w = 0; w < W_out; ++w) {
-                        float sum = biases.data[c_out];
-                        for (int c_in = 0; c_in < in_channels; ++c_in) {
-                            for (int kh = 0; kh < kernel_size; ++kh) {
-                                for (int kw = 0; kw < kernel_size; ++kw) {
-                                    int h_in = h * stride + kh - padding;
+                        float g = output_gradient.data[((n * out_channels + c_out) * H_out + h) * W_out + w];
+                        grad_biases.data[c_out] += g;
+                        for (int c_in = 0; c_in < C_in; ++c_in) {
+                            for (int kh = 0; kh < K; ++kh) {
+                                int h_in = h * stride + kh - padding;
+                                if (h_in < 0 || h_in >= H_in) continue;
+                                for (int kw = 0; kw < K; ++kw) {
                                     int w_in = w * stride + kw - padding;
-                                    if (h_in >= 0 && h_in < H_in && w_in >= 0 && w_in < W_in) {
-                                        int input_idx = n * C_in * H_in * W_in + c_in * H_in * W_in + h_in * W_in + w_in;
-                                        int kernel_idx = c_out * C_in * kernel_size * kernel_size + c_in * kernel_size * kernel_size + kh * kernel_size + kw;
-                                        sum += input.data[input_idx] * kernels.data[kernel_idx];
-                                    }
+                                    if (w_in < 0 || w_in >= W_in) continue;
+                                    int input_idx = ((n * C_in + c_in) * H_in + h_in) * W_in + w_in;
+                                    int kernel_idx = ((c_out * C_in + c_in) * K + kh) * K + kw;
+                                    grad_kernels.data[kernel_idx] += g * last_input.data[input_idx];
+                                    input_gradient.data[input_idx] += g * kernels.data[kernel_idx];
                                 }
                             }
                         }
-                        int output_idx = n * out_channels * H_out * W_out + c_out * H_out * W_out + h * W_out + w;
-                        output.data[output_idx] = sum;
                     }
                 }
             }
         }
-        return output;
+        return input_gradient;
     }
-    Tensor backward(const Tensor& output_gradient) override {
-        grad_kernels = Tensor(kernels.shape); 
-        grad_biases = Tensor(biases.shape);   
-        return Tensor(last_input.shape);      
+    std::unique_ptr<Layer> clone() const override {
+        auto new_layer = std::make_unique<Conv2DLayer>(in_channels, out_channels, kernel_size, stride, padding);
+        new_layer->kernels = this->kernels;
+        new_layer->biases = this->biases;
+        return new_layer;
+    }
+    void parameters(std::vector<ParamSpan>& spans) override {
+        spans.push_back({kernels.data.data(), grad_kernels.data.data(), static_cast<int>(kernels.data.size())});
+        spans.push_back({biases.data.data(), grad_biases.data.data(), static_cast<int>(biases.data.size())});
     }
 };
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 #include "Layer.h"
 #include <random>
+#include <algorithm>
 class DenseLayer : public Layer {
 public:
     Tensor weights;
@@ -18,6 +19,8 @@ public:
             w = distribution(generator);
         }
         bias = Tensor({1, output_size}); 
+        grad_weights = Tensor({input_size, output_size});
+        grad_bias = Tensor({1, output_size});
     }
     Tensor forward(const Tensor& input) override {
         last_input = input;
@@ -29,25 +32,20 @@ public:
         }
         return output;
     }
+    // Gradients are written into the buffers allocated by the constructor, so
+    // the spans handed out by parameters() stay valid.
     Tensor backward(const Tensor& output_gradient) override {
-        Tensor last_input_T({last_input.shape[1], last_input.shape[0]});
-        for(int i = 0; i < last_input.shape[0]; ++i)
-            for(int j = 0; j < last_input.shape[1]; ++j)
-                last_input_T.at(j,i) = last_input.at(i,j);
-        grad_weights = Tensor::dot(last_input_T, output_gradient);
-        grad_bias = Tensor({1, output_gradient.shape[1]});
-        for (int j = 0; j < output_gradient.shape[1]; ++j) {
-            float sum = 0.0f;
-            for (int i = 0; i < output_gradient.shape[0]; ++i) {
-                sum += output_gradient.at(i, j);
-            }
-            grad_bias.data[j] = sum;
+        int N = last_input.shape[0], in = weights.shape[0], out = weights.shape[1];
+        gemm(true, false, in, out, N, last_input.data.data(), in, output_gradient.data.data(), out,
+             grad_weights.data.data(), out, false);
+        std::fill(grad_bias.data.begin(), grad_bias.data.end(), 0.0f);
+        for (int n = 0; n < N; ++n) {
+            for (int j = 0; j < out; ++j) grad_bias.data[j] += output_gradient.data[n * out + j];
         }
-        Tensor weights_T({weights.shape[1], weights.shape[0]});
-        for(int i = 0; i < weights.shape[0]; ++i)
-            for(int j = 0; j < weights.shape[1]; ++j)
-                weights_T.at(j,i) = weights.at(i,j);
-        return Tensor::dot(output_gradient, weights_T);
+        Tensor input_gradient({N, in});
+        gemm(false, true, N, in, out, output_gradient.data.data(), out, weights.data.data(), out,
+             input_gradient.data.data(), in, false);
+        return input_gradient;
     }
     std::unique_ptr<Layer> clone() const override {
         auto new_layer = std::make_unique<DenseLayer>(weights.shape[0], weights.shape[1]);
@@ -55,4 +53,8 @@ public:
         new_layer->bias = this->bias;
         return new_layer;
     }
+    void parameters(std::vector<ParamSpan>& spans) override {
+        spans.push_back({weights.data.data(), grad_weights.data.data(), static_cast<int>(weights.data.size())});
+        spans.push_back({bias.data.data(), grad_bias.data.data(), static_cast<int>(bias.data.size())});
+    }
 };
\ No newline at end of file
@@ -0,0 +1,154 @@
+#pragma once
+#include "Sequential.h"
+#include "Loss.h"
+#include "../random.h"
+#include "../thread_pool.h"
+#include <vector>
+#include <atomic>
+#include <random>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <iostream>
+// Evolution strategies with antithetic Gaussian perturbations. Perturbation k
+// of generation g is the normal stream of Philox(seed, g) at [k * P, k * P + P),
+// so no population is ever stored: workers regenerate their noise in chunks
+// and the update is rebuilt from the same seeds and the scalar losses. Memory
+// is a few parameter-sized vectors plus one model per worker thread.
+class EvolutionStrategies {
+public:
+    int pair_count;
+    float sigma;
+    float learning_rate;
+    float beta1 = 0.9f;
+    float beta2 = 0.999f;
+    std::vector<float> losses; // losses[2k] for theta + sigma * eps_k, losses[2k + 1] for theta - sigma * eps_k
+private:
+    static constexpr int kChunk = 4096;
+    uint64_t seed;
+    std::vector<float> theta;
+    std::vector<float> first_moment;
+    std::vector<float> second_moment;
+    std::vector<float> gradient;
+    std::vector<float> pair_weights;
+    std::vector<Sequential> workers;
+    std::vector<std::vector<ParamSpan>> worker_spans;
+    std::vector<std::vector<float>> noise;
+    ThreadPool pool;
+public:
+    EvolutionStrategies(int pairs = 50, float noise_std = 0.05f, float lr = 0.02f,
+                        int threads = std::max(1u, std::thread::hardware_concurrency()),
+                        uint64_t seed = std::random_device{}())
+        : pair_count(std::max(1, pairs)), sigma(noise_std), learning_rate(lr), seed(seed), pool(std::max(1, threads)) {}
+    Sequential train(const Sequential& model_template, const Tensor& X_train, const Tensor& y_train, Loss& loss_fn, int generations) {
+        Sequential model(model_template);
+        model.get_parameters(theta);
+        first_moment.assign(theta.size(), 0.0f);
+        second_moment.assign(theta.size(), 0.0f);
+        gradient.assign(theta.size(), 0.0f);
+        losses.assign(2 * pair_count, 0.0f);
+        workers.assign(pool.size(), model_template);
+        worker_spans.clear();
+        for (auto& worker : workers) worker_spans.push_back(worker.parameters());
+        noise.assign(pool.size(), std::vector<float>(kChunk));
+        for (int gen = 0; gen < generations; ++gen) {
+            Philox stream(seed, gen);
+            evaluate_population(stream, X_train, y_train, loss_fn);
+            estimate_gradient(stream);
+            adam_step(gen + 1);
+            if (gen % 10 == 0) {
+                float mean = std::accumulate(losses.begin(), losses.end(), 0.0f) / losses.size();
+                std::cout << "Generation " << gen << ", Mean Loss: " << mean
+                          << ", Best Loss: " << *std::min_element(losses.begin(), losses.end()) << std::endl;
+            }
+        }
+        model.set_parameters(theta);
+        std::cout << "\n--- Training Finished ---" << std::endl;
+        std::cout << "Final Loss: " << loss_fn.calculate(model.forward(X_train), y_train) << std::endl;
+        return model;
+    }
+private:
+    // Each worker takes pairs off a shared counter. The mirrored point is
+    // 2 * theta - (theta + sigma * eps), so the noise is generated once per pair.
+    void evaluate_population(const Philox& stream, const Tensor& X, const Tensor& y, Loss& loss_fn) {
+        std::atomic<int> next{0};
+        std::vector<std::future<void>> done;
+        for (size_t w = 0; w < pool.size(); ++w) {
+            done.push_back(pool.submit([&, w](size_t) {
+                Sequential& model = workers[w];
+                float* buffer = noise[w].data();
+                for (int k = next++; k < pair_count; k = next++) {
+                    uint64_t base_offset = static_cast<uint64_t>(k) * theta.size();
+                    size_t position = 0;
+                    for (auto& span : worker_spans[w]) {
+                        for (int start = 0; start < span.size; start += kChunk) {
+                            int count = std::min(kChunk, span.size - start);
+                            stream.fill_normal(buffer, count, sigma, base_offset + position + start);
+                            const float* center = theta.data() + position + start;
+                            for (int i = 0; i < count; ++i) span.values[start + i] = center[i] + buffer[i];
+                        }
+                        position += span.size;
+                    }
+                    losses[2 * k] = loss_fn.calculate(model.forward(X), y);
+                    position = 0;
+                    for (auto& span : worker_spans[w]) {
+                        const float* center = theta.data() + position;
+                        for (int i = 0; i < span.size; ++i) span.values[i] = 2.0f * center[i] - span.values[i];
+                        position += span.size;
+                    }
+                    losses[2 * k + 1] = loss_fn.calculate(model.forward(X), y);
+                }
+            }));
+        }
+        for (auto& task : done) task.get();
+    }
+    // Centered-rank shaping: the lowest loss scores +0.5 and the highest -0.5,
+    // so the step does not depend on the scale of the loss. Each worker owns a
+    // range of parameters and replays every pair's noise over that range.
+    void estimate_gradient(const Philox& stream) {
+        int n = losses.size();
+        std::vector<int> order(n);
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](int a, int b) { return losses[a] > losses[b]; });
+        std::vector<float> utility(n);
+        for (int rank = 0; rank < n; ++rank) utility[order[rank]] = n > 1 ? float(rank) / (n - 1) - 0.5f : 0.0f;
+        pair_weights.resize(pair_count);
+        for (int k = 0; k < pair_count; ++k) pair_weights[k] = utility[2 * k] - utility[2 * k + 1];
+        size_t P = theta.size();
+        size_t chunks = (P + kChunk - 1) / kChunk;
+        size_t per_worker = (chunks + pool.size() - 1) / pool.size();
+        float scale = 1.0f / (n * sigma);
+        std::vector<std::future<void>> done;
+        for (size_t w = 0; w < pool.size(); ++w) {
+            size_t begin = std::min(P, w * per_worker * kChunk);
+            size_t end = std::min(P, (w + 1) * per_worker * kChunk);
+            if (begin == end) break;
+            done.push_back(pool.submit([&, w, begin, end](size_t) {
+                float* buffer = noise[w].data();
+                for (size_t start = begin; start < end; start += kChunk) {
+                    int count = std::min<size_t>(kChunk, end - start);
+                    float* g = gradient.data() + start;
+                    std::fill(g, g + count, 0.0f);
+                    for (int k = 0; k < pair_count; ++k) {
+                        float weight = pair_weights[k];
+                        if (weight == 0.0f) continue;
+                        stream.fill_normal(buffer, count, 1.0f, static_cast<uint64_t>(k) * P + start);
+                        for (int i = 0; i < count; ++i) g[i] += weight * buffer[i];
+                    }
+                    for (int i = 0; i < count; ++i) g[i] *= scale;
+                }
+            }));
+        }
+        for (auto& task : done) task.get();
+    }
+    // Adam ascent on the fitness estimate.
+    void adam_step(int t) {
+        float correction1 = 1.0f - std::pow(beta1, t);
+        float correction2 = 1.0f - std::pow(beta2, t);
+        for (size_t i = 0; i < theta.size(); ++i) {
+            first_moment[i] = beta1 * first_moment[i] + (1.0f - beta1) * gradient[i];
+            second_moment[i] = beta2 * second_moment[i] + (1.0f - beta2) * gradient[i] * gradient[i];
+            theta[i] += learning_rate * (first_moment[i] / correction1) / (std::sqrt(second_moment[i] / correction2) + 1e-8f);
+        }
+    }
+};
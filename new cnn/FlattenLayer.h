@@ -20,4 +20,7 @@ public:
         input_gradient.data = output_gradient.data;
         return input_gradient;
     }
+    std::unique_ptr<Layer> clone() const override {
+        return std::make_unique<FlattenLayer>(*this);
+    }
 };
\ No newline at end of file
@@ -1,41 +1,117 @@
 #pragma once
 #include "Sequential.h"
-#include "DenseLayer.h"
+#include "StackedSequential.h"
 #include "Loss.h"
 #include <vector>
 #include <algorithm>
 #include <random>
 #include <iostream>
+#include <cstdint>
+#include <numeric>
+#include <limits>
+#include <cmath>
 struct Individual {
     Sequential model;
     float fitness = 0.0f;
+    // Dropped out of a fitness race; its fitness covers only the first rows,
+    // so it ranks below every individual that saw the whole subsample.
+    bool stopped_early = false;
     bool operator<(const Individual& other) const {
+        if (stopped_early != other.stopped_early) return !stopped_early;
         return fitness > other.fitness; 
     }
 };
+// Uniform crossover over flat parameter spans: one random word picks the
+// parent for 32 consecutive values.
+inline void crossover_parameters(const std::vector<ParamSpan>& parent1, const std::vector<ParamSpan>& parent2,
+                                 const std::vector<ParamSpan>& child, std::default_random_engine& generator) {
+    std::uniform_int_distribution<uint32_t> word;
+    for (size_t s = 0; s < child.size(); ++s) {
+        const float* a = parent1[s].values;
+        const float* b = parent2[s].values;
+        float* out = child[s].values;
+        for (int start = 0; start < child[s].size; start += 32) {
+            uint32_t bits = word(generator);
+            int count = std::min(32, child[s].size - start);
+            for (int i = 0; i < count; ++i) {
+                out[start + i] = (bits >> i) & 1u ? a[start + i] : b[start + i];
+            }
+        }
+    }
+}
+// Adds uniform(-strength, strength) noise to each value with probability
+// rate. The gaps between hits are geometric, so the cost is proportional to
+// the number of mutated values rather than to the parameter count.
+inline void mutate_parameters(const std::vector<ParamSpan>& spans, float rate, float strength, std::default_random_engine& generator) {
+    if (rate <= 0.0f) return;
+    std::geometric_distribution<long> gap(std::min(rate, 1.0f));
+    std::uniform_real_distribution<float> dist(-strength, strength);
+    long skip = gap(generator);
+    for (const auto& span : spans) {
+        long i = skip;
+        for (; i < span.size; i += 1 + gap(generator)) span.values[i] += dist(generator);
+        skip = i - span.size;
+    }
+}
+struct GenerationStats {
+    int generation;
+    float best_loss;
+    float cutoff_loss;
+    int stopped_early;
+    long samples_evaluated;
+    float evaluation_fraction; // samples_evaluated / (population * rows of X_train)
+};
 class GeneticAlgorithmOptimizer {
 public:
     int population_size;
     float mutation_rate;
     float mutation_strength;
     int elitism_count; 
+    // Rows scored per generation, drawn from a reshuffled pass over the
+    // data; 0 uses every row.
+    int subsample_size;
+    // First racing mini-batch; the batch doubles each round. 0 disables racing.
+    int racing_batch;
+    // Standard errors by which an individual must trail the cutoff to be dropped.
+    float racing_confidence = 2.0f;
     std::vector<Individual> population;
+    std::vector<GenerationStats> history;
 private:
+    struct Race {
+        std::vector<float> losses;
+        double sum = 0.0;
+        bool alive = true;
+        double mean() const { return losses.empty() ? 0.0 : sum / losses.size(); }
+    };
     std::default_random_engine generator;
+    std::vector<int> order;
+    int cursor = 0;
+    std::vector<Race> races;
+    Tensor X_batch, y_batch, pred_row, true_row;
+    StackedSequential stacked;
+    std::vector<Sequential*> members;
+    std::vector<Tensor> predictions;
 public:
-    GeneticAlgorithmOptimizer(int pop_size = 50, float mut_rate = 0.05f, float mut_strength = 0.1f, int elite_count = 2)
-        : population_size(pop_size), mutation_rate(mut_rate), mutation_strength(mut_strength), elitism_count(elite_count) {
+    GeneticAlgorithmOptimizer(int pop_size = 50, float mut_rate = 0.05f, float mut_strength = 0.1f, int elite_count = 2,
+                              int subsample = 0, int race_batch = 0)
+        : population_size(pop_size), mutation_rate(mut_rate), mutation_strength(mut_strength), elitism_count(elite_count),
+          subsample_size(subsample), racing_batch(race_batch) {
         std::random_device rd;
         generator.seed(rd());
     }
     Sequential train(const Sequential& model_template, const Tensor& X_train, const Tensor& y_train, Loss& loss_fn, int generations) {
         initialize_population(model_template);
+        history.clear();
+        order.clear();
         for (int gen = 0; gen < generations; ++gen) {
-            calculate_fitness(X_train, y_train, loss_fn);
+            race_fitness(X_train, y_train, loss_fn, gen);
             std::sort(population.begin(), population.end());
             if (gen % 10 == 0) {
+                const GenerationStats& stats = history.back();
                 std::cout << "Generation " << gen << ", Best Fitness: " << population[0].fitness 
-                          << ", Loss: " << (1.0f / population[0].fitness) << std::endl;
+                          << ", Loss: " << (1.0f / population[0].fitness)
+                          << ", Stopped: " << stats.stopped_early
+                          << ", Evaluated: " << 100.0f * stats.evaluation_fraction << "%" << std::endl;
             }
             evolve_new_generation();
         }
@@ -59,7 +135,120 @@ private:
             Tensor y_pred = individual.model.forward(X);
             float loss = loss_fn.calculate(y_pred, y);
             individual.fitness = 1.0f / (loss + 1e-6f);
+            individual.stopped_early = false;
+        }
+    }
+    // Parents are drawn from the top half, so that is the cut racing protects.
+    int selection_cutoff() const {
+        return std::max(1, std::max(elitism_count, population_size / 2));
+    }
+    void next_subsample(int rows, int count) {
+        if (static_cast<int>(order.size()) != rows) {
+            order.resize(rows);
+            std::iota(order.begin(), order.end(), 0);
+            cursor = rows;
+        }
+        if (cursor + count > rows) {
+            std::shuffle(order.begin(), order.end(), generator);
+            cursor = 0;
+        }
+    }
+    static void gather_rows(const Tensor& source, const int* rows, int count, Tensor& out) {
+        std::vector<int> shape = source.shape;
+        shape[0] = count;
+        if (out.shape != shape) out = Tensor(shape);
+        int row_size = source.data.size() / source.shape[0];
+        for (int i = 0; i < count; ++i) {
+            std::copy_n(source.data.begin() + static_cast<size_t>(rows[i]) * row_size, row_size, out.data.begin() + static_cast<size_t>(i) * row_size);
+        }
+    }
+    void accumulate_row_losses(Race& race, const Tensor& pred, const Tensor& y, Loss& loss_fn) {
+        int count = pred.shape[0];
+        int pred_size = pred.data.size() / count, true_size = y.data.size() / count;
+        std::vector<int> pred_shape = pred.shape, true_shape = y.shape;
+        pred_shape[0] = true_shape[0] = 1;
+        if (pred_row.shape != pred_shape) pred_row = Tensor(pred_shape);
+        if (true_row.shape != true_shape) true_row = Tensor(true_shape);
+        for (int i = 0; i < count; ++i) {
+            std::copy_n(pred.data.begin() + i * pred_size, pred_size, pred_row.data.begin());
+            std::copy_n(y.data.begin() + i * true_size, true_size, true_row.data.begin());
+            float loss = loss_fn.calculate(pred_row, true_row);
+            race.losses.push_back(loss);
+            race.sum += loss;
+        }
+    }
+    // Every individual sees the same rows, so the comparison with the cutoff
+    // individual is paired, which is far tighter than comparing two means.
+    bool clearly_worse(const Race& race, const Race& reference) const {
+        int n = race.losses.size();
+        if (n < 2) return false;
+        double sum = 0.0, sum_sq = 0.0;
+        for (int i = 0; i < n; ++i) {
+            double d = race.losses[i] - reference.losses[i];
+            sum += d;
+            sum_sq += d * d;
         }
+        double mean = sum / n;
+        double error = std::sqrt(std::max(0.0, sum_sq / n - mean * mean) / (n - 1));
+        return mean > racing_confidence * error;
+    }
+    // Racing evaluation on this generation's subsample: the live individuals
+    // run the next, doubled mini-batch together as one stacked model, then
+    // any that trails the individual ranked at the selection cutoff by
+    // racing_confidence standard errors stops early. It keeps its partial
+    // mean as its fitness but sorts below every survivor.
+    void race_fitness(const Tensor& X, const Tensor& y, Loss& loss_fn, int gen) {
+        int rows = X.shape[0];
+        int samples = subsample_size > 0 ? std::min(subsample_size, rows) : rows;
+        next_subsample(rows, samples);
+        const int* subsample = order.data() + cursor;
+        cursor += samples;
+        races.assign(population.size(), Race());
+        int cutoff = selection_cutoff();
+        int done = 0, stopped = 0;
+        long evaluated = 0;
+        float cutoff_loss = 0.0f;
+        int batch = racing_batch > 0 ? std::min(racing_batch, samples) : samples;
+        while (done < samples) {
+            int end = std::min(samples, done == 0 ? batch : 2 * done);
+            gather_rows(X, subsample + done, end - done, X_batch);
+            gather_rows(y, subsample + done, end - done, y_batch);
+            std::vector<int> alive;
+            members.clear();
+            for (size_t i = 0; i < population.size(); ++i) {
+                if (!races[i].alive) continue;
+                alive.push_back(i);
+                members.push_back(&population[i].model);
+            }
+            stacked.pack(members);
+            stacked.forward(X_batch, predictions);
+            for (size_t a = 0; a < alive.size(); ++a) {
+                accumulate_row_losses(races[alive[a]], predictions[a], y_batch, loss_fn);
+            }
+            evaluated += static_cast<long>(end - done) * alive.size();
+            done = end;
+            if (static_cast<int>(alive.size()) <= cutoff) continue;
+            std::nth_element(alive.begin(), alive.begin() + cutoff - 1, alive.end(),
+                             [&](int a, int b) { return races[a].mean() < races[b].mean(); });
+            const Race& reference = races[alive[cutoff - 1]];
+            cutoff_loss = reference.mean();
+            if (done == samples) break;
+            for (auto& race : races) {
+                if (race.alive && race.mean() > cutoff_loss && clearly_worse(race, reference)) {
+                    race.alive = false;
+                    ++stopped;
+                }
+            }
+        }
+        float best_loss = std::numeric_limits<float>::max();
+        for (size_t i = 0; i < population.size(); ++i) {
+            float loss = races[i].mean();
+            population[i].fitness = 1.0f / (loss + 1e-6f);
+            population[i].stopped_early = !races[i].alive;
+            if (races[i].alive) best_loss = std::min(best_loss, loss);
+        }
+        history.push_back({gen, best_loss, cutoff_loss, stopped, evaluated,
+                           static_cast<float>(evaluated) / (static_cast<float>(population.size()) * rows)});
     }
     void evolve_new_generation() {
         std::vector<Individual> next_generation;
@@ -72,7 +261,7 @@ private:
             Individual& parent2 = select_parent();
             Individual offspring = crossover(parent1, parent2);
             mutate(offspring);
-            next_generation.push_back(offspring);
+            next_generation.push_back(std::move(offspring));
         }
         population = std::move(next_generation);
     }
@@ -80,48 +269,13 @@ private:
         int index = std::uniform_int_distribution<int>(0, population_size / 2 - 1)(generator);
         return population[index];
     }
-    Individual crossover(const Individual& parent1, const Individual& parent2) {
+    Individual crossover(Individual& parent1, Individual& parent2) {
         Individual child;
         child.model = Sequential(parent1.model); 
-        for (size_t i = 0; i < child.model.layers.size(); ++i) {
-            DenseLayer* child_dense = dynamic_cast<DenseLayer*>(child.model.layers[i].get());
-            if (child_dense) {
-                const DenseLayer* p1_dense = dynamic_cast<const DenseLayer*>(parent1.model.layers[i].get());
-                const DenseLayer* p2_dense = dynamic_cast<const DenseLayer*>(parent2.model.layers[i].get());
-                for(size_t j = 0; j < child_dense->weights.data.size(); ++j) {
-                    if (std::uniform_real_distribution<float>(0, 1)(generator) < 0.5f) {
-                        child_dense->weights.data[j] = p1_dense->weights.data[j];
-                    } else {
-                        child_dense->weights.data[j] = p2_dense->weights.data[j];
-                    }
-                }
-                for(size_t j = 0; j < child_dense->bias.data.size(); ++j) {
-                     if (std::uniform_real_distribution<float>(0, 1)(generator) < 0.5f) {
-                        child_dense->bias.data[j] = p1_dense->bias.data[j];
-                    } else {
-                        child_dense->bias.data[j] = p2_dense->bias.data[j];
-                    }
-                }
-            }
-        }
+        crossover_parameters(parent1.model.parameters(), parent2.model.parameters(), child.model.parameters(), generator);
         return child;
     }
     void mutate(Individual& individual) {
-        std::uniform_real_distribution<float> dist(-mutation_strength, mutation_strength);
-        for (auto& layer : individual.model.layers) {
-            DenseLayer* dense_layer = dynamic_cast<DenseLayer*>(layer.get());
-            if (dense_layer) {
-                for (auto& weight : dense_layer->weights.data) {
-                    if (std::uniform_real_distribution<float>(0, 1)(generator) < mutation_rate) {
-                        weight += dist(generator);
-                    }
-                }
-                for (auto& b : dense_layer->bias.data) {
-                    if (std::uniform_real_distribution<float>(0, 1)(generator) < mutation_rate) {
-                        b += dist(generator);
-                    }
-                }
-            }
-        }
+        mutate_parameters(individual.model.parameters(), mutation_rate, mutation_strength, generator);
     }
 };
\ No newline at end of file
@@ -0,0 +1,167 @@
+#pragma once
+#include "GeneticAlgorithmOptimizer.h"
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <algorithm>
+#include <iostream>
+// Steady-state GA over islands, one thread per island. Each birth picks two
+// parents by tournament, writes the child over the loser of a reverse
+// tournament and evaluates it at once, so no island ever waits for a
+// generation barrier. Every migration_interval births an island sends a
+// copy of its best individual to the next island in a ring.
+class IslandGeneticAlgorithm {
+public:
+    int population_size;
+    int island_count;
+    float mutation_rate;
+    float mutation_strength;
+    int tournament_size;
+    int migration_interval;
+    std::vector<std::vector<Individual>> islands;
+private:
+    struct Mailbox {
+        std::mutex mutex;
+        std::deque<Individual> migrants;
+        std::atomic<bool> pending{false};
+    };
+    struct Island {
+        std::vector<Individual>* population;
+        std::default_random_engine generator;
+        int best = 0;
+    };
+    unsigned seed;
+    std::vector<std::unique_ptr<Mailbox>> mailboxes;
+    std::atomic<float> best_fitness{0.0f};
+    std::mutex report_mutex;
+public:
+    IslandGeneticAlgorithm(int pop_size = 1000, int num_islands = std::max(1u, std::thread::hardware_concurrency()),
+                           float mut_rate = 0.05f, float mut_strength = 0.1f, int tournament = 3,
+                           int migration = 50, unsigned seed = std::random_device{}())
+        : population_size(pop_size), island_count(std::max(1, std::min(num_islands, pop_size / 2))),
+          mutation_rate(mut_rate), mutation_strength(mut_strength),
+          tournament_size(std::max(1, tournament)), migration_interval(std::max(1, migration)), seed(seed) {}
+    // generations counts births per individual: each island makes
+    // generations * island size births.
+    Sequential train(const Sequential& model_template, const Tensor& X_train, const Tensor& y_train, Loss& loss_fn, int generations) {
+        initialize_islands(model_template);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < island_count; ++i) {
+            threads.emplace_back([&, i] { run_island(i, X_train, y_train, loss_fn, generations); });
+        }
+        for (auto& thread : threads) thread.join();
+        const Individual* best = nullptr;
+        for (auto& island : islands) {
+            for (auto& individual : island) {
+                if (!best || individual.fitness > best->fitness) best = &individual;
+            }
+        }
+        std::cout << "\n--- Training Finished ---" << std::endl;
+        std::cout << "Final Best Loss: " << (1.0f / best->fitness) << std::endl;
+        return best->model;
+    }
+private:
+    void initialize_islands(const Sequential& model_template) {
+        islands.assign(island_count, {});
+        mailboxes.clear();
+        for (int i = 0; i < island_count; ++i) {
+            int size = population_size / island_count + (i < population_size % island_count ? 1 : 0);
+            islands[i].resize(size);
+            for (auto& individual : islands[i]) individual.model = Sequential(model_template);
+            mailboxes.push_back(std::make_unique<Mailbox>());
+        }
+        best_fitness = 0.0f;
+    }
+    static float evaluate(Individual& individual, const Tensor& X, const Tensor& y, Loss& loss_fn) {
+        Tensor y_pred = individual.model.forward(X);
+        float loss = loss_fn.calculate(y_pred, y);
+        individual.fitness = 1.0f / (loss + 1e-6f);
+        return individual.fitness;
+    }
+    int tournament(Island& island, bool best) {
+        int size = island.population->size();
+        std::uniform_int_distribution<int> pick(0, size - 1);
+        int winner = pick(island.generator);
+        for (int i = 1; i < tournament_size; ++i) {
+            int candidate = pick(island.generator);
+            float a = (*island.population)[candidate].fitness, b = (*island.population)[winner].fitness;
+            if (best ? a > b : a < b) winner = candidate;
+        }
+        return winner;
+    }
+    // Never replaces the island's best, so the island keeps its elite.
+    int victim(Island& island) {
+        int index = tournament(island, false);
+        if (index == island.best) index = (index + 1) % island.population->size();
+        return index;
+    }
+    void record(Island& island, int index) {
+        auto& population = *island.population;
+        if (population[index].fitness > population[island.best].fitness) island.best = index;
+        float global = best_fitness.load();
+        float fitness = population[index].fitness;
+        while (fitness > global && !best_fitness.compare_exchange_weak(global, fitness)) {}
+    }
+    void receive(Island& island, int id) {
+        Mailbox& mailbox = *mailboxes[id];
+        if (!mailbox.pending.load(std::memory_order_acquire)) return;
+        std::deque<Individual> arrived;
+        {
+            std::lock_guard<std::mutex> lock(mailbox.mutex);
+            arrived.swap(mailbox.migrants);
+            mailbox.pending = false;
+        }
+        for (auto& migrant : arrived) {
+            int index = victim(island);
+            (*island.population)[index] = std::move(migrant);
+            record(island, index);
+        }
+    }
+    void send(Island& island, int id) {
+        Mailbox& mailbox = *mailboxes[(id + 1) % island_count];
+        Individual migrant = (*island.population)[island.best];
+        std::lock_guard<std::mutex> lock(mailbox.mutex);
+        mailbox.migrants.push_back(std::move(migrant));
+        mailbox.pending.store(true, std::memory_order_release);
+    }
+    void run_island(int id, const Tensor& X, const Tensor& y, Loss& loss_fn, int generations) {
+        auto& population = islands[id];
+        Island island{&population, std::default_random_engine(seed + id), 0};
+        // Individuals start as copies of the template; all but one are mutated.
+        for (size_t i = 0; i < population.size(); ++i) {
+            if (i > 0) mutate(population[i], island.generator);
+            evaluate(population[i], X, y, loss_fn);
+            record(island, i);
+        }
+        long births = static_cast<long>(generations) * population.size();
+        for (long birth = 1; birth <= births; ++birth) {
+            receive(island, id);
+            int parent1 = tournament(island, true);
+            int parent2 = tournament(island, true);
+            int child = victim(island);
+            if (child == parent1 || child == parent2) continue;
+            crossover(population[parent1], population[parent2], population[child], island.generator);
+            mutate(population[child], island.generator);
+            evaluate(population[child], X, y, loss_fn);
+            record(island, child);
+            if (island_count > 1 && birth % migration_interval == 0) send(island, id);
+            if (id == 0 && birth % (10 * static_cast<long>(population.size())) == 0) {
+                float fitness = best_fitness.load();
+                std::lock_guard<std::mutex> lock(report_mutex);
+                std::cout << "Generation " << birth / population.size() << ", Best Fitness: " << fitness
+                          << ", Loss: " << (1.0f / fitness) << std::endl;
+            }
+        }
+    }
+    // Uniform crossover written into an existing individual, so a birth
+    // reuses the victim's buffers instead of allocating a new model.
+    void crossover(Individual& parent1, Individual& parent2, Individual& child, std::default_random_engine& generator) {
+        crossover_parameters(parent1.model.parameters(), parent2.model.parameters(), child.model.parameters(), generator);
+    }
+    void mutate(Individual& individual, std::default_random_engine& generator) {
+        mutate_parameters(individual.model.parameters(), mutation_rate, mutation_strength, generator);
+    }
+};
\ No newline at end of file
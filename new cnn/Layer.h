@@ -1,10 +1,22 @@
 #pragma once
 #include "Tensor.h"
 #include <memory>
+#include <vector>
+#include <cstdint>
+// A contiguous run of trainable values and the buffer backward() writes
+// their gradients into. Both stay valid for the lifetime of the layer.
+struct ParamSpan {
+    float* values;
+    float* grads;
+    int size;
+};
 class Layer {
 public:
     virtual ~Layer() = default;
     virtual Tensor forward(const Tensor& input) = 0;
     virtual Tensor backward(const Tensor& output_gradient) = 0;
     virtual std::unique_ptr<Layer> clone() const = 0;
+    virtual void parameters(std::vector<ParamSpan>& spans) {}
+    // Layers that draw random numbers take their stream from here.
+    virtual void seed(uint64_t seed, uint64_t stream) {}
 };
\ No newline at end of file
@@ -1,26 +1,78 @@
 #pragma once
 #include "Tensor.h"
+#include <cmath>
+#include <algorithm>
 class Loss {
 public:
     virtual ~Loss() = default;
     virtual float calculate(const Tensor& y_pred, const Tensor& y_true) = 0;
     virtual Tensor derivative(const Tensor& y_pred, const Tensor& y_true) = 0;
+    virtual float calculate_with_gradient(const Tensor& y_pred, const Tensor& y_true, Tensor& grad) {
+        grad = derivative(y_pred, y_true);
+        return calculate(y_pred, y_true);
+    }
+protected:
+    static void prepare_gradient(const Tensor& y_pred, Tensor& grad) {
+        if (grad.shape != y_pred.shape) grad = Tensor(y_pred.shape);
+    }
 };
 class MeanSquaredError : public Loss {
 public:
     float calculate(const Tensor& y_pred, const Tensor& y_true) override {
-        float sum = 0.0f;
-        for (size_t i = 0; i < y_pred.data.size(); ++i) {
-            float diff = y_pred.data[i] - y_true.data[i];
-            sum += diff * diff;
-        }
-        return sum / y_pred.data.size();
+        return mse_loss<float>(y_pred.data.data(), y_true.data.data(), y_pred.data.size(), nullptr);
     }
     Tensor derivative(const Tensor& y_pred, const Tensor& y_true) override {
-        Tensor grad = y_pred;
-        for (size_t i = 0; i < y_pred.data.size(); ++i) {
-            grad.data[i] = 2 * (y_pred.data[i] - y_true.data[i]) / y_pred.data.size();
-        }
+        Tensor grad(y_pred.shape);
+        mse_loss(y_pred.data.data(), y_true.data.data(), y_pred.data.size(), grad.data.data());
         return grad;
     }
+    float calculate_with_gradient(const Tensor& y_pred, const Tensor& y_true, Tensor& grad) override {
+        prepare_gradient(y_pred, grad);
+        return mse_loss(y_pred.data.data(), y_true.data.data(), y_pred.data.size(), grad.data.data());
+    }
+};
+// Takes logits of shape [N, C]; replaces SoftmaxLayer + a loss at the end
+// of a model. The gradient is (softmax - y) / N.
+class SoftmaxCrossEntropy : public Loss {
+public:
+    float calculate(const Tensor& y_pred, const Tensor& y_true) override {
+        return run(y_pred, y_true, nullptr);
+    }
+    Tensor derivative(const Tensor& y_pred, const Tensor& y_true) override {
+        Tensor grad(y_pred.shape);
+        run(y_pred, y_true, &grad);
+        return grad;
+    }
+    float calculate_with_gradient(const Tensor& y_pred, const Tensor& y_true, Tensor& grad) override {
+        prepare_gradient(y_pred, grad);
+        return run(y_pred, y_true, &grad);
+    }
+private:
+    float run(const Tensor& logits, const Tensor& y_true, Tensor* grad) {
+        assert(logits.shape.size() == 2);
+        return softmax_cross_entropy(logits.data.data(), y_true.data.data(), logits.shape[0], logits.shape[1],
+                                     grad ? grad->data.data() : nullptr);
+    }
+};
+// Takes logits; replaces SigmoidLayer + a loss. The gradient is
+// (sigmoid - y) / size.
+class BinaryCrossEntropyWithLogits : public Loss {
+public:
+    float calculate(const Tensor& y_pred, const Tensor& y_true) override {
+        return run(y_pred, y_true, nullptr);
+    }
+    Tensor derivative(const Tensor& y_pred, const Tensor& y_true) override {
+        Tensor grad(y_pred.shape);
+        run(y_pred, y_true, &grad);
+        return grad;
+    }
+    float calculate_with_gradient(const Tensor& y_pred, const Tensor& y_true, Tensor& grad) override {
+        prepare_gradient(y_pred, grad);
+        return run(y_pred, y_true, &grad);
+    }
+private:
+    float run(const Tensor& logits, const Tensor& y_true, Tensor* grad) {
+        return sigmoid_cross_entropy(logits.data.data(), y_true.data.data(), logits.data.size(),
+                                     grad ? grad->data.data() : nullptr);
+    }
 };
\ No newline at end of file
@@ -3,10 +3,12 @@
 #include <vector>
 #include <algorithm>
 #include <limits>
+#include <cstdint>
 class MaxPooling2DLayer : public Layer {
-private:
+public:
     int pool_size;
     int stride;
+private:
     Tensor last_input;
     std::vector<int> max_indices; 
 public:
@@ -20,29 +22,16 @@ public:
         int W_out = (W_in - pool_size) / stride + 1;
         Tensor output({N, C, H_out, W_out});
         max_indices.resize(output.data.size());
+        std::vector<uint8_t> offsets(output.data.size());
+        int in_image = C * H_in * W_in, out_image = C * H_out * W_out;
         for (int n = 0; n < N; ++n) {
-            for (int c = 0; c < C; ++c) {
-                for (int h = 0; h < H_out; ++h) {
-                    for (int w = 0; w < W_out; ++w) {
-                        float max_val = -std::numeric_limits<float>::infinity();
-                        int max_idx = -1;
-                        for (int ph = 0; ph < pool_size; ++ph) {
-                            for (int pw = 0; pw < pool_size; ++pw) {
-                                int h_in = h * stride + ph;
-                                int w_in = w * stride + pw;
-                                int input_idx = n * C * H_in * W_in + c * H_in * W_in + h_in * W_in + w_in;
-                                if (input.data[input_idx] > max_val) {
-                                    max_val = input.data[input_idx];
-                                    max_idx = input_idx;
-                                }
-                            }
-                        }
-                        int output_idx = n * C * H_out * W_out + c * H_out * W_out + h * W_out + w;
-                        output.data[output_idx] = max_val;
-                        max_indices[output_idx] = max_idx;
-                    }
-                }
-            }
+            max_pool_nchw(&input.data[n * in_image], C, H_in, W_in, pool_size, stride, 0,
+                          &output.data[n * out_image], &offsets[n * out_image], H_out, W_out);
+        }
+        for (int o = 0; o < static_cast<int>(output.data.size()); ++o) {
+            int w = o % W_out, h = o / W_out % H_out, plane = o / (H_out * W_out);
+            int h_in = h * stride + offsets[o] / pool_size, w_in = w * stride + offsets[o] % pool_size;
+            max_indices[o] = (plane * H_in + h_in) * W_in + w_in;
         }
         return output;
     }
@@ -57,4 +46,7 @@ public:
         }
         return input_gradient;
     }
+    std::unique_ptr<Layer> clone() const override {
+        return std::make_unique<MaxPooling2DLayer>(*this);
+    }
 };
\ No newline at end of file
@@ -0,0 +1,122 @@
+#pragma once
+#include "Sequential.h"
+#include "DenseLayer.h"
+#include "Conv2DLayer.h"
+#include "MaxPooling2DLayer.h"
+#include "FlattenLayer.h"
+#include "ReLULayer.h"
+#include "SigmoidLayer.h.h"
+#include " DropoutLayer.h"
+#include "../model.h"
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <limits>
+#include <stdexcept>
+// Reads and writes the Model<T> file format from model.h, so a network
+// trained with either API loads into the other. Dense weights are stored
+// [out][in] in the file and [in][out] here; convolution weights match.
+inline void add_activation(Sequential& model, const std::string& name) {
+    if (name == "relu") model.add(std::make_unique<ReLULayer>());
+    else if (name == "sigmoid") model.add(std::make_unique<SigmoidLayer>());
+    else if (name != "linear") throw std::runtime_error("load_model: activation " + name + " has no new cnn layer");
+}
+inline Sequential load_model(const std::string& filename) {
+    Model<float> source;
+    source.load(filename);
+    Sequential model;
+    bool spatial = false; // a Dense after Conv2D or MaxPool needs a Flatten here
+    for (size_t l = 0; l < source.layer_count(); ++l) {
+        Lay<float>& layer = source.layer(l);
+        std::string type = layer.getType();
+        std::stringstream saved;
+        layer.save(saved);
+        if (type == "Dense") {
+            auto& dense = static_cast<Dense<float>&>(layer);
+            int in = dense.input_size(), out = dense.output_size();
+            if (spatial) model.add(std::make_unique<FlattenLayer>());
+            auto converted = std::make_unique<DenseLayer>(in, out);
+            for (int i = 0; i < in; ++i) {
+                for (int j = 0; j < out; ++j) converted->weights.data[i * out + j] = dense.weights()[j * in + i];
+            }
+            converted->bias.data.assign(dense.biases().begin(), dense.biases().end());
+            model.add(std::move(converted));
+            add_activation(model, dense.activation_name());
+            spatial = false;
+        } else if (type == "Conv2D") {
+            int height, width, channels, kernel, filters, stride, padding;
+            saved >> height >> width >> channels >> kernel >> filters >> stride >> padding;
+            auto conv = std::make_unique<Conv2DLayer>(channels, filters, kernel, stride, padding);
+            for (auto& w : conv->kernels.data) saved >> w;
+            for (auto& b : conv->biases.data) saved >> b;
+            model.add(std::move(conv));
+            spatial = true;
+        } else if (type == "MaxPool") {
+            int height, width, channels, pool, stride, padding;
+            saved >> height >> width >> channels >> pool >> stride >> padding;
+            if (padding != 0) throw std::runtime_error("load_model: MaxPooling2DLayer has no padding");
+            model.add(std::make_unique<MaxPooling2DLayer>(pool, stride));
+            spatial = true;
+        } else if (type == "Flatten") {
+            model.add(std::make_unique<FlattenLayer>());
+            spatial = false;
+        } else if (type == "Activation") {
+            add_activation(model, static_cast<ActivationLayer<float>&>(layer).activation_name());
+        } else {
+            throw std::runtime_error("load_model: layer type " + type + " has no new cnn equivalent");
+        }
+    }
+    return model;
+}
+inline std::string activation_name(const Layer* layer) {
+    if (dynamic_cast<const ReLULayer*>(layer)) return "relu";
+    if (dynamic_cast<const SigmoidLayer*>(layer)) return "sigmoid";
+    return "";
+}
+// input_shape is one sample's shape, e.g. {C, H, W} or {features}; it is
+// run through the model once to find each layer's input size. A ReLU or
+// sigmoid right after a dense layer is folded into it; dropout is left out,
+// as it is the identity at inference.
+inline void save_model(Sequential& model, const std::vector<int>& input_shape, const std::string& filename) {
+    std::ofstream out(filename);
+    if (!out) throw std::runtime_error("Cannot open file for writing");
+    out.precision(std::numeric_limits<float>::max_digits10);
+    std::vector<int> shape = {1};
+    shape.insert(shape.end(), input_shape.begin(), input_shape.end());
+    Tensor x(shape);
+    for (size_t l = 0; l < model.layers.size(); ++l) {
+        Layer* layer = model.layers[l].get();
+        if (auto* dense = dynamic_cast<DenseLayer*>(layer)) {
+            int in = dense->weights.shape[0], outputs = dense->weights.shape[1];
+            std::string activation = l + 1 < model.layers.size() ? activation_name(model.layers[l + 1].get()) : "";
+            out << "Dense\n" << in << " " << outputs << "\n" << (activation.empty() ? "linear" : activation) << "\n";
+            for (int j = 0; j < outputs; ++j) {
+                for (int i = 0; i < in; ++i) out << dense->weights.data[i * outputs + j] << " ";
+            }
+            out << "\n";
+            for (float b : dense->bias.data) out << b << " ";
+            out << "\n";
+            if (!activation.empty()) {
+                x = layer->forward(x);
+                layer = model.layers[++l].get();
+            }
+        } else if (auto* conv = dynamic_cast<Conv2DLayer*>(layer)) {
+            out << "Conv2D\n" << x.shape[2] << " " << x.shape[3] << " " << conv->in_channels << " " << conv->kernel_size
+                << " " << conv->out_channels << " " << conv->stride << " " << conv->padding << "\n";
+            for (float w : conv->kernels.data) out << w << " ";
+            out << "\n";
+            for (float b : conv->biases.data) out << b << " ";
+            out << "\n";
+        } else if (auto* pool = dynamic_cast<MaxPooling2DLayer*>(layer)) {
+            out << "MaxPool\n" << x.shape[2] << " " << x.shape[3] << " " << x.shape[1] << " " << pool->pool_size
+                << " " << pool->stride << " " << 0 << "\n";
+        } else if (dynamic_cast<FlattenLayer*>(layer)) {
+            out << "Flatten\n" << x.data.size() << "\n";
+        } else if (!activation_name(layer).empty()) {
+            out << "Activation\n" << activation_name(layer) << "\n";
+        } else if (!dynamic_cast<DropoutLayer*>(layer)) {
+            throw std::runtime_error("save_model: layer " + std::to_string(l) + " has no Model file equivalent");
+        }
+        x = layer->forward(x);
+    }
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "Layer.h"
+#include "../activations.h"
 class ReLULayer : public Layer {
 private:
     Tensor last_input;
@@ -7,11 +8,7 @@ public:
     Tensor forward(const Tensor& input) override {
         last_input = input;
         Tensor output = input;
-        for (auto& val : output.data) {
-            if (val < 0) {
-                val = 0;
-            }
-        }
+        for (auto& val : output.data) val = Activations<float>::relu(val);
         return output;
     }
     Tensor backward(const Tensor& output_gradient) override {
@@ -1,6 +1,7 @@
 #pragma once
 #include "Layer.h"
 #include <vector>
+#include <algorithm>
 class Sequential {
 public:
     std::vector<std::unique_ptr<Layer>> layers;
@@ -13,6 +14,8 @@ public:
     Sequential& operator=(const Sequential& other) {
         if (this == &other) return *this; 
         layers.clear();
+        spans.clear();
+        span_layers.clear();
         for (const auto& layer : other.layers) {
             layers.push_back(layer->clone());
         }
@@ -23,6 +26,10 @@ public:
     void add(std::unique_ptr<Layer> layer) {
         layers.push_back(std::move(layer));
     }
+    // Gives every layer the stream numbered by its position under `seed`.
+    void seed(uint64_t seed) {
+        for (size_t i = 0; i < layers.size(); ++i) layers[i]->seed(seed, i);
+    }
     Tensor forward(const Tensor& input) {
         Tensor current_output = input;
         for (const auto& layer : layers) {
@@ -36,4 +43,40 @@ public:
             current_gradient = layers[i]->backward(current_gradient);
         }
     }
+private:
+    std::vector<ParamSpan> spans;
+    std::vector<const Layer*> span_layers;
+public:
+    // Spans in layer order; their concatenation is the model's flat
+    // parameter vector. Layers keep their buffers for life, so the list is
+    // rebuilt only when the layers themselves change.
+    const std::vector<ParamSpan>& parameters() {
+        bool same = span_layers.size() == layers.size();
+        for (size_t i = 0; same && i < layers.size(); ++i) same = span_layers[i] == layers[i].get();
+        if (!same) {
+            spans.clear();
+            span_layers.clear();
+            for (const auto& layer : layers) {
+                layer->parameters(spans);
+                span_layers.push_back(layer.get());
+            }
+        }
+        return spans;
+    }
+    int parameter_count() {
+        int count = 0;
+        for (const auto& span : parameters()) count += span.size;
+        return count;
+    }
+    void get_parameters(std::vector<float>& flat) {
+        flat.clear();
+        for (const auto& span : parameters()) flat.insert(flat.end(), span.values, span.values + span.size);
+    }
+    void set_parameters(const std::vector<float>& flat) {
+        size_t position = 0;
+        for (const auto& span : parameters()) {
+            std::copy(flat.begin() + position, flat.begin() + position + span.size, span.values);
+            position += span.size;
+        }
+    }
 };
\ No newline at end of file
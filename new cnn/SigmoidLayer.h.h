@@ -1,5 +1,6 @@
 #pragma once
 #include "Layer.h"
+#include "../activations.h"
 #include <cmath>
 class SigmoidLayer : public Layer {
 private:
@@ -8,7 +9,7 @@ public:
     Tensor forward(const Tensor& input) override {
         Tensor output = input;
         for (size_t i = 0; i < output.data.size(); ++i) {
-            output.data[i] = 1.0f / (1.0f + exp(-input.data[i]));
+            output.data[i] = Activations<float>::sigmoid(input.data[i]);
         }
         last_output = output; 
         return output;
@@ -21,4 +22,7 @@ public:
         }
         return input_gradient;
     }
+    std::unique_ptr<Layer> clone() const override {
+        return std::make_unique<SigmoidLayer>(*this);
+    }
 };
\ No newline at end of file
@@ -11,21 +11,7 @@ public:
     Tensor forward(const Tensor& input) override {
         assert(input.shape.size() == 2); 
         Tensor output({input.shape[0], input.shape[1]});
-        for (int i = 0; i < input.shape[0]; ++i) {
-            float max_val = input.at(i, 0);
-            for (int j = 1; j < input.shape[1]; ++j) {
-                if (input.at(i, j) > max_val) max_val = input.at(i, j);
-            }
-            float sum_exp = 0.0f;
-            for (int j = 0; j < input.shape[1]; ++j) {
-                float val = exp(input.at(i, j) - max_val);
-                output.at(i, j) = val;
-                sum_exp += val;
-            }
-            for (int j = 0; j < input.shape[1]; ++j) {
-                output.at(i, j) /= sum_exp;
-            }
-        }
+        softmax_rows(input.data.data(), input.shape[0], input.shape[1], output.data.data());
         last_output = output;
         return output;
     }
@@ -43,4 +29,7 @@ public:
         }
         return input_gradient;
     }
+    std::unique_ptr<Layer> clone() const override {
+        return std::make_unique<SoftmaxLayer>(*this);
+    }
 };
\ No newline at end of file
@@ -0,0 +1,167 @@
+#pragma once
+#include "Sequential.h"
+#include "DenseLayer.h"
+#include "ReLULayer.h"
+#include "SigmoidLayer.h.h"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+// Runs K models of one architecture on the same input as a single pass.
+// Models are grouped into tiles of kLanes, and each tile's activations are
+// stored [N][features][kLanes], so every dense layer is one batched GEMM
+// whose inner loop runs across the models of a tile and fills the SIMD
+// lanes even when the layers themselves are tiny. Layers other than dense,
+// ReLU and sigmoid fall back to each model's own forward() on its slice.
+class StackedSequential {
+public:
+    int model_count = 0;
+private:
+    enum Kind { Dense, ReLU, Sigmoid, Other };
+    struct Stage {
+        Kind kind;
+        int in = 0, out = 0;
+        AlignedVector<float> weights; // [tile][in][out][kLanes]
+        AlignedVector<float> bias;    // [tile][out][kLanes]
+    };
+    static constexpr int kLanes = 16;
+    std::vector<Sequential*> models;
+    int tiles = 0;
+    std::vector<Stage> stages;
+    AlignedVector<float> current, next;
+    std::vector<int> current_shape; // per-model shape, batch first
+    bool shared = true;             // current holds the common input once, not per model
+    static Kind kind_of(Layer* layer) {
+        if (dynamic_cast<DenseLayer*>(layer)) return Dense;
+        if (dynamic_cast<ReLULayer*>(layer)) return ReLU;
+        if (dynamic_cast<SigmoidLayer*>(layer)) return Sigmoid;
+        return Other;
+    }
+public:
+    // Copies the parameters of `members` into stacked buffers; call again
+    // whenever their weights change.
+    void pack(const std::vector<Sequential*>& members) {
+        models = members;
+        model_count = members.size();
+        tiles = (model_count + kLanes - 1) / kLanes;
+        stages.clear();
+        if (members.empty()) return;
+        const Sequential& first = *members[0];
+        for (const auto& model : members) {
+            if (model->layers.size() != first.layers.size()) throw std::runtime_error("StackedSequential: models differ in depth");
+        }
+        for (size_t l = 0; l < first.layers.size(); ++l) {
+            Stage stage;
+            Layer* layer = first.layers[l].get();
+            stage.kind = kind_of(layer);
+            // Other stages run each member's own layer, so only the kinds
+            // the stacked path computes itself have to agree.
+            for (const auto& model : members) {
+                if (kind_of(model->layers[l].get()) != stage.kind) throw std::runtime_error("StackedSequential: models differ in architecture");
+            }
+            if (stage.kind == Dense) {
+                auto* dense = static_cast<DenseLayer*>(layer);
+                stage.in = dense->weights.shape[0];
+                stage.out = dense->weights.shape[1];
+                size_t weight_count = static_cast<size_t>(stage.in) * stage.out;
+                stage.weights.assign(weight_count * tiles * kLanes, 0.0f);
+                stage.bias.assign(static_cast<size_t>(stage.out) * tiles * kLanes, 0.0f);
+                for (int k = 0; k < model_count; ++k) {
+                    auto* member = static_cast<DenseLayer*>(members[k]->layers[l].get());
+                    if (member->weights.shape != dense->weights.shape) throw std::runtime_error("StackedSequential: models differ in architecture");
+                    float* w = stage.weights.data() + (k / kLanes) * weight_count * kLanes + k % kLanes;
+                    float* b = stage.bias.data() + (k / kLanes) * stage.out * kLanes + k % kLanes;
+                    for (size_t i = 0; i < weight_count; ++i) w[i * kLanes] = member->weights.data[i];
+                    for (int j = 0; j < stage.out; ++j) b[j * kLanes] = member->bias.data[j];
+                }
+            }
+            stages.push_back(std::move(stage));
+        }
+    }
+    // outputs[k] is what members[k]->forward(input) would return.
+    void forward(const Tensor& input, std::vector<Tensor>& outputs) {
+        current = input.data;
+        current_shape = input.shape;
+        shared = true;
+        for (size_t l = 0; l < stages.size(); ++l) {
+            Stage& stage = stages[l];
+            switch (stage.kind) {
+            case Dense: dense(stage); break;
+            case ReLU: for (auto& v : current) v = Activations<float>::relu(v); break;
+            case Sigmoid: for (auto& v : current) v = Activations<float>::sigmoid(v); break;
+            case Other: fallback(l); break;
+            }
+        }
+        outputs.resize(model_count);
+        for (int k = 0; k < model_count; ++k) unstack(k, outputs[k]);
+    }
+    std::vector<Tensor> forward(const Tensor& input) {
+        std::vector<Tensor> outputs;
+        forward(input, outputs);
+        return outputs;
+    }
+private:
+    size_t positions() const {
+        size_t count = 1;
+        for (int dim : current_shape) count *= dim;
+        return count;
+    }
+    void unstack(int k, Tensor& out) const {
+        if (out.shape != current_shape) out = Tensor(current_shape);
+        if (shared) {
+            std::copy(current.begin(), current.end(), out.data.begin());
+            return;
+        }
+        const float* tile = current.data() + (k / kLanes) * out.data.size() * kLanes + k % kLanes;
+        for (size_t i = 0; i < out.data.size(); ++i) out.data[i] = tile[i * kLanes];
+    }
+    static void broadcast_add(float* __restrict y, float x, const float* __restrict w) {
+        for (int t = 0; t < kLanes; ++t) y[t] += x * w[t];
+    }
+    static void lanes_add(float* __restrict y, const float* __restrict x, const float* __restrict w) {
+        for (int t = 0; t < kLanes; ++t) y[t] += x[t] * w[t];
+    }
+    // out[n][j][t] = bias[j][t] + sum_i x[n][i][t] * W[i][j][t] for each tile;
+    // a tile's weights stay in cache across the whole batch.
+    void dense(const Stage& stage) {
+        int N = current_shape[0], in = stage.in, out = stage.out;
+        if (positions() != static_cast<size_t>(N) * in) throw std::runtime_error("StackedSequential: dense input size mismatch");
+        size_t in_tile = static_cast<size_t>(N) * in * kLanes, out_tile = static_cast<size_t>(N) * out * kLanes;
+        size_t weight_tile = static_cast<size_t>(in) * out * kLanes;
+        next.resize(out_tile * tiles);
+        for (int tile = 0; tile < tiles; ++tile) {
+            const float* weights = stage.weights.data() + tile * weight_tile;
+            const float* bias = stage.bias.data() + tile * static_cast<size_t>(out) * kLanes;
+            for (int n = 0; n < N; ++n) {
+                float* y = next.data() + tile * out_tile + static_cast<size_t>(n) * out * kLanes;
+                std::copy_n(bias, out * kLanes, y);
+                for (int i = 0; i < in; ++i) {
+                    const float* w = weights + static_cast<size_t>(i) * out * kLanes;
+                    if (shared) {
+                        float x = current[static_cast<size_t>(n) * in + i];
+                        for (int j = 0; j < out; ++j) broadcast_add(y + j * kLanes, x, w + j * kLanes);
+                    } else {
+                        const float* x = current.data() + tile * in_tile + (static_cast<size_t>(n) * in + i) * kLanes;
+                        for (int j = 0; j < out; ++j) lanes_add(y + j * kLanes, x, w + j * kLanes);
+                    }
+                }
+            }
+        }
+        current.swap(next);
+        current_shape = {N, out};
+        shared = false;
+    }
+    void fallback(size_t l) {
+        Tensor slice, result;
+        for (int k = 0; k < model_count; ++k) {
+            unstack(k, slice);
+            result = models[k]->layers[l]->forward(slice);
+            if (k == 0) next.assign(result.data.size() * tiles * kLanes, 0.0f);
+            float* tile = next.data() + (k / kLanes) * result.data.size() * kLanes + k % kLanes;
+            for (size_t i = 0; i < result.data.size(); ++i) tile[i * kLanes] = result.data[i];
+        }
+        current.swap(next);
+        current_shape = result.shape;
+        shared = false;
+    }
+};
@@ -4,10 +4,12 @@
 #include <numeric>
 #include <cassert>
 #include <stdexcept>
+#include "../kernels.h"
+#include "../aligned_allocator.h"
 class Tensor {
 public:
     std::vector<int> shape;
-    std::vector<float> data;
+    AlignedVector<float> data;
     std::vector<int> strides; 
     Tensor() = default;
     Tensor(const std::vector<int>& s) : shape(s) {
@@ -62,15 +64,8 @@ public:
         assert(a.shape.size() == 2 && b.shape.size() == 2);
         assert(a.shape[1] == b.shape[0]);
         Tensor result({a.shape[0], b.shape[1]});
-        for (int i = 0; i < a.shape[0]; ++i) {
-            for (int j = 0; j < b.shape[1]; ++j) {
-                float sum = 0.0f;
-                for (int k = 0; k < a.shape[1]; ++k) {
-                    sum += a.at(i, k) * b.at(k, j);
-                }
-                result.at(i, j) = sum;
-            }
-        }
+        gemm(false, false, a.shape[0], b.shape[1], a.shape[1],
+             a.data.data(), a.shape[1], b.data.data(), b.shape[1], result.data.data(), b.shape[1], false);
         return result;
     }
     void print() const {
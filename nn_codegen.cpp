@@ -0,0 +1,38 @@
+#include "codegen.h"
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+
+using namespace std;
+using T = float;
+
+int main(int argc, char** argv) {
+    if (argc < 5) {
+        cerr << "Usage: " << argv[0] << " <model_file> <output_header> <namespace> <input_dims...>\n"
+             << "  e.g. " << argv[0] << " model.txt mnist_net.h mnist_net 1 28 28\n";
+        return 1;
+    }
+
+    vector<size_t> input_shape;
+    for (int i = 4; i < argc; ++i) input_shape.push_back(stoul(argv[i]));
+
+    try {
+        Model<T> model;
+        model.load(argv[1]);
+        size_t folded = model.fold_batchnorm();
+        model.compile(input_shape);
+
+        ofstream out(argv[2]);
+        if (!out) throw runtime_error(string("cannot open ") + argv[2]);
+        CodeGenerator<T>().generate(model, input_shape, argv[3], out);
+
+        cout << "wrote " << argv[2] << " (" << model.layer_count() << " layers";
+        if (folded > 0) cout << ", " << folded << " BatchNorm folded";
+        cout << ")" << endl;
+    } catch (const exception& e) {
+        cerr << "nn_codegen: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
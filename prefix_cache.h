@@ -0,0 +1,45 @@
+#pragma once
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+// Stores the output of a model's frozen prefix per sample id, so later
+// epochs only run the trainable layers. Model::compile calls bind() with
+// the prefix output size and a fingerprint of the frozen weights; a cache
+// must drop its contents when either changes.
+template<typename T>
+class PrefixCache {
+public:
+    virtual ~PrefixCache() = default;
+    virtual void bind(size_t feature_size, uint64_t fingerprint) = 0;
+    virtual bool lookup(size_t sample, std::vector<T>& features) = 0;
+    virtual void store(size_t sample, const std::vector<T>& features) = 0;
+};
+
+template<typename T>
+class MemoryPrefixCache : public PrefixCache<T> {
+    std::unordered_map<size_t, std::vector<T>> m_features;
+    size_t m_feature_size = 0;
+    uint64_t m_fingerprint = 0;
+
+public:
+    void bind(size_t feature_size, uint64_t fingerprint) override {
+        if (feature_size != m_feature_size || fingerprint != m_fingerprint) {
+            m_features.clear();
+            m_feature_size = feature_size;
+            m_fingerprint = fingerprint;
+        }
+    }
+
+    bool lookup(size_t sample, std::vector<T>& features) override {
+        auto it = m_features.find(sample);
+        if (it == m_features.end()) return false;
+        features = it->second;
+        return true;
+    }
+
+    void store(size_t sample, const std::vector<T>& features) override {
+        m_features[sample] = features;
+    }
+};
@@ -0,0 +1,145 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <atomic>
+
+// Philox4x32-10 counter-based generator. Every block of four values is a
+// pure function of (seed, stream, index), so a buffer filled in one pass,
+// in chunks, or by several threads over disjoint ranges comes out
+// bit-identical, and streams never share state.
+class Philox {
+private:
+    uint32_t m_key[2];
+    uint32_t m_stream[2];
+    uint64_t m_position = 0;
+
+    static constexpr uint32_t kMul0 = 0xD2511F53;
+    static constexpr uint32_t kMul1 = 0xCD9E8D57;
+    static constexpr uint32_t kWeyl0 = 0x9E3779B9;
+    static constexpr uint32_t kWeyl1 = 0xBB67AE85;
+    static constexpr uint64_t kDefaultBit = uint64_t(1) << 63;
+
+public:
+    Philox(uint64_t seed = 0, uint64_t stream = 0)
+        : m_key{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)},
+          m_stream{static_cast<uint32_t>(stream), static_cast<uint32_t>(stream >> 32)} {}
+
+    // Process-wide defaults: a stream id for layers built outside a Model
+    // and for clones, and a seed for models never given one. The top bit
+    // keeps them apart from layer positions and from seeds a caller picks.
+    static uint64_t next_stream() {
+        static std::atomic<uint64_t> counter{0};
+        return counter.fetch_add(1, std::memory_order_relaxed) | kDefaultBit;
+    }
+
+    static uint64_t next_seed() {
+        static std::atomic<uint64_t> counter{0};
+        return counter.fetch_add(1, std::memory_order_relaxed) | kDefaultBit;
+    }
+
+    // Block number `index` of this stream.
+    void block(uint64_t index, uint32_t out[4]) const {
+        uint32_t c0 = static_cast<uint32_t>(index);
+        uint32_t c1 = static_cast<uint32_t>(index >> 32);
+        uint32_t c2 = m_stream[0];
+        uint32_t c3 = m_stream[1];
+        uint32_t k0 = m_key[0];
+        uint32_t k1 = m_key[1];
+
+        for (int round = 0; round < 10; ++round) {
+            uint64_t p0 = static_cast<uint64_t>(kMul0) * c0;
+            uint64_t p1 = static_cast<uint64_t>(kMul1) * c2;
+            uint32_t n0 = static_cast<uint32_t>(p1 >> 32) ^ c1 ^ k0;
+            uint32_t n2 = static_cast<uint32_t>(p0 >> 32) ^ c3 ^ k1;
+            c1 = static_cast<uint32_t>(p1);
+            c3 = static_cast<uint32_t>(p0);
+            c0 = n0;
+            c2 = n2;
+            k0 += kWeyl0;
+            k1 += kWeyl1;
+        }
+
+        out[0] = c0;
+        out[1] = c1;
+        out[2] = c2;
+        out[3] = c3;
+    }
+
+    // Raw 32-bit words [offset, offset + count) of the stream.
+    void fill_bits(uint32_t* out, size_t count, uint64_t offset) const {
+        uint32_t words[4];
+        size_t i = 0;
+        while (i < count) {
+            uint64_t position = offset + i;
+            block(position / 4, words);
+            for (size_t lane = position % 4; lane < 4 && i < count; ++lane, ++i) {
+                out[i] = words[lane];
+            }
+        }
+    }
+
+    // Uniform in [low, high) from the top 24 bits of each word.
+    template<typename T>
+    void fill_uniform(T* out, size_t count, T low, T high, uint64_t offset) const {
+        uint32_t words[4];
+        T scale = (high - low) / T(16777216);
+        size_t i = 0;
+        while (i < count) {
+            uint64_t position = offset + i;
+            block(position / 4, words);
+            for (size_t lane = position % 4; lane < 4 && i < count; ++lane, ++i) {
+                out[i] = low + static_cast<T>(words[lane] >> 8) * scale;
+            }
+        }
+    }
+
+    // Standard normal values scaled by stddev, by Box-Muller: positions 2k
+    // and 2k + 1 are the cosine and sine branches of block k.
+    template<typename T>
+    void fill_normal(T* out, size_t count, T stddev, uint64_t offset) const {
+        constexpr double kTwoPi = 6.283185307179586;
+        constexpr double kInv32 = 1.0 / 4294967296.0;
+        uint32_t words[4];
+        size_t i = 0;
+        while (i < count) {
+            uint64_t position = offset + i;
+            block(position / 2, words);
+            double radius = std::sqrt(-2.0 * std::log((words[0] + 1.0) * kInv32));
+            double angle = kTwoPi * (words[1] * kInv32);
+            if (position % 2 == 0) out[i++] = static_cast<T>(stddev * radius * std::cos(angle));
+            if (i < count) out[i++] = static_cast<T>(stddev * radius * std::sin(angle));
+        }
+    }
+
+    // out[i] = keep ? value : 0, with keep true with probability p.
+    template<typename T>
+    void fill_bernoulli(T* out, size_t count, double p, T value, uint64_t offset) const {
+        uint64_t threshold = static_cast<uint64_t>(p * 4294967296.0);
+        uint32_t words[4];
+        size_t i = 0;
+        while (i < count) {
+            uint64_t position = offset + i;
+            block(position / 4, words);
+            for (size_t lane = position % 4; lane < 4 && i < count; ++lane, ++i) {
+                out[i] = words[lane] < threshold ? value : T(0);
+            }
+        }
+    }
+
+    // Sequential use: each call consumes the next `count` words.
+    template<typename T>
+    void uniform(T* out, size_t count, T low, T high) {
+        fill_uniform(out, count, low, high, m_position);
+        m_position += count;
+    }
+
+    template<typename T>
+    void bernoulli(T* out, size_t count, double p, T value) {
+        fill_bernoulli(out, count, p, value, m_position);
+        m_position += count;
+    }
+
+    uint64_t position() const { return m_position; }
+    void seek(uint64_t position) { m_position = position; }
+};
@@ -0,0 +1,452 @@
+#pragma once
+#include "lay.h"
+#include "activations.h"
+#include "random.h"
+#include "kernels.h"
+#include <vector>
+#include <stdexcept>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <string>
+
+// Shared sequence machinery for gated recurrent layers. The input is a
+// [steps x features] sequence, the output the last hidden state or, with
+// return_sequences, all of them as [steps x hidden].
+//
+// Weights are stored input-major, [features][gates * hidden] and
+// [hidden][gates * hidden], so every product below is a row update over
+// contiguous gate values. The input projection of the whole sequence is
+// one GEMM before the time loop; each step then adds the recurrent
+// projection of all gates at once.
+//
+// Backward runs through the steps of the last forward call only. For
+// truncated BPTT over a long series, make the layer stateful and feed the
+// series in windows of `steps`: the final state of one window becomes the
+// (constant) initial state of the next. reset_state() starts a new series.
+template<typename T>
+class Recurrent : public Lay<T> {
+protected:
+    size_t m_gates;
+    size_t m_hidden = 0;
+    size_t m_steps = 0;
+    size_t m_input_size = 0;
+    bool m_return_sequences = false;
+    bool m_stateful = false;
+    // GRU keeps the recurrent pre-activations apart from the input ones,
+    // with their own bias, because its reset gate scales only them.
+    bool m_split_recurrent = false;
+
+    std::vector<T> m_input_weights;
+    std::vector<T> m_recurrent_weights;
+    std::vector<T> m_biases;
+    std::vector<T> m_recurrent_biases;
+    std::vector<T> m_dinput_weights;
+    std::vector<T> m_drecurrent_weights;
+    std::vector<T> m_dbiases;
+    std::vector<T> m_drecurrent_biases;
+
+    // Per-timestep buffers, allocated in compile().
+    std::vector<T> m_inputs;            // [steps][features]
+    std::vector<T> m_input_gates;       // [steps][gates * hidden]
+    std::vector<T> m_recurrent_gates;   // [steps][gates * hidden], split only
+    std::vector<T> m_activations;       // [steps][gates * hidden]
+    std::vector<T> m_states;            // [steps + 1][hidden]
+    std::vector<T> m_dinput_gates;
+    std::vector<T> m_drecurrent_gates;
+    std::vector<T> m_dstate;
+
+    bool m_has_state = false;
+    bool m_compiled = false;
+    Philox m_rng{0, Philox::next_stream()};
+
+    size_t width() const { return m_gates * m_hidden; }
+
+    static void axpy(T a, const T* x, T* y, size_t n) {
+        for (size_t i = 0; i < n; ++i) y[i] += a * x[i];
+    }
+
+    // Computes step t: reads the gate pre-activations and state t, writes
+    // state t + 1 and whatever backward needs.
+    virtual void cell_forward(size_t t) = 0;
+
+    // dstate holds dL/dh for state t + 1. Writes the pre-activation
+    // gradients of step t and leaves in dstate the part of dL/dh for state
+    // t that does not pass through the recurrent weights.
+    virtual void cell_backward(size_t t, T* dstate) = 0;
+
+    // Called before a forward pass; carry is true when the previous final
+    // state should become the initial one.
+    virtual void start_sequence(bool carry) {}
+    virtual void start_backward() {}
+    virtual void allocate_cell() {}
+    virtual void initialize_biases() {}
+
+    void initialize_weights() {
+        size_t gates = width();
+        m_input_weights.resize(m_input_size * gates);
+        m_recurrent_weights.resize(m_hidden * gates);
+        m_biases.assign(gates, 0);
+        if (m_split_recurrent) m_recurrent_biases.assign(gates, 0);
+
+        T input_range = std::sqrt(6.0 / (m_input_size + m_hidden));
+        T recurrent_range = std::sqrt(3.0 / m_hidden);
+        m_rng.fill_uniform(m_input_weights.data(), m_input_weights.size(),
+                           -input_range, input_range, 0);
+        m_rng.fill_uniform(m_recurrent_weights.data(), m_recurrent_weights.size(),
+                           -recurrent_range, recurrent_range, m_input_weights.size());
+        initialize_biases();
+    }
+
+    static void write_values(std::ostream& out, const std::vector<T>& values) {
+        for (const auto& v : values) out << v << " ";
+        out << "\n";
+    }
+
+    void read_values(std::istream& in, std::vector<T>& values, size_t size) {
+        values.resize(size);
+        for (size_t i = 0; i < size; ++i) {
+            if (!(in >> values[i])) {
+                throw std::runtime_error(this->getType() + ": weight data truncated");
+            }
+        }
+    }
+
+public:
+    Recurrent(size_t gates, size_t hidden, size_t steps, bool return_sequences)
+        : m_gates(gates), m_hidden(hidden), m_steps(steps),
+          m_return_sequences(return_sequences) {}
+
+    size_t hidden_size() const { return m_hidden; }
+    size_t steps() const { return m_steps; }
+
+    void set_stateful(bool stateful) {
+        m_stateful = stateful;
+        m_has_state = false;
+    }
+    bool stateful() const { return m_stateful; }
+    void reset_state() { m_has_state = false; }
+
+    void save(std::ostream& out) const override {
+        out << m_input_size << " " << m_hidden << " " << m_steps << " "
+            << m_return_sequences << " " << m_stateful << "\n";
+        write_values(out, m_input_weights);
+        write_values(out, m_recurrent_weights);
+        write_values(out, m_biases);
+        if (m_split_recurrent) write_values(out, m_recurrent_biases);
+    }
+
+    void load(std::istream& in) override {
+        in >> m_input_size >> m_hidden >> m_steps >> m_return_sequences >> m_stateful;
+        if (in.fail() || m_hidden == 0 || m_steps == 0) {
+            throw std::runtime_error(this->getType() + ": failed to read parameters");
+        }
+
+        size_t gates = width();
+        read_values(in, m_input_weights, m_input_size * gates);
+        read_values(in, m_recurrent_weights, m_hidden * gates);
+        read_values(in, m_biases, gates);
+        if (m_split_recurrent) read_values(in, m_recurrent_biases, gates);
+
+        m_has_state = false;
+        m_compiled = false;
+    }
+
+    std::vector<size_t> compile(const std::vector<size_t>& input_shape) override {
+        size_t size = shape_size(input_shape);
+        bool steps_match = input_shape.size() != 2 || input_shape[0] == m_steps;
+        if (m_hidden == 0 || m_steps == 0 || size % m_steps != 0 || !steps_match ||
+            (!m_input_weights.empty() && size != m_steps * m_input_size)) {
+            std::ostringstream oss;
+            oss << this->getType() << ": input of " << size << " values is not a sequence of "
+                << m_steps << " steps";
+            if (!m_input_weights.empty()) oss << " x " << m_input_size << " features";
+            throw std::runtime_error(oss.str());
+        }
+
+        if (m_input_weights.empty()) {
+            m_input_size = size / m_steps;
+            initialize_weights();
+        }
+        this->allocate_gradient(m_dinput_weights, m_input_weights.size());
+        this->allocate_gradient(m_drecurrent_weights, m_recurrent_weights.size());
+        this->allocate_gradient(m_dbiases, m_biases.size());
+        this->allocate_gradient(m_drecurrent_biases, m_recurrent_biases.size());
+
+        size_t gates = m_steps * width();
+        m_inputs.assign(m_steps * m_input_size, 0);
+        m_input_gates.assign(gates, 0);
+        m_recurrent_gates.assign(m_split_recurrent ? gates : 0, 0);
+        m_activations.assign(gates, 0);
+        m_states.assign((m_steps + 1) * m_hidden, 0);
+        m_dinput_gates.assign(gates, 0);
+        m_drecurrent_gates.assign(m_split_recurrent ? gates : 0, 0);
+        m_dstate.assign(m_hidden, 0);
+        allocate_cell();
+
+        m_has_state = false;
+        m_compiled = true;
+        if (m_return_sequences) return {m_steps, m_hidden};
+        return {m_hidden};
+    }
+
+    std::vector<T> forward(const std::vector<T>& input) override {
+        if (!m_compiled) compile({input.size()});
+
+        size_t gates = width();
+        bool carry = m_stateful && m_has_state;
+        if (carry) {
+            std::copy(m_states.end() - m_hidden, m_states.end(), m_states.begin());
+        } else {
+            std::fill(m_states.begin(), m_states.begin() + m_hidden, 0);
+        }
+        start_sequence(carry);
+        std::copy(input.begin(), input.end(), m_inputs.begin());
+
+        // Input projection for all steps: [steps x features] * [features x gates].
+        for (size_t t = 0; t < m_steps; ++t) {
+            std::copy(m_biases.begin(), m_biases.end(), m_input_gates.begin() + t * gates);
+        }
+        gemm(false, false, m_steps, gates, m_input_size, m_inputs.data(), m_input_size,
+             m_input_weights.data(), gates, m_input_gates.data(), gates, true);
+
+        for (size_t t = 0; t < m_steps; ++t) {
+            T* row;
+            if (m_split_recurrent) {
+                row = &m_recurrent_gates[t * gates];
+                std::copy(m_recurrent_biases.begin(), m_recurrent_biases.end(), row);
+            } else {
+                row = &m_input_gates[t * gates];
+            }
+            gemm(false, false, 1, gates, m_hidden, &m_states[t * m_hidden], m_hidden,
+                 m_recurrent_weights.data(), gates, row, gates, true);
+            cell_forward(t);
+        }
+        m_has_state = true;
+
+        if (m_return_sequences) return std::vector<T>(m_states.begin() + m_hidden, m_states.end());
+        return std::vector<T>(m_states.end() - m_hidden, m_states.end());
+    }
+
+    std::vector<T> backward(const std::vector<T>& output_gradient) override {
+        size_t gates = width();
+        bool input_grad = this->m_input_gradient_required;
+        bool param_grad = this->m_trainable && !m_dinput_weights.empty();
+        std::vector<T>& drecurrent = m_split_recurrent ? m_drecurrent_gates : m_dinput_gates;
+
+        std::fill(m_dstate.begin(), m_dstate.end(), 0);
+        start_backward();
+        for (size_t t = m_steps; t-- > 0;) {
+            if (m_return_sequences) {
+                axpy(1, &output_gradient[t * m_hidden], m_dstate.data(), m_hidden);
+            } else if (t == m_steps - 1) {
+                axpy(1, output_gradient.data(), m_dstate.data(), m_hidden);
+            }
+            cell_backward(t, m_dstate.data());
+
+            // The initial state is an input we do not differentiate.
+            if (t == 0) break;
+            gemm(false, true, 1, m_hidden, gates, &drecurrent[t * gates], gates,
+                 m_recurrent_weights.data(), gates, m_dstate.data(), m_hidden, true);
+        }
+
+        // Parameter gradients accumulate across calls until update_weights.
+        // Weight gradients are inputs^T * gate gradients over all steps.
+        if (param_grad) {
+            gemm(true, false, m_input_size, gates, m_steps, m_inputs.data(), m_input_size,
+                 m_dinput_gates.data(), gates, m_dinput_weights.data(), gates, true);
+            gemm(true, false, m_hidden, gates, m_steps, m_states.data(), m_hidden,
+                 drecurrent.data(), gates, m_drecurrent_weights.data(), gates, true);
+            for (size_t t = 0; t < m_steps; ++t) {
+                axpy(1, &m_dinput_gates[t * gates], m_dbiases.data(), gates);
+                if (m_split_recurrent) axpy(1, &drecurrent[t * gates], m_drecurrent_biases.data(), gates);
+            }
+        }
+
+        if (!input_grad) return {};
+
+        std::vector<T> input_gradient(m_steps * m_input_size);
+        gemm(false, true, m_steps, m_input_size, gates, m_dinput_gates.data(), gates,
+             m_input_weights.data(), gates, input_gradient.data(), m_input_size, false);
+        return input_gradient;
+    }
+
+    // Takes effect the next time weights are initialized.
+    void seed(uint64_t seed, uint64_t stream) override {
+        m_rng = Philox(seed, stream);
+    }
+
+    void reinitialize() override {
+        if (m_input_weights.empty()) return;
+        initialize_weights();
+        for (auto* grads : {&m_dinput_weights, &m_drecurrent_weights, &m_dbiases, &m_drecurrent_biases}) {
+            std::fill(grads->begin(), grads->end(), T(0));
+        }
+    }
+
+    void collect_params(std::vector<ParamRef<T>>& params) override {
+        bool frozen = m_dinput_weights.empty();
+        auto add = [&](std::vector<T>& values, std::vector<T>& grads) {
+            params.push_back({values.data(), frozen ? nullptr : grads.data(), values.size()});
+        };
+        add(m_input_weights, m_dinput_weights);
+        add(m_recurrent_weights, m_drecurrent_weights);
+        add(m_biases, m_dbiases);
+        if (m_split_recurrent) add(m_recurrent_biases, m_drecurrent_biases);
+    }
+
+    void update_weights(T learning_rate) override {
+        if (m_dinput_weights.empty()) return;
+        auto apply = [&](std::vector<T>& values, std::vector<T>& grads) {
+            for (size_t i = 0; i < values.size(); ++i) {
+                values[i] -= learning_rate * grads[i];
+                grads[i] = 0;
+            }
+        };
+        apply(m_input_weights, m_dinput_weights);
+        apply(m_recurrent_weights, m_drecurrent_weights);
+        apply(m_biases, m_dbiases);
+        if (m_split_recurrent) apply(m_recurrent_biases, m_drecurrent_biases);
+    }
+
+};
+
+// Gates in order input, forget, cell, output. The forget bias starts at 1.
+template<typename T>
+class LSTM : public Recurrent<T> {
+    std::vector<T> m_cells;        // [steps + 1][hidden]
+    std::vector<T> m_cell_tanh;    // [steps][hidden]
+    std::vector<T> m_dcell;
+
+    void allocate_cell() override {
+        m_cells.assign((this->m_steps + 1) * this->m_hidden, 0);
+        m_cell_tanh.assign(this->m_steps * this->m_hidden, 0);
+        m_dcell.assign(this->m_hidden, 0);
+    }
+
+    void initialize_biases() override {
+        std::fill(this->m_biases.begin() + this->m_hidden,
+                  this->m_biases.begin() + 2 * this->m_hidden, T(1));
+    }
+
+    void start_sequence(bool carry) override {
+        size_t hidden = this->m_hidden;
+        if (carry) {
+            std::copy(m_cells.end() - hidden, m_cells.end(), m_cells.begin());
+        } else {
+            std::fill(m_cells.begin(), m_cells.begin() + hidden, 0);
+        }
+    }
+
+    void start_backward() override {
+        std::fill(m_dcell.begin(), m_dcell.end(), 0);
+    }
+
+    void cell_forward(size_t t) override {
+        size_t hidden = this->m_hidden;
+        const T* pre = &this->m_input_gates[t * 4 * hidden];
+        T* act = &this->m_activations[t * 4 * hidden];
+        const T* cell = &m_cells[t * hidden];
+        T* next_cell = &m_cells[(t + 1) * hidden];
+        T* cell_tanh = &m_cell_tanh[t * hidden];
+        T* state = &this->m_states[(t + 1) * hidden];
+
+        for (size_t j = 0; j < hidden; ++j) {
+            T i = Activations<T>::sigmoid(pre[j]);
+            T f = Activations<T>::sigmoid(pre[hidden + j]);
+            T g = std::tanh(pre[2 * hidden + j]);
+            T o = Activations<T>::sigmoid(pre[3 * hidden + j]);
+            act[j] = i;
+            act[hidden + j] = f;
+            act[2 * hidden + j] = g;
+            act[3 * hidden + j] = o;
+            next_cell[j] = f * cell[j] + i * g;
+            cell_tanh[j] = std::tanh(next_cell[j]);
+            state[j] = o * cell_tanh[j];
+        }
+    }
+
+    void cell_backward(size_t t, T* dstate) override {
+        size_t hidden = this->m_hidden;
+        const T* act = &this->m_activations[t * 4 * hidden];
+        const T* cell = &m_cells[t * hidden];
+        const T* cell_tanh = &m_cell_tanh[t * hidden];
+        T* dgates = &this->m_dinput_gates[t * 4 * hidden];
+
+        for (size_t j = 0; j < hidden; ++j) {
+            T i = act[j], f = act[hidden + j], g = act[2 * hidden + j], o = act[3 * hidden + j];
+            T tc = cell_tanh[j];
+            T dcell = m_dcell[j] + dstate[j] * o * (1 - tc * tc);
+            dgates[j] = dcell * g * i * (1 - i);
+            dgates[hidden + j] = dcell * cell[j] * f * (1 - f);
+            dgates[2 * hidden + j] = dcell * i * (1 - g * g);
+            dgates[3 * hidden + j] = dstate[j] * tc * o * (1 - o);
+            m_dcell[j] = dcell * f;
+            dstate[j] = 0;
+        }
+    }
+
+public:
+    LSTM(size_t hidden, size_t steps, bool return_sequences = false)
+        : Recurrent<T>(4, hidden, steps, return_sequences) {}
+
+    LSTM() : Recurrent<T>(4, 0, 0, false) {}
+
+    std::string getType() const override { return "LSTM"; }
+};
+
+// Gates in order reset, update, candidate:
+//   n = tanh(W_n x + b_n + r * (U_n h + c_n)),  h' = (1 - z) * n + z * h
+template<typename T>
+class GRU : public Recurrent<T> {
+    void cell_forward(size_t t) override {
+        size_t hidden = this->m_hidden;
+        const T* in = &this->m_input_gates[t * 3 * hidden];
+        const T* rec = &this->m_recurrent_gates[t * 3 * hidden];
+        T* act = &this->m_activations[t * 3 * hidden];
+        const T* state = &this->m_states[t * hidden];
+        T* next = &this->m_states[(t + 1) * hidden];
+
+        for (size_t j = 0; j < hidden; ++j) {
+            T r = Activations<T>::sigmoid(in[j] + rec[j]);
+            T z = Activations<T>::sigmoid(in[hidden + j] + rec[hidden + j]);
+            T n = std::tanh(in[2 * hidden + j] + r * rec[2 * hidden + j]);
+            act[j] = r;
+            act[hidden + j] = z;
+            act[2 * hidden + j] = n;
+            next[j] = (1 - z) * n + z * state[j];
+        }
+    }
+
+    void cell_backward(size_t t, T* dstate) override {
+        size_t hidden = this->m_hidden;
+        const T* rec = &this->m_recurrent_gates[t * 3 * hidden];
+        const T* act = &this->m_activations[t * 3 * hidden];
+        const T* state = &this->m_states[t * hidden];
+        T* din = &this->m_dinput_gates[t * 3 * hidden];
+        T* drec = &this->m_drecurrent_gates[t * 3 * hidden];
+
+        for (size_t j = 0; j < hidden; ++j) {
+            T r = act[j], z = act[hidden + j], n = act[2 * hidden + j];
+            T dn = dstate[j] * (1 - z) * (1 - n * n);
+            T dz = dstate[j] * (state[j] - n) * z * (1 - z);
+            T dr = dn * rec[2 * hidden + j] * r * (1 - r);
+            din[j] = drec[j] = dr;
+            din[hidden + j] = drec[hidden + j] = dz;
+            din[2 * hidden + j] = dn;
+            drec[2 * hidden + j] = dn * r;
+            dstate[j] *= z;
+        }
+    }
+
+public:
+    GRU(size_t hidden, size_t steps, bool return_sequences = false)
+        : Recurrent<T>(3, hidden, steps, return_sequences) {
+        this->m_split_recurrent = true;
+    }
+
+    GRU() : GRU(0, 0, false) {}
+
+    std::string getType() const override { return "GRU"; }
+};
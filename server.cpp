@@ -0,0 +1,40 @@
+#include "inference_server.h"
+#include <iostream>
+#include <csignal>
+#include <string>
+
+using namespace std;
+using T = float;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        cerr << "Usage: " << argv[0]
+             << " <model_file> <input_size> [socket_path] [workers] [max_batch] [max_delay_us]\n";
+        return 1;
+    }
+
+    InferenceServer<T>::Config config;
+    if (argc > 3) config.socket_path = argv[3];
+    if (argc > 4) config.workers = stoul(argv[4]);
+    if (argc > 5) config.max_batch = stoul(argv[5]);
+    if (argc > 6) config.max_delay = chrono::microseconds(stoul(argv[6]));
+
+    signal(SIGINT, [](int) { stop_requested = 1; });
+    signal(SIGTERM, [](int) { stop_requested = 1; });
+
+    InferenceServer<T> server(argv[1], stoul(argv[2]), config);
+    server.start();
+    cout << "Serving " << argv[1] << " on " << config.socket_path
+         << " (workers: " << config.workers << ", max batch: " << config.max_batch
+         << ", max delay: " << config.max_delay.count() << " us)" << endl;
+
+    while (!stop_requested) {
+        this_thread::sleep_for(chrono::milliseconds(100));
+    }
+
+    server.report(cout);
+    server.stop();
+    return 0;
+}
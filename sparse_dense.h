@@ -0,0 +1,364 @@
+#pragma once
+#include "lay.h"
+#include "dense.h"
+#include "aligned_allocator.h"
+#include "activations.h"
+#include <vector>
+#include <string>
+#include <functional>
+#include <stdexcept>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstdint>
+
+enum class PruneMode { Unstructured, NM, Block };
+
+struct PruneConfig {
+    PruneMode mode = PruneMode::Unstructured;
+    // Fraction of weights (Unstructured) or of 1 x kSparseBlock blocks
+    // (Block) removed, smallest magnitude first.
+    double sparsity = 0.8;
+    // NM keeps the n largest of every m consecutive weights in a row.
+    size_t n = 2;
+    size_t m = 4;
+};
+
+constexpr size_t kSparseBlock = 8;
+
+// A pruned Dense layer. Weights are stored row by row as blocks of
+// m_block consecutive inputs: m_block = 1 is plain CSR (unstructured and
+// N:M pruning), m_block = kSparseBlock is 1x8 block-sparse, whose blocks
+// are contiguous in both the weights and the input and so vectorize.
+// The sparsity pattern is fixed; training only updates kept weights.
+template<typename T>
+class SparseDense : public Lay<T> {
+    size_t m_inputSize = 0;
+    size_t m_outputSize = 0;
+    size_t m_block = 1;
+    std::function<T(T)> m_activation;
+    std::function<T(T)> m_activation_deriv;
+    std::string m_activation_name = "linear";
+    // Blocks of row j are m_row_ptr[j] .. m_row_ptr[j + 1]; each starts at
+    // input column m_columns[b] and holds m_block values.
+    std::vector<uint32_t> m_row_ptr;
+    std::vector<uint32_t> m_columns;
+    std::vector<T> m_values;
+    std::vector<T> m_biases;
+    std::vector<T> m_dvalues;
+    std::vector<T> m_dbiases;
+    std::vector<T> m_last_input;
+    std::vector<T> m_last_preactivation;
+    std::vector<T> m_preact_gradient;
+    // forward_batch() works on transposed [features][count] blocks.
+    AlignedVector<T> m_batch_inputs;
+    AlignedVector<T> m_batch_outputs;
+    bool m_compiled = false;
+
+    template<size_t B>
+    void forward_rows(const T* input, T* preactivation) const {
+        for (size_t j = 0; j < m_outputSize; ++j) {
+            T lanes[B] = {};
+            for (uint32_t b = m_row_ptr[j]; b < m_row_ptr[j + 1]; ++b) {
+                const T* values = &m_values[b * B];
+                const T* x = input + m_columns[b];
+                for (size_t l = 0; l < B; ++l) lanes[l] += values[l] * x[l];
+            }
+            T sum = m_biases[j];
+            for (size_t l = 0; l < B; ++l) sum += lanes[l];
+            preactivation[j] = sum;
+        }
+    }
+
+    // Batched form: each kept weight scales a whole row of the transposed
+    // inputs into its output row, so the inner loop runs across samples.
+    template<size_t B>
+    void forward_batch_rows(const T* inputs, T* preactivations, size_t count) const {
+        for (size_t j = 0; j < m_outputSize; ++j) {
+            T* out = preactivations + j * count;
+            std::fill(out, out + count, m_biases[j]);
+            for (uint32_t b = m_row_ptr[j]; b < m_row_ptr[j + 1]; ++b) {
+                const T* values = &m_values[b * B];
+                for (size_t l = 0; l < B; ++l) {
+                    T weight = values[l];
+                    const T* x = inputs + (m_columns[b] + l) * count;
+                    for (size_t n = 0; n < count; ++n) out[n] += weight * x[n];
+                }
+            }
+        }
+    }
+
+    template<size_t B>
+    void backward_rows(const T* preact_gradient, T* dvalues, T* input_gradient) const {
+        for (size_t j = 0; j < m_outputSize; ++j) {
+            T grad = preact_gradient[j];
+            for (uint32_t b = m_row_ptr[j]; b < m_row_ptr[j + 1]; ++b) {
+                size_t column = m_columns[b];
+                if (dvalues) {
+                    T* dv = dvalues + b * B;
+                    const T* x = &m_last_input[column];
+                    for (size_t l = 0; l < B; ++l) dv[l] += grad * x[l];
+                }
+                if (input_gradient) {
+                    const T* values = &m_values[b * B];
+                    T* in = input_gradient + column;
+                    for (size_t l = 0; l < B; ++l) in[l] += values[l] * grad;
+                }
+            }
+        }
+    }
+
+    // keep[j * m_inputSize + i] marks surviving weights; for blocked
+    // storage every kSparseBlock-aligned run is kept or dropped as a whole.
+    void build(const T* weights, const std::vector<bool>& keep) {
+        m_row_ptr.assign(1, 0);
+        m_columns.clear();
+        m_values.clear();
+        for (size_t j = 0; j < m_outputSize; ++j) {
+            for (size_t i = 0; i < m_inputSize; i += m_block) {
+                size_t index = j * m_inputSize + i;
+                if (!keep[index]) continue;
+                m_columns.push_back(static_cast<uint32_t>(i));
+                m_values.insert(m_values.end(), weights + index, weights + index + m_block);
+            }
+            m_row_ptr.push_back(static_cast<uint32_t>(m_columns.size()));
+        }
+    }
+
+    // Marks all but the `removed` lowest-scoring entries.
+    static std::vector<bool> keep_largest(const std::vector<T>& scores, size_t removed) {
+        std::vector<size_t> order(scores.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::vector<bool> keep(scores.size(), true);
+        if (removed == 0) return keep;
+        removed = std::min(removed, scores.size());
+        std::nth_element(order.begin(), order.begin() + (removed - 1), order.end(),
+                         [&](size_t a, size_t b) { return scores[a] < scores[b]; });
+        for (size_t k = 0; k < removed; ++k) keep[order[k]] = false;
+        return keep;
+    }
+
+    void validate() const {
+        bool ok = (m_block == 1 || m_block == kSparseBlock) &&
+                  m_row_ptr.size() == m_outputSize + 1 && m_row_ptr.front() == 0 &&
+                  m_row_ptr.back() == m_columns.size() &&
+                  m_values.size() == m_columns.size() * m_block &&
+                  m_biases.size() == m_outputSize;
+        for (size_t j = 0; ok && j < m_outputSize; ++j) ok = m_row_ptr[j] <= m_row_ptr[j + 1];
+        for (size_t b = 0; ok && b < m_columns.size(); ++b) ok = m_columns[b] + m_block <= m_inputSize;
+        if (!ok) throw std::runtime_error("SparseDense: inconsistent sparse structure");
+    }
+
+public:
+    SparseDense(const Dense<T>& dense, const PruneConfig& config)
+        : m_inputSize(dense.input_size()), m_outputSize(dense.output_size()),
+          m_biases(dense.biases()) {
+        const AlignedVector<T>& weights = dense.weights();
+        if (weights.empty()) throw std::runtime_error("SparseDense: Dense layer has no weights yet");
+        if (config.sparsity < 0 || config.sparsity > 1) {
+            throw std::runtime_error("SparseDense: sparsity must be in [0, 1]");
+        }
+        set_activation(dense.activation_name());
+
+        std::vector<bool> keep(weights.size(), true);
+        if (config.mode == PruneMode::Unstructured) {
+            std::vector<T> scores(weights.size());
+            for (size_t i = 0; i < weights.size(); ++i) scores[i] = std::abs(weights[i]);
+            keep = keep_largest(scores, static_cast<size_t>(config.sparsity * scores.size()));
+        } else if (config.mode == PruneMode::NM) {
+            if (config.n == 0 || config.n > config.m) {
+                throw std::runtime_error("SparseDense: N:M pruning needs 0 < n <= m");
+            }
+            std::vector<size_t> group(config.m);
+            for (size_t j = 0; j < m_outputSize; ++j) {
+                const T* row = &weights[j * m_inputSize];
+                for (size_t start = 0; start < m_inputSize; start += config.m) {
+                    size_t count = std::min(config.m, m_inputSize - start);
+                    if (count <= config.n) continue;
+                    std::iota(group.begin(), group.begin() + count, start);
+                    std::nth_element(group.begin(), group.begin() + config.n, group.begin() + count,
+                                     [&](size_t a, size_t b) { return std::abs(row[a]) > std::abs(row[b]); });
+                    for (size_t k = config.n; k < count; ++k) keep[j * m_inputSize + group[k]] = false;
+                }
+            }
+        } else {
+            if (m_inputSize % kSparseBlock != 0) {
+                throw std::runtime_error("SparseDense: block pruning needs an input size divisible by " +
+                                         std::to_string(kSparseBlock));
+            }
+            m_block = kSparseBlock;
+            std::vector<T> scores(weights.size() / kSparseBlock);
+            for (size_t b = 0; b < scores.size(); ++b) {
+                T sum = 0;
+                for (size_t l = 0; l < kSparseBlock; ++l) {
+                    T w = weights[b * kSparseBlock + l];
+                    sum += w * w;
+                }
+                scores[b] = sum;
+            }
+            std::vector<bool> keep_blocks = keep_largest(scores, static_cast<size_t>(config.sparsity * scores.size()));
+            for (size_t i = 0; i < weights.size(); ++i) keep[i] = keep_blocks[i / kSparseBlock];
+        }
+
+        build(weights.data(), keep);
+    }
+
+    SparseDense() = default;
+
+    std::string getType() const override { return "SparseDense"; }
+
+    void set_activation(const std::string& name) {
+        m_activation_name = name;
+        Activations<T>::select(name, m_activation, m_activation_deriv);
+    }
+
+    size_t nonzeros() const { return m_values.size(); }
+    double density() const {
+        return m_inputSize != 0 && m_outputSize != 0
+            ? static_cast<double>(m_values.size()) / (m_inputSize * m_outputSize) : 0.0;
+    }
+
+    void save(std::ostream& out) const override {
+        out << m_inputSize << " " << m_outputSize << " " << m_block << " "
+            << m_columns.size() << "\n";
+        out << m_activation_name << "\n";
+        for (const auto& r : m_row_ptr) out << r << " ";
+        out << "\n";
+        for (const auto& c : m_columns) out << c << " ";
+        out << "\n";
+        for (const auto& v : m_values) out << v << " ";
+        out << "\n";
+        for (const auto& b : m_biases) out << b << " ";
+        out << "\n";
+    }
+
+    void load(std::istream& in) override {
+        size_t blocks = 0;
+        in >> m_inputSize >> m_outputSize >> m_block >> blocks;
+        in >> m_activation_name;
+        if (in.fail() || (m_block != 1 && m_block != kSparseBlock)) {
+            throw std::runtime_error("SparseDense: failed to read parameters");
+        }
+        set_activation(m_activation_name);
+
+        m_row_ptr.resize(m_outputSize + 1);
+        for (auto& r : m_row_ptr) in >> r;
+        m_columns.resize(blocks);
+        for (auto& c : m_columns) in >> c;
+        m_values.resize(blocks * m_block);
+        for (auto& v : m_values) in >> v;
+        m_biases.resize(m_outputSize);
+        for (auto& b : m_biases) in >> b;
+        if (in.fail()) throw std::runtime_error("SparseDense: data truncated");
+
+        validate();
+        m_compiled = false;
+    }
+
+    std::vector<size_t> compile(const std::vector<size_t>& input_shape) override {
+        size_t input_size = shape_size(input_shape);
+        if (input_size != m_inputSize) {
+            std::ostringstream oss;
+            oss << "SparseDense: input size mismatch. Expected: " << m_inputSize
+                << ", Got: " << input_size;
+            throw std::runtime_error(oss.str());
+        }
+
+        this->allocate_gradient(m_dvalues, m_values.size());
+        this->allocate_gradient(m_dbiases, m_biases.size());
+        m_last_input.resize(m_inputSize);
+        m_last_preactivation.resize(m_outputSize);
+        m_preact_gradient.resize(m_outputSize);
+        m_compiled = true;
+        return {m_outputSize};
+    }
+
+    std::vector<T> forward(const std::vector<T>& input) override {
+        if (!m_compiled) compile({input.size()});
+
+        if (!this->m_inference) std::copy(input.begin(), input.end(), m_last_input.begin());
+        if (m_block == kSparseBlock) {
+            forward_rows<kSparseBlock>(input.data(), m_last_preactivation.data());
+        } else {
+            forward_rows<1>(input.data(), m_last_preactivation.data());
+        }
+
+        std::vector<T> output(m_outputSize);
+        for (size_t j = 0; j < m_outputSize; ++j) output[j] = m_activation(m_last_preactivation[j]);
+        return output;
+    }
+
+    // Sparse x dense over the whole batch, as Dense::forward_batch does it:
+    // out^T = W * in^T on transposed blocks.
+    std::vector<T> forward_batch(const std::vector<T>& inputs, size_t count) override {
+        if (!m_compiled) compile({count ? inputs.size() / count : 0});
+        if (!this->m_inference) this->m_saved_batch = inputs;
+
+        m_batch_inputs.resize(m_inputSize * count);
+        m_batch_outputs.resize(m_outputSize * count);
+        for (size_t n = 0; n < count; ++n) {
+            for (size_t i = 0; i < m_inputSize; ++i) m_batch_inputs[i * count + n] = inputs[n * m_inputSize + i];
+        }
+        if (m_block == kSparseBlock) {
+            forward_batch_rows<kSparseBlock>(m_batch_inputs.data(), m_batch_outputs.data(), count);
+        } else {
+            forward_batch_rows<1>(m_batch_inputs.data(), m_batch_outputs.data(), count);
+        }
+
+        std::vector<T> outputs(count * m_outputSize);
+        for (size_t n = 0; n < count; ++n) {
+            for (size_t j = 0; j < m_outputSize; ++j) {
+                outputs[n * m_outputSize + j] = m_activation(m_batch_outputs[j * count + n]);
+            }
+        }
+        return outputs;
+    }
+
+    std::vector<T> backward(const std::vector<T>& output_gradient) override {
+        for (size_t j = 0; j < m_outputSize; ++j) {
+            m_preact_gradient[j] = output_gradient[j] * m_activation_deriv(m_last_preactivation[j]);
+        }
+
+        bool param_grad = this->m_trainable && !m_dvalues.empty();
+        if (param_grad) {
+            for (size_t j = 0; j < m_outputSize; ++j) m_dbiases[j] += m_preact_gradient[j];
+        }
+
+        std::vector<T> input_gradient;
+        if (this->m_input_gradient_required) input_gradient.assign(m_inputSize, 0);
+        T* dvalues = param_grad ? m_dvalues.data() : nullptr;
+        T* in_grad = input_gradient.empty() ? nullptr : input_gradient.data();
+        if (m_block == kSparseBlock) {
+            backward_rows<kSparseBlock>(m_preact_gradient.data(), dvalues, in_grad);
+        } else {
+            backward_rows<1>(m_preact_gradient.data(), dvalues, in_grad);
+        }
+        return input_gradient;
+    }
+
+    // The sparsity pattern came from the pruned weights; there is nothing
+    // to draw it from again.
+    void reinitialize() override {
+        throw std::runtime_error("SparseDense: cannot reinitialize a pruned layer");
+    }
+
+    void collect_params(std::vector<ParamRef<T>>& params) override {
+        bool frozen = m_dvalues.empty();
+        params.push_back({m_values.data(), frozen ? nullptr : m_dvalues.data(), m_values.size()});
+        params.push_back({m_biases.data(), frozen ? nullptr : m_dbiases.data(), m_biases.size()});
+    }
+
+    void update_weights(T learning_rate) override {
+        if (m_dvalues.empty()) return;
+        for (size_t i = 0; i < m_values.size(); ++i) {
+            m_values[i] -= learning_rate * m_dvalues[i];
+            m_dvalues[i] = 0;
+        }
+        for (size_t i = 0; i < m_biases.size(); ++i) {
+            m_biases[i] -= learning_rate * m_dbiases[i];
+            m_dbiases[i] = 0;
+        }
+    }
+};
@@ -0,0 +1,156 @@
+#include "model.h"
+#include "random.h"
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+using T = float;
+
+const size_t kInputs = 32, kHidden = 24, kOutputs = 5;
+
+unique_ptr<Model<T>> make_model() {
+    auto model = make_unique<Model<T>>();
+    model->set_seed(9);
+    model->add(make_unique<Dense<T>>(kHidden, "relu"));
+    model->add(make_unique<Dense<T>>(kOutputs));
+    model->compile({kInputs});
+    // Biases start at zero; give them values so they are checked too.
+    vector<ParamRef<T>> params = model->params();
+    for (size_t i = 1; i < params.size(); i += 2) {
+        Philox(13, i).fill_uniform(params[i].values, params[i].size, T(-0.5), T(0.5), 0);
+    }
+    return model;
+}
+
+// Which weights of a kHidden x kInputs layer a SparseDense kept, read
+// back from its saved sparse structure.
+vector<bool> kept_mask(const Lay<T>& layer) {
+    ostringstream out;
+    layer.save(out);
+    istringstream in(out.str());
+    size_t inputs, outputs, block, blocks;
+    string activation;
+    in >> inputs >> outputs >> block >> blocks >> activation;
+    vector<uint32_t> row_ptr(outputs + 1), columns(blocks);
+    for (auto& r : row_ptr) in >> r;
+    for (auto& c : columns) in >> c;
+
+    vector<bool> keep(inputs * outputs, false);
+    for (size_t j = 0; j < outputs; ++j) {
+        for (uint32_t b = row_ptr[j]; b < row_ptr[j + 1]; ++b) {
+            for (size_t l = 0; l < block; ++l) keep[j * inputs + columns[b] + l] = true;
+        }
+    }
+    return keep;
+}
+
+// Scores are |w| per weight, or the squared norm of each 1 x kSparseBlock
+// block; no removed score may exceed a kept one within a group.
+bool largest_kept(const vector<T>& weights, const vector<bool>& keep, const PruneConfig& config) {
+    size_t unit = config.mode == PruneMode::Block ? kSparseBlock : 1;
+    size_t group = config.mode == PruneMode::NM ? config.m : weights.size();
+    for (size_t start = 0; start < weights.size(); start += group) {
+        T lowest_kept = numeric_limits<T>::max(), highest_removed = 0;
+        size_t kept = 0;
+        for (size_t i = start; i < start + group; i += unit) {
+            T score = 0;
+            for (size_t l = 0; l < unit; ++l) score += unit == 1 ? std::abs(weights[i]) : weights[i + l] * weights[i + l];
+            if (keep[i]) {
+                lowest_kept = min(lowest_kept, score);
+                ++kept;
+            } else {
+                highest_removed = max(highest_removed, score);
+            }
+        }
+        if (highest_removed > lowest_kept) return false;
+        if (config.mode == PruneMode::NM && kept != config.n) return false;
+    }
+    return true;
+}
+
+bool check(const string& name, const PruneConfig& config, double expected_density) {
+    auto pruned = make_model();
+    auto masked = make_model();
+    const auto& dense = static_cast<Dense<T>&>(pruned->layer(0));
+    vector<T> weights(dense.weights().begin(), dense.weights().end());
+
+    double density = pruned->prune(0, config);
+    vector<bool> keep = kept_mask(pruned->layer(0));
+    size_t kept = 0;
+    for (bool k : keep) kept += k;
+
+    bool ok = true;
+    if (pruned->layer(0).getType() != "SparseDense") {
+        cerr << name << ": layer 0 is " << pruned->layer(0).getType() << endl;
+        ok = false;
+    }
+    if (std::abs(density - expected_density) > 1e-9 ||
+        std::abs(static_cast<double>(kept) / weights.size() - expected_density) > 1e-9) {
+        cerr << name << ": density " << density << " with " << kept << " weights kept, expected "
+             << expected_density << endl;
+        ok = false;
+    }
+    if (!largest_kept(weights, keep, config)) {
+        cerr << name << ": a removed weight outranks a kept one" << endl;
+        ok = false;
+    }
+
+    // The same model with the removed weights zeroed in the Dense layer.
+    ParamRef<T> masked_weights = masked->params()[0];
+    for (size_t i = 0; i < masked_weights.size; ++i) {
+        if (!keep[i]) masked_weights.values[i] = 0;
+    }
+
+    // The pruned model again after a save/load round trip.
+    string file = "sparse_test_" + name + ".txt";
+    pruned->save(file);
+    Model<T> reloaded;
+    reloaded.load(file);
+    reloaded.compile({kInputs});
+    std::remove(file.c_str());
+
+    Philox rng(21);
+    vector<vector<T>> inputs(16, vector<T>(kInputs));
+    vector<vector<T>> expected(inputs.size());
+    for (size_t n = 0; n < inputs.size(); ++n) {
+        rng.fill_uniform(inputs[n].data(), kInputs, T(-1), T(1), n * 64);
+        expected[n] = masked->forward(inputs[n]);
+    }
+    T worst = 0;
+    auto compare = [&](size_t n, const vector<T>& output) {
+        for (size_t i = 0; i < expected[n].size(); ++i) worst = max(worst, std::abs(output[i] - expected[n][i]));
+    };
+    for (Model<T>* model : {pruned.get(), &reloaded}) {
+        for (size_t n = 0; n < inputs.size(); ++n) compare(n, model->forward(inputs[n]));
+        vector<vector<T>> batch = model->forward_batch(inputs);
+        for (size_t n = 0; n < inputs.size(); ++n) compare(n, batch[n]);
+    }
+    if (!(worst <= T(1e-5))) {
+        cerr << name << ": output (per sample, batched or reloaded) differs from the masked Dense by "
+             << worst << endl;
+        ok = false;
+    }
+    cout << name << ": density " << density << ", max difference " << worst << endl;
+    return ok;
+}
+
+int main() {
+    PruneConfig unstructured;
+    unstructured.sparsity = 0.75;
+    PruneConfig nm;
+    nm.mode = PruneMode::NM;
+    PruneConfig block;
+    block.mode = PruneMode::Block;
+    block.sparsity = 0.5;
+
+    bool ok = check("unstructured", unstructured, 0.25);
+    ok = check("2:4", nm, 0.5) && ok;
+    ok = check("block", block, 0.5) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <algorithm>
+
+// Fixed set of worker threads draining a FIFO queue. Tasks receive the
+// index of the worker running them, so callers can keep per-worker
+// scratch state without locking.
+class ThreadPool {
+    std::vector<std::thread> m_workers;
+    std::deque<std::packaged_task<void(size_t)>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_stopping = false;
+
+    void worker_loop(size_t worker) {
+        for (;;) {
+            std::packaged_task<void(size_t)> task;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cv.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+                if (m_tasks.empty()) return;
+                task = std::move(m_tasks.front());
+                m_tasks.pop_front();
+            }
+            task(worker);
+        }
+    }
+
+public:
+    explicit ThreadPool(size_t threads = std::max(1u, std::thread::hardware_concurrency())) {
+        threads = std::max<size_t>(threads, 1);
+        for (size_t i = 0; i < threads; ++i) {
+            m_workers.emplace_back(&ThreadPool::worker_loop, this, i);
+        }
+    }
+
+    // Finishes the queued tasks before joining.
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_cv.notify_all();
+        for (auto& worker : m_workers) worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return m_workers.size(); }
+
+    // Exceptions thrown by the task are rethrown by future::get().
+    std::future<void> submit(std::function<void(size_t worker)> task) {
+        std::packaged_task<void(size_t)> packaged(std::move(task));
+        std::future<void> result = packaged.get_future();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tasks.push_back(std::move(packaged));
+        }
+        m_cv.notify_one();
+        return result;
+    }
+};
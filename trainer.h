@@ -1,13 +1,71 @@
 #pragma once
 #include "model.h"
+#include "loss.h"
+#include <cmath>
+#include <algorithm>
+
+template<typename T>
+struct TrainerConfig {
+    // Samples whose gradients are summed before each weight update.
+    size_t accumulation_steps = 1;
+    // Linear scaling rule: multiply the learning rate by accumulation_steps.
+    bool scale_learning_rate = false;
+    // Updates over which the learning rate ramps up linearly from zero.
+    size_t warmup_steps = 0;
+    // LARS: scale each parameter tensor's step by
+    // trust_coefficient * ||w|| / ||g||, so layers with small gradients
+    // relative to their weights are not left behind at large batch sizes.
+    bool layerwise_scaling = false;
+    T trust_coefficient = T(0.001);
+};
 
 template<typename T>
 class BackwardTrainer {
     Model<T>& model;
     T learning_rate;
+    TrainerConfig<T> config;
+    std::vector<T> output_gradient;
+    size_t accumulated = 0;
+    size_t updates = 0;
+
+    // Averages the accumulated gradients, applies the trust ratios and
+    // hands them to the layers, which apply and zero them.
+    void apply_update() {
+        T inv_count = T(1) / static_cast<T>(accumulated);
+        for (auto& param : model.params()) {
+            if (!param.grads) continue;
+            T scale = inv_count;
+            if (config.layerwise_scaling) {
+                T weight_norm = 0;
+                T grad_norm = 0;
+                for (size_t i = 0; i < param.size; ++i) {
+                    weight_norm += param.values[i] * param.values[i];
+                    grad_norm += param.grads[i] * param.grads[i];
+                }
+                weight_norm = std::sqrt(weight_norm);
+                grad_norm = std::sqrt(grad_norm) * inv_count;
+                if (weight_norm > 0 && grad_norm > 0) {
+                    scale *= config.trust_coefficient * weight_norm / grad_norm;
+                }
+            }
+            for (size_t i = 0; i < param.size; ++i) param.grads[i] *= scale;
+        }
+
+        model.update_weights(current_learning_rate());
+        accumulated = 0;
+        ++updates;
+    }
+
+    void accumulate(size_t samples = 1) {
+        accumulated += samples;
+        if (accumulated >= config.accumulation_steps) apply_update();
+    }
 
 public:
-    BackwardTrainer(Model<T>& model, T lr) : model(model), learning_rate(lr) {}
+    BackwardTrainer(Model<T>& model, T lr, const TrainerConfig<T>& config = TrainerConfig<T>())
+        : model(model), learning_rate(lr), config(config) {
+        if (this->config.accumulation_steps == 0) this->config.accumulation_steps = 1;
+    }
 
     void train_step(const std::vector<T>& input, 
                    const std::vector<T>& target,
@@ -22,6 +80,81 @@ public:
         model.backward(output_gradient);
         
        
-        model.update_weights(learning_rate);
+        accumulate();
+    }
+
+    // Returns the loss of the prediction made before the update. The
+    // gradient buffer is reused across calls. Weights change only every
+    // accumulation_steps calls.
+    T train_step(const std::vector<T>& input,
+                 const std::vector<T>& target,
+                 const LossFunction<T>& loss) {
+        auto output = model.forward(input);
+        T value = loss.compute(output, target, output_gradient);
+        model.backward(output_gradient);
+        accumulate();
+        return value;
+    }
+
+    // Same, but lets the model reuse the cached output of its frozen
+    // prefix for this sample (see Model::set_prefix_cache).
+    T train_step(size_t sample,
+                 const std::vector<T>& input,
+                 const std::vector<T>& target,
+                 const LossFunction<T>& loss) {
+        auto output = model.forward(sample, input);
+        T value = loss.compute(output, target, output_gradient);
+        model.backward(output_gradient);
+        accumulate();
+        return value;
+    }
+
+    // Trains on a batch at once through Model::forward_batch, so layers
+    // that depend on the whole batch (BatchNorm) see all of it. Counts as
+    // inputs.size() samples towards accumulation_steps. Returns the mean loss.
+    T train_batch(const std::vector<std::vector<T>>& inputs,
+                  const std::vector<std::vector<T>>& targets,
+                  const LossFunction<T>& loss) {
+        if (inputs.empty()) return T(0);
+        auto outputs = model.forward_batch(inputs);
+        std::vector<std::vector<T>> gradients(outputs.size());
+        T total = 0;
+        for (size_t n = 0; n < outputs.size(); ++n) total += loss.compute(outputs[n], targets[n], gradients[n]);
+        model.backward_batch(gradients);
+        accumulate(inputs.size());
+        return total / static_cast<T>(inputs.size());
+    }
+
+    // Applies a partially accumulated batch, e.g. at the end of an epoch.
+    void flush() {
+        if (accumulated > 0) apply_update();
+    }
+
+    T current_learning_rate() const {
+        T lr = learning_rate;
+        if (config.scale_learning_rate) lr *= static_cast<T>(config.accumulation_steps);
+        if (updates < config.warmup_steps) {
+            lr *= static_cast<T>(updates + 1) / static_cast<T>(config.warmup_steps);
+        }
+        return lr;
+    }
+
+    // Starts over at update zero, e.g. after Model::reinitialize.
+    void reset(T lr) {
+        learning_rate = lr;
+        accumulated = 0;
+        updates = 0;
+    }
+
+    size_t update_count() const { return updates; }
+    // Samples accumulated since the last update; their summed gradients
+    // are in the layers' gradient buffers.
+    size_t accumulated_count() const { return accumulated; }
+
+    // Resumes the update count (and so the warmup schedule) and a partial
+    // accumulation, e.g. after the gradients were restored from a checkpoint.
+    void restore_progress(size_t update_count, size_t accumulated_count) {
+        updates = update_count;
+        accumulated = accumulated_count;
     }
-};
\ No newline at end of file
+};